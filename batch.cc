@@ -0,0 +1,141 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <batch.hh>
+#include <decompress.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi {
+
+bool collect(const std::string &path, std::vector< std::string > &files)
+{
+    std::error_code ec;
+
+    //
+    // Anything but a directory is passed through as is, to be reported by the
+    // identification:
+    //
+    if (!fs::is_directory(path, ec)) {
+        files.push_back(path);
+        return true;
+    }
+
+    const auto options = fs::directory_options::skip_permission_denied;
+    fs::recursive_directory_iterator iter(path, options, ec), last;
+
+    for (; !ec && iter != last; iter.increment(ec))
+        if (iter->is_regular_file(ec))
+            files.push_back(iter->path().string());
+
+    return !ec;
+}
+
+bool collect(std::istream &stream, std::vector< std::string > &files)
+{
+    bool success = true;
+
+    for (std::string s; std::getline(stream, s);)
+        if (!s.empty())
+            success = collect(s, files) && success;
+
+    return success;
+}
+
+namespace {
+
+template< detail::probe_t which >
+FOFI_TARGET_CLONES
+void probe(const buffer_t *bufs, const std::uint32_t *first,
+           const std::uint32_t *last, font_type *types)
+{
+    for (; first != last; ++first) {
+        const auto &buf = bufs[*first];
+
+        font_type type = FONT_UNKNOWN;
+        auto iter = buf.data;
+
+        //
+        // The compressed formats go with the unrecognized leading words:
+        //
+        if (!detail::probe(which, iter, buf.data + buf.size, type, 0) &&
+            !identify_compressed(buf.data, buf.size, type))
+            type = FONT_UNKNOWN;
+
+        types[*first] = type;
+    }
+}
+
+using probe_fn = void(*)(
+    const buffer_t *, const std::uint32_t *, const std::uint32_t *,
+    font_type *);
+
+const probe_fn probes[] = {
+    probe< detail::PROBE_NONE >,  probe< detail::PROBE_PFA >,
+    probe< detail::PROBE_PFB >,   probe< detail::PROBE_CFF >,
+    probe< detail::PROBE_TTF >,   probe< detail::PROBE_OTF >,
+    probe< detail::PROBE_DFONT >
+};
+
+static_assert(sizeof probes / sizeof *probes == detail::PROBE_MAX);
+
+} // anonymous namespace
+
+void identify(const buffer_t *bufs, size_t n, font_type *types, size_t jobs)
+{
+    using detail::PROBE_MAX;
+
+    ASSERT(n <= UINT32_MAX);
+
+    //
+    // A counting sort of the buffer indices by probe:
+    //
+    std::vector< unsigned char > which(n);
+    size_t counts[PROBE_MAX + 1] = { };
+
+    for (size_t i = 0; i < n; ++i) {
+        const auto &buf = bufs[i];
+
+        which[i] = detail::probe_for(
+            detail::leading_word(buf.data, buf.data + buf.size));
+
+        ++counts[which[i] + 1];
+    }
+
+    for (size_t i = 1; i <= PROBE_MAX; ++i)
+        counts[i] += counts[i - 1];
+
+    std::vector< std::uint32_t > order(n);
+
+    {
+        size_t next[PROBE_MAX];
+        std::copy(counts, counts + PROBE_MAX, next);
+
+        for (size_t i = 0; i < n; ++i)
+            order[next[which[i]]++] = i;
+    }
+
+    //
+    // Chunks of the sorted indices, each split where the probe changes:
+    //
+    static constexpr size_t chunk = 256;
+
+    parallel_for((n + chunk - 1) / chunk, jobs, [&](size_t c) {
+        const size_t first = c * chunk, last = std::min(n, first + chunk);
+
+        for (size_t p = 0; p < PROBE_MAX; ++p) {
+            const auto lo = std::max(first, counts[p]);
+            const auto hi = std::min(last, counts[p + 1]);
+
+            if (lo < hi)
+                probes[p](bufs, &order[lo], &order[0] + hi, types);
+        }
+    });
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,81 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_BATCH_HH
+#define FOFI_BATCH_HH
+
+#include <fofi.hh>
+#include <cache.hh>
+#include <pool.hh>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace xpdf::fofi {
+
+//
+// Appends all regular files underneath `path' to `files' if it is a directory,
+// or else `path' itself. Directory symlinks are not followed and unreadable
+// subdirectories are skipped. Returns false if the walk fails.
+//
+bool collect(const std::string &path, std::vector< std::string > &files);
+
+//
+// Same as above, for each non-empty line read from the stream.
+//
+bool collect(std::istream &, std::vector< std::string > &files);
+
+//
+// A font program in memory, e.g., a font stream embedded in a PDF:
+//
+struct buffer_t
+{
+    const char *data;
+    size_t size;
+};
+
+//
+// Identifies the `n' buffers and writes their types to the corresponding
+// elements of `types', FONT_UNKNOWN for the ones not recognized, on a pool
+// of `jobs' threads (0 for one per core). The buffers are sorted by their
+// leading word first, so that every probe runs over all of its candidates
+// in a row.
+//
+void identify(const buffer_t *bufs, size_t n, font_type *types,
+              size_t jobs = 0);
+
+//
+// Identifies all `files' on a pool of `jobs' threads (0 for one per core) and
+// reports each one as it completes via f(index, success, type), in no
+// particular order and possibly concurrently.
+//
+template< typename F >
+void identify(const std::vector< std::string > &files, size_t jobs, F &&f)
+{
+    parallel_for(files.size(), jobs, [&](size_t i) {
+        font_type type = FONT_UNKNOWN;
+        const bool success = identify(files[i].c_str(), type);
+        f(i, success, type);
+    });
+}
+
+//
+// Same as above, going through a cache of earlier results.
+//
+template< typename F >
+void identify(const std::vector< std::string > &files, size_t jobs, cache &c,
+              F &&f)
+{
+    parallel_for(files.size(), jobs, [&](size_t i) {
+        font_type type = FONT_UNKNOWN;
+        const bool success = identify(files[i].c_str(), type, c);
+        f(i, success, type);
+    });
+
+    c.flush();
+}
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_BATCH_HH
@@ -0,0 +1,748 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <atomic>
+#include <cstring>
+#include <forward_list>
+#include <fstream>
+#include <list>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include <fofi.hh>
+#include <batch.hh>
+#include <corpus.hh>
+#include <dedup.hh>
+#include <mapped.hh>
+#include <results.hh>
+#include <scan.hh>
+#include <server.hh>
+#include <shm.hh>
+#include <stats.hh>
+#include <verify.hh>
+#include <detail/fofi.hh>
+
+namespace {
+
+namespace corpus = xpdf::fofi::corpus;
+namespace detail = xpdf::fofi::detail;
+
+using xpdf::fofi::font_type;
+
+//
+// Samples are generated once, per kind and size, and live for the program:
+//
+const std::string &sample(corpus::kind_t kind, size_t size)
+{
+    static std::vector< std::pair< std::pair< int, size_t >, std::string > > xs;
+
+    const std::pair< int, size_t > key(kind, size);
+
+    for (const auto &[k, buf] : xs)
+        if (k == key)
+            return buf;
+
+    xs.emplace_back(key, corpus::generate(kind, size, kind));
+    return xs.back().second;
+}
+
+//
+// A temporary file with the sample, for the benchmarks that go through the
+// file system:
+//
+struct sample_file
+{
+    sample_file(const std::string &content)
+    {
+        char buf[] = "/tmp/fofi-bench.XXXXXX";
+
+        if (-1 != (fd = ::mkstemp(buf))) {
+            path = buf;
+            benchmark::DoNotOptimize(
+                ::write(fd, content.data(), content.size()));
+        }
+    }
+
+    ~sample_file()
+    {
+        if (-1 != fd) {
+            ::close(fd);
+            ::unlink(path.c_str());
+        }
+    }
+
+    int fd = -1;
+    std::string path;
+};
+
+void sizes(benchmark::internal::Benchmark *b)
+{
+    for (int kind = 0; kind < corpus::KIND_MAX; ++kind)
+        for (long size : { 64L, 4L << 10, 1L << 20 })
+            b->Args({ kind, size });
+}
+
+//
+// The parsers look at the headers only, the rate that matters is that of
+// fonts, not of bytes:
+//
+void label(benchmark::State &state, corpus::kind_t kind)
+{
+    state.SetLabel(corpus::name(kind));
+    state.SetItemsProcessed(state.iterations());
+}
+
+//
+// The content detection proper, over memory:
+//
+void identify(benchmark::State &state)
+{
+    const auto kind = corpus::kind_t(state.range(0));
+    const auto &buf = sample(kind, state.range(1));
+
+    for (auto _ : state) {
+        font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+        auto iter = buf.data();
+        benchmark::DoNotOptimize(
+            detail::identify(iter, buf.data() + buf.size(), type));
+        benchmark::DoNotOptimize(type);
+    }
+
+    label(state, kind);
+}
+
+BENCHMARK(identify)->Apply(sizes);
+
+//
+// Each probe, on a sample it accepts and on one it rejects:
+//
+template< typename F >
+void probe(benchmark::State &state, F f, corpus::kind_t kind)
+{
+    const auto &buf = sample(kind, state.range(0));
+
+    for (auto _ : state) {
+        font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+        auto iter = buf.data();
+        benchmark::DoNotOptimize(f(iter, buf.data() + buf.size(), type));
+        benchmark::DoNotOptimize(type);
+    }
+
+    label(state, kind);
+}
+
+#define PROBE(name, match, mismatch)                                    \
+    BENCHMARK_CAPTURE(                                                  \
+        probe, name ## _match, [](auto &iter, auto last, auto &type) {  \
+            return detail::name(iter, last, type);                      \
+        }, corpus::match)->Arg(4 << 10);                                \
+    BENCHMARK_CAPTURE(                                                  \
+        probe, name ## _mismatch, [](auto &iter, auto last, auto &type) { \
+            return detail::name(iter, last, type);                      \
+        }, corpus::mismatch)->Arg(4 << 10)
+
+PROBE(identify_pfa,   PFA,      PFB);
+PROBE(identify_pfb,   PFB,      PFA);
+PROBE(identify_cff,   CFF_CID,  TTF);
+PROBE(identify_ttf,   TTC,      OTF_CID);
+PROBE(identify_otf,   OTF_CID,  TTF);
+PROBE(identify_dfont, DFONT,    OTF_CID);
+
+#undef PROBE
+
+//
+// The structural walk of a CFF font, by the number of glyphs; the INDEX sizes
+// should not matter:
+//
+void parse_cff(benchmark::State &state, bool cid)
+{
+    const auto buf = corpus::make_cff_font(cid, state.range(0), 4);
+
+    for (auto _ : state) {
+        xpdf::fofi::cff_info info;
+        benchmark::DoNotOptimize(
+            xpdf::fofi::parse_cff(buf.data(), buf.size(), info));
+        benchmark::DoNotOptimize(info);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(parse_cff, 8bit, false)->Arg(16)->Arg(64 << 10);
+BENCHMARK_CAPTURE(parse_cff, cid, true)->Arg(16)->Arg(64 << 10);
+
+//
+// Bounds-checked advance over the three iterator categories, the way the
+// parsers skip over table data:
+//
+template< typename Container >
+void safe_advance(benchmark::State &state)
+{
+    const Container xs(state.range(0), 'x');
+
+    for (auto _ : state) {
+        auto iter = xs.begin();
+
+        while (detail::safe_advance(xs.begin(), iter, xs.end(), 16))
+            ;
+
+        benchmark::DoNotOptimize(iter);
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(safe_advance, std::forward_list< char >)->Arg(64 << 10);
+BENCHMARK_TEMPLATE(safe_advance, std::list< char >)->Arg(64 << 10);
+BENCHMARK_TEMPLATE(safe_advance, std::vector< char >)->Arg(64 << 10);
+
+//
+// The whole of it, from the path to the result:
+//
+void identify_file(benchmark::State &state)
+{
+    const auto kind = corpus::kind_t(state.range(0));
+    const auto &buf = sample(kind, state.range(1));
+
+    sample_file file(buf);
+
+    for (auto _ : state) {
+        font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+        benchmark::DoNotOptimize(
+            xpdf::fofi::identify(file.path.c_str(), type));
+        benchmark::DoNotOptimize(type);
+    }
+
+    label(state, kind);
+}
+
+BENCHMARK(identify_file)->Apply(sizes);
+
+void identify_stream(benchmark::State &state)
+{
+    const auto kind = corpus::kind_t(state.range(0));
+    const auto &buf = sample(kind, state.range(1));
+
+    for (auto _ : state) {
+        std::stringbuf sb(buf);
+        font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+        benchmark::DoNotOptimize(xpdf::fofi::identify(sb, type));
+        benchmark::DoNotOptimize(type);
+    }
+
+    label(state, kind);
+}
+
+BENCHMARK(identify_stream)->Apply(sizes);
+
+//
+// Mixed buffers, one at a time and all at once:
+//
+std::vector< xpdf::fofi::buffer_t > mixed_buffers(size_t n)
+{
+    std::vector< xpdf::fofi::buffer_t > bufs;
+
+    for (size_t i = 0; i < n; ++i) {
+        const auto kind = corpus::kind_t(i % corpus::KIND_MAX);
+        const auto &buf = sample(kind, 4 << 10);
+        bufs.push_back({ buf.data(), buf.size() });
+    }
+
+    return bufs;
+}
+
+void identify_buffers(benchmark::State &state)
+{
+    const auto bufs = mixed_buffers(state.range(0));
+
+    for (auto _ : state) {
+        for (const auto &buf : bufs) {
+            font_type type = xpdf::fofi::FONT_UNKNOWN;
+            benchmark::DoNotOptimize(
+                xpdf::fofi::identify(buf.data, buf.size, type));
+        }
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * bufs.size());
+}
+
+BENCHMARK(identify_buffers)->Arg(4096);
+
+void identify_batch(benchmark::State &state)
+{
+    const auto bufs = mixed_buffers(state.range(0));
+    std::vector< font_type > types(bufs.size());
+
+    for (auto _ : state) {
+        xpdf::fofi::identify(bufs.data(), bufs.size(), types.data(), 1);
+        benchmark::DoNotOptimize(types.data());
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * bufs.size());
+}
+
+BENCHMARK(identify_batch)->Arg(4096);
+
+//
+// Searching a blob for embedded fonts, with each implementation of the scan
+// and by probing at every offset:
+//
+const std::string &blob()
+{
+    static const std::string s = [] {
+        std::string s;
+
+        for (int i = 0; s.size() < (1 << 20); ++i) {
+            //
+            // Without the signature the noise starts with:
+            //
+            s += corpus::generate(corpus::NOISE, 64 << 10, i).substr(16);
+            s += sample(corpus::kind_t(i % corpus::TRUNCATED_OTF), 4 << 10);
+        }
+
+        return s;
+    }();
+
+    return s;
+}
+
+void scan(benchmark::State &state, xpdf::fofi::scan_impl_t impl)
+{
+    const auto &s = blob();
+    std::vector< xpdf::fofi::scan_hit > hits;
+
+    for (auto _ : state) {
+        hits.clear();
+        benchmark::DoNotOptimize(
+            xpdf::fofi::scan(s.data(), s.size(), hits, impl));
+    }
+
+    state.SetLabel(std::to_string(hits.size()) + " hits");
+    state.SetBytesProcessed(int64_t(state.iterations()) * s.size());
+}
+
+BENCHMARK_CAPTURE(scan, scalar, xpdf::fofi::SCAN_SCALAR);
+BENCHMARK_CAPTURE(scan, sse2, xpdf::fofi::SCAN_SSE2);
+BENCHMARK_CAPTURE(scan, avx2, xpdf::fofi::SCAN_AVX2);
+
+void scan_every_offset(benchmark::State &state)
+{
+    const auto &s = blob();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < s.size(); ++i) {
+            font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+            const char *iter = s.data() + i, *last = s.data() + s.size();
+            benchmark::DoNotOptimize(detail::identify(iter, last, type));
+        }
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * s.size());
+}
+
+BENCHMARK(scan_every_offset);
+
+//
+// The table checksums, with each implementation, and the verification of a
+// font with all of its tables summed:
+//
+void checksum(benchmark::State &state, xpdf::fofi::scan_impl_t impl)
+{
+    const auto &s = blob();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            xpdf::fofi::checksum(s.data(), s.size(), impl));
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * s.size());
+}
+
+BENCHMARK_CAPTURE(checksum, scalar, xpdf::fofi::SCAN_SCALAR);
+BENCHMARK_CAPTURE(checksum, sse2, xpdf::fofi::SCAN_SSE2);
+BENCHMARK_CAPTURE(checksum, avx2, xpdf::fofi::SCAN_AVX2);
+
+void verify(benchmark::State &state)
+{
+    std::string glyf(state.range(0), '\0');
+
+    for (size_t i = 0; i < glyf.size(); ++i)
+        glyf[i] = char(i * 2654435761U >> 24);
+
+    const auto buf = corpus::seal_sfnt(corpus::make_sfnt(
+        std::string("\x00\x01\x00\x00", 4),
+        { { "head", std::string(56, '\0') }, { "glyf", glyf } }));
+
+    for (auto _ : state) {
+        xpdf::fofi::verify_result result;
+        benchmark::DoNotOptimize(
+            xpdf::fofi::verify(buf.data(), buf.size(), result));
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * buf.size());
+}
+
+BENCHMARK(verify)->Arg(4 << 10)->Arg(1 << 20);
+
+//
+// The content hash of the dedup index, over the blob:
+//
+void hash64(benchmark::State &state)
+{
+    const auto &s = blob();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(xpdf::fofi::hash64(s.data(), s.size()));
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * s.size());
+}
+
+BENCHMARK(hash64);
+
+//
+// Round trips to a server in the same process, one request at a time and
+// `range(0)' requests in flight:
+//
+void identify_server(benchmark::State &state)
+{
+    const auto path = "/tmp/fofi-bench-" + std::to_string(::getpid());
+
+    xpdf::fofi::server server(path.c_str());
+    std::thread thread([&] { server.run(); });
+
+    sample_file file(sample(corpus::OTF_CID, 4 << 10));
+
+    {
+        xpdf::fofi::client client(path.c_str());
+        const size_t depth = state.range(0);
+
+        for (auto _ : state) {
+            for (size_t i = 0; i < depth; ++i)
+                client.send_path(i, file.path.c_str());
+
+            xpdf::fofi::response_t res;
+
+            for (size_t i = 0; i < depth; ++i)
+                benchmark::DoNotOptimize(client.receive(res));
+        }
+
+        state.SetItemsProcessed(int64_t(state.iterations()) * depth);
+    }
+
+    server.stop();
+    thread.join();
+}
+
+BENCHMARK(identify_server)->Arg(1)->Arg(64)->UseRealTime();
+
+//
+// Fonts classified through a shared memory ring by a consumer thread, with
+// `range(0)' requests in flight:
+//
+void identify_shm(benchmark::State &state)
+{
+    const auto &buf = sample(corpus::OTF_CID, 4 << 10);
+
+    xpdf::fofi::shm_ring ring(state.range(0), buf.size());
+    std::copy(buf.begin(), buf.end(), ring.data());
+
+    std::atomic< bool > done(false);
+
+    std::thread consumer([&] {
+        while (!done)
+            if (0 == ring.serve())
+                std::this_thread::yield();
+    });
+
+    const size_t depth = ring.capacity();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < depth; ++i)
+            ring.submit(i, 0, buf.size());
+
+        xpdf::fofi::shm_result result;
+
+        for (size_t i = 0; i < depth; ++i)
+            while (!ring.collect(result))
+                std::this_thread::yield();
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * depth);
+
+    done = true;
+    consumer.join();
+}
+
+BENCHMARK(identify_shm)->Arg(1)->Arg(64)->UseRealTime();
+
+//
+// A large OpenType font read cold, the file evicted before every run, through
+// a plain mapping (0), a planned one (1) or the pread reader (2). The faults
+// and the pages of the file left in the page cache are counted per run.
+//
+void identify_cold(benchmark::State &state)
+{
+    sample_file file(corpus::make_otf(corpus::make_cff(true, 8 << 20), 4096));
+
+    const size_t size = (8 << 20) + 4096;
+    const size_t page = ::sysconf(_SC_PAGESIZE);
+
+    //
+    // Dirty pages would not be evicted:
+    //
+    ::fdatasync(file.fd);
+
+    size_t faults = 0, resident = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        ::posix_fadvise(file.fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        struct rusage before, after;
+        ::getrusage(RUSAGE_THREAD, &before);
+        state.ResumeTiming();
+
+        xpdf::fofi::font_type type;
+
+        switch (state.range(0)) {
+        case 0: {
+            void *p = ::mmap(0, size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+
+            benchmark::DoNotOptimize(xpdf::fofi::identify(
+                static_cast< const char * >(p), size, type));
+
+            ::munmap(p, size);
+            break;
+        }
+
+        case 1:
+            benchmark::DoNotOptimize(
+                xpdf::fofi::identify_mapped(file.path.c_str(), type));
+            break;
+
+        default:
+            benchmark::DoNotOptimize(
+                xpdf::fofi::identify(file.path.c_str(), type));
+            break;
+        }
+
+        state.PauseTiming();
+        ::getrusage(RUSAGE_THREAD, &after);
+
+        faults += after.ru_minflt - before.ru_minflt +
+            after.ru_majflt - before.ru_majflt;
+
+        //
+        // The pages of the file in the page cache:
+        //
+        void *p = ::mmap(0, size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+        std::vector< unsigned char > vec((size + page - 1) / page);
+
+        ::mincore(p, size, vec.data());
+        ::munmap(p, size);
+
+        for (auto x : vec)
+            resident += x & 1;
+
+        state.ResumeTiming();
+    }
+
+    state.counters["faults"] = benchmark::Counter(
+        faults, benchmark::Counter::kAvgIterations);
+    state.counters["cached_pages"] = benchmark::Counter(
+        resident, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(identify_cold)->DenseRange(0, 2)->Iterations(200);
+
+//
+// The results of a scan of 100,000 files, as `path : type' lines and as a
+// columnar file:
+//
+constexpr size_t nresults = 100000;
+
+std::string result_path(size_t i)
+{
+    return "/usr/share/fonts/" + std::to_string(i % 97) + "/font-" +
+        std::to_string(i) + ".ttf";
+}
+
+const std::string &results_text()
+{
+    static const std::string text = [] {
+        std::string s;
+
+        for (size_t i = 0; i < nresults; ++i)
+            s += result_path(i) + " : " + xpdf::fofi::stats::type_name(
+                xpdf::fofi::font_type(i % 10)) + "\n";
+
+        return s;
+    }();
+
+    return text;
+}
+
+const char *results_path()
+{
+    static const std::string path = [] {
+        const auto path = "/tmp/fofi-bench-results-" +
+            std::to_string(::getpid());
+
+        xpdf::fofi::results_writer writer;
+        struct stat st = { };
+
+        for (size_t i = 0; i < nresults; ++i)
+            writer.add(result_path(i), xpdf::fofi::font_type(i % 10), st);
+
+        writer.write(path.c_str());
+        std::atexit([] { ::unlink(results_path()); });
+
+        return path;
+    }();
+
+    return path.c_str();
+}
+
+//
+// Counting the fonts of every type, parsing the lines back:
+//
+void count_text(benchmark::State &state)
+{
+    const auto &text = results_text();
+
+    std::unordered_map< std::string_view, size_t > types;
+
+    for (size_t i = 0; i <= xpdf::fofi::FONT_ERROR; ++i)
+        types[xpdf::fofi::stats::type_name(xpdf::fofi::font_type(i))] = i;
+
+    for (auto _ : state) {
+        size_t counts[xpdf::fofi::FONT_ERROR + 1] = { };
+
+        for (size_t pos = 0; pos < text.size();) {
+            const auto eol = text.find('\n', pos);
+            const std::string_view line(text.data() + pos, eol - pos);
+
+            const auto sep = line.rfind(" : ");
+            ++counts[types[line.substr(sep + 3)]];
+
+            pos = eol + 1;
+        }
+
+        benchmark::DoNotOptimize(counts);
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * nresults);
+}
+
+BENCHMARK(count_text);
+
+//
+// The same, mapping the columnar file and walking the type column:
+//
+void count_columns(benchmark::State &state)
+{
+    const auto path = results_path();
+
+    for (auto _ : state) {
+        xpdf::fofi::results_file results(path);
+
+        size_t counts[xpdf::fofi::FONT_ERROR + 1] = { };
+
+        for (size_t i = 0; i < results.size(); ++i)
+            ++counts[results.type(i)];
+
+        benchmark::DoNotOptimize(counts);
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * nresults);
+}
+
+BENCHMARK(count_columns);
+
+//
+// Joins by path, one lookup at a time:
+//
+void find_columns(benchmark::State &state)
+{
+    xpdf::fofi::results_file results(results_path());
+
+    size_t i = 0;
+
+    for (auto _ : state) {
+        const auto path = result_path(i++ * 7919 % nresults);
+        benchmark::DoNotOptimize(results.find(path));
+    }
+}
+
+BENCHMARK(find_columns);
+
+//
+// Writes the samples to `dir', e.g., as training input for profile-guided
+// builds:
+//
+bool write_corpus(const fs::path &dir)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    if (ec)
+        return false;
+
+    for (int kind = 0; kind < corpus::KIND_MAX; ++kind) {
+        for (size_t size : { 64, 4 << 10, 1 << 20 }) {
+            const auto &buf = sample(corpus::kind_t(kind), size);
+
+            const auto path = dir / (std::string(corpus::name(
+                corpus::kind_t(kind))) + "-" + std::to_string(size));
+
+            std::ofstream out(path, std::ios::binary);
+
+            if (!out.write(buf.data(), buf.size()))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    static const char corpus_opt[] = "--corpus=";
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strncmp(argv[i], corpus_opt, sizeof corpus_opt - 1)) {
+            return write_corpus(argv[i] + sizeof corpus_opt - 1)
+                ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return EXIT_FAILURE;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,416 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cache.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+const char signature[16] = "fofi-cache-0001";
+
+bool write_all(int fd, const void *pbuf, size_t n)
+{
+    for (auto p = static_cast< const char * >(pbuf); n;) {
+        const auto result = ::write(fd, p, n);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        p += result;
+        n -= result;
+    }
+
+    return true;
+}
+
+//
+// The logs with fewer records are not compacted, see cache::compact:
+//
+constexpr size_t min_compact = 1024;
+
+//
+// Locks the log at `path' exclusively. If the file open as `fd' was replaced
+// by a compaction in the meantime, `fd' is moved over to the new one first:
+//
+struct lock_t
+{
+    lock_t(int fd, const std::string &path) : fd(fd)
+    {
+        for (;;) {
+            ::flock(fd, LOCK_EX);
+
+            struct stat a, b;
+
+            if (0 != ::stat(path.c_str(), &a) || 0 != ::fstat(fd, &b) ||
+                (a.st_dev == b.st_dev && a.st_ino == b.st_ino))
+                return;
+
+            const int x = ::open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+
+            if (x < 0)
+                return;
+
+            //
+            // Which drops the lock on the replaced file:
+            //
+            ::dup3(x, fd, O_CLOEXEC);
+            ::close(x);
+        }
+    }
+
+    ~lock_t() { ::flock(fd, LOCK_UN); }
+
+    int fd;
+};
+
+} // anonymous namespace
+
+cache::cache(const char *filepath) : path(filepath)
+{
+    static_assert(sizeof(record_t) == 40);
+
+    fd = ::open(filepath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        return;
+
+    bool success = false;
+
+    {
+        lock_t lock(fd, path);
+
+        struct stat st;
+
+        if (0 == ::fstat(fd, &st)) {
+            if (0 == st.st_size) {
+                success = write_all(fd, signature, sizeof signature);
+            } else {
+                char buf[sizeof signature] = { 0 };
+
+                success = sizeof buf == ::pread(fd, buf, sizeof buf, 0) &&
+                    0 == memcmp(buf, signature, sizeof buf);
+            }
+        }
+
+        if (success) {
+            refresh();
+            compact();
+        }
+    }
+
+    if (!success) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+cache::~cache()
+{
+    flush();
+
+    if (base)
+        ::munmap(const_cast< char * >(base), size);
+
+    if (fd >= 0)
+        ::close(fd);
+}
+
+std::uint32_t cache::checksum(const record_t &rec)
+{
+    //
+    // Catches torn writes and the zero padding, see flush_:
+    //
+    auto h = rec.dev * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ rec.ino) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ rec.size) * 0x94d049bb133111ebULL;
+    h = (h ^ std::uint64_t(rec.mtime)) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ rec.type) * 0xbf58476d1ce4e5b9ULL;
+
+    return std::uint32_t(h ^ h >> 32) ^ 0x6f666f66;
+}
+
+cache::record_t cache::make_record(const struct stat &st, font_type type)
+{
+    record_t rec;
+
+    rec.dev = st.st_dev;
+    rec.ino = st.st_ino;
+    rec.size = st.st_size;
+    rec.mtime = std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    rec.type = type;
+    rec.check = checksum(rec);
+
+    return rec;
+}
+
+void cache::refresh()
+{
+    struct stat st;
+
+    if (0 != ::fstat(fd, &st))
+        return;
+
+    //
+    // A log replaced by a compaction is indexed again from the start:
+    //
+    if (base && (st.st_dev != dev || st.st_ino != ino)) {
+        ::munmap(const_cast< char * >(base), size);
+
+        base = 0;
+        size = indexed = 0;
+    }
+
+    if (size_t(st.st_size) <= size)
+        return;
+
+    if (base)
+        ::munmap(const_cast< char * >(base), size);
+
+    auto p = ::mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        base = 0;
+        size = indexed = 0;
+        return;
+    }
+
+    base = static_cast< const char * >(p);
+    size = st.st_size;
+
+    dev = st.st_dev;
+    ino = st.st_ino;
+
+    if (indexed < sizeof signature)
+        indexed = sizeof signature;
+
+    for (; indexed + sizeof(record_t) <= size; indexed += sizeof(record_t)) {
+        record_t rec;
+        memcpy(&rec, base + indexed, sizeof rec);
+
+        if (rec.type < FONT_ERROR && checksum(rec) == rec.check)
+            index[{ rec.dev, rec.ino }] = rec;
+    }
+}
+
+bool cache::lookup(const struct stat &st, font_type &result)
+{
+    if (fd < 0)
+        return false;
+
+    const auto rec = make_record(st, FONT_UNKNOWN);
+
+    const auto find = [&]() {
+        const auto iter = index.find({ rec.dev, rec.ino });
+
+        if (iter == index.end() || iter->second.size != rec.size ||
+            iter->second.mtime != rec.mtime)
+            return false;
+
+        result = font_type(iter->second.type);
+        return true;
+    };
+
+    size_t known;
+    dev_t known_dev;
+    ino_t known_ino;
+
+    {
+        std::shared_lock< std::shared_mutex > lock(mtx);
+
+        if (find())
+            return true;
+
+        known = size;
+        known_dev = dev;
+        known_ino = ino;
+    }
+
+    //
+    // A miss re-maps only if the log grew or was replaced since it was last
+    // mapped, and the log is looked at without the lock:
+    //
+    struct stat log;
+
+    if (0 != ::fstat(fd, &log) ||
+        (size_t(log.st_size) <= known && log.st_dev == known_dev &&
+         log.st_ino == known_ino && 0 != log.st_nlink))
+        return false;
+
+    //
+    // A log no longer linked was replaced by a compaction elsewhere; the
+    // lock moves over to the new one, see lock_t:
+    //
+    if (0 == log.st_nlink) {
+        std::lock_guard< std::mutex > serial(flush_mtx);
+        lock_t follow(fd, path);
+    }
+
+    std::lock_guard< std::shared_mutex > lock(mtx);
+
+    refresh();
+    return find();
+}
+
+void cache::insert(const struct stat &st, font_type type)
+{
+    if (fd < 0)
+        return;
+
+    const auto rec = make_record(st, type);
+
+    {
+        std::lock_guard< std::shared_mutex > lock(mtx);
+        index[{ rec.dev, rec.ino }] = rec;
+    }
+
+    std::vector< record_t > full;
+
+    {
+        std::lock_guard< std::mutex > lock(pending_mtx);
+        pending.push_back(rec);
+
+        if (pending.size() >= 256)
+            full.swap(pending);
+    }
+
+    flush_(full);
+}
+
+void cache::flush()
+{
+    if (fd < 0)
+        return;
+
+    std::vector< record_t > records;
+
+    {
+        std::lock_guard< std::mutex > lock(pending_mtx);
+        records.swap(pending);
+    }
+
+    flush_(records);
+}
+
+void cache::flush_(std::vector< record_t > &records)
+{
+    if (records.empty())
+        return;
+
+    //
+    // The flock is shared by the threads, being on the open file:
+    //
+    std::lock_guard< std::mutex > serial(flush_mtx);
+
+    lock_t lock(fd, path);
+
+    struct stat st;
+
+    if (0 == ::fstat(fd, &st)) {
+        //
+        // A torn append by a process that died would shift all subsequent
+        // records; pad the log back into alignment first:
+        //
+        const auto n = (st.st_size - sizeof signature) % sizeof(record_t);
+
+        static const char zeroes[sizeof(record_t)] = { 0 };
+
+        if (0 == n || write_all(fd, zeroes, sizeof(record_t) - n))
+            write_all(fd, records.data(), records.size() * sizeof(record_t));
+    }
+
+    std::lock_guard< std::shared_mutex > guard(mtx);
+
+    refresh();
+    compact();
+}
+
+void cache::compact()
+{
+    //
+    // Only once the dead records, superseded or torn, are more than half of
+    // the log:
+    //
+    if (0 == base)
+        return;
+
+    const size_t n = (indexed - sizeof signature) / sizeof(record_t);
+
+    if (n < min_compact || n <= 2 * index.size())
+        return;
+
+    std::vector< record_t > live;
+    live.reserve(index.size());
+
+    for (const auto &entry : index)
+        live.push_back(entry.second);
+
+    std::string temp = path + ".XXXXXX";
+
+    const int x = ::mkostemp(&temp[0], O_APPEND | O_CLOEXEC);
+
+    if (x < 0)
+        return;
+
+    const bool success = 0 == ::fchmod(x, 0644) &&
+        write_all(x, signature, sizeof signature) &&
+        write_all(x, live.data(), live.size() * sizeof(record_t)) &&
+        0 == ::fdatasync(x) && 0 == ::rename(temp.c_str(), path.c_str());
+
+    if (!success) {
+        ::close(x);
+        ::unlink(temp.c_str());
+        return;
+    }
+
+    //
+    // The other processes move over the next time they lock the log, see
+    // lock_t; this one does right away:
+    //
+    ::dup3(x, fd, O_CLOEXEC);
+    ::close(x);
+
+    refresh();
+}
+
+bool identify(const char *filepath, xpdf::fofi::font_type &result, cache &c)
+{
+    struct stat st;
+
+    if (0 != ::stat(filepath, &st))
+        return result = FONT_ERROR, false;
+
+    if (c.lookup(st, result))
+        return result != FONT_UNKNOWN;
+
+    result = FONT_UNKNOWN;
+    const bool success = identify(filepath, result);
+
+    if (success || result == FONT_UNKNOWN) {
+        //
+        // Only if the file did not change while it was being read:
+        //
+        struct stat after;
+
+        if (0 == ::stat(filepath, &after) && after.st_ino == st.st_ino &&
+            after.st_size == st.st_size &&
+            after.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+            after.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+            c.insert(st, result);
+    }
+
+    return success;
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,123 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_CACHE_HH
+#define FOFI_CACHE_HH
+
+#include <fofi.hh>
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace xpdf::fofi {
+
+//
+// A persistent cache of identification results, keyed by the device, inode,
+// size and modification time of the files. Files that were read but not
+// recognized are cached as FONT_UNKNOWN; read errors are not cached.
+//
+// The cache file is an append-only log of fixed-size, checksummed records. It
+// is mapped and indexed when opened, and re-mapped when a lookup misses and
+// the file has grown, which picks up the records appended by other processes
+// in the meantime. Appends are buffered and written under an exclusive flock,
+// the last record for a file winning. A cache that cannot be opened is empty
+// and ignores insertions.
+//
+// Once more than half of the records of a log of some size are dead, i.e.,
+// superseded by later ones for the same files or torn, the live ones are
+// written to a new log that is renamed over the file, under the flock. The
+// other processes follow it the next time they append.
+//
+// Lookups that hit share the index; only the re-mapping and the insertions
+// take it exclusively, and the buffered appends are written without it.
+//
+struct cache
+{
+    explicit cache(const char *filepath);
+    ~cache();
+
+    cache(const cache &) = delete;
+    cache &operator=(const cache &) = delete;
+
+    bool is_open() const { return fd >= 0; }
+
+    bool lookup(const struct stat &, font_type &);
+    void insert(const struct stat &, font_type);
+
+    //
+    // Writes out the buffered insertions:
+    //
+    void flush();
+
+private:
+    struct record_t
+    {
+        std::uint64_t dev, ino, size;
+        std::int64_t mtime;
+        std::uint32_t type, check;
+    };
+
+    struct key_t
+    {
+        std::uint64_t dev, ino;
+
+        bool operator==(const key_t &other) const
+        {
+            return dev == other.dev && ino == other.ino;
+        }
+    };
+
+    struct hash_t
+    {
+        size_t operator()(const key_t &key) const
+        {
+            return key.ino * 0x9e3779b97f4a7c15ULL ^ key.dev;
+        }
+    };
+
+    static std::uint32_t checksum(const record_t &);
+    static record_t make_record(const struct stat &, font_type);
+
+    void refresh();
+    void compact();
+    void flush_(std::vector< record_t > &);
+
+private:
+    //
+    // The index and the mapping; the buffered appends have a lock of their
+    // own, so that writing them out does not hold up the lookups:
+    //
+    std::shared_mutex mtx;
+    std::mutex pending_mtx, flush_mtx;
+
+    std::unordered_map< key_t, record_t, hash_t > index;
+    std::vector< record_t > pending;
+
+    std::string path;
+    int fd = -1;
+
+    //
+    // The mapping of the log, and the file it is of:
+    //
+    const char *base = 0;
+    size_t size = 0, indexed = 0;
+
+    dev_t dev = 0;
+    ino_t ino = 0;
+};
+
+//
+// Same as identify(const char *, font_type &), going through the cache; a file
+// whose stat data matches a cached record is not read at all.
+//
+bool identify(const char *, xpdf::fofi::font_type &, cache &);
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_CACHE_HH
@@ -0,0 +1,497 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_CORPUS_HH
+#define FOFI_CORPUS_HH
+
+#include <defs.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// Synthetic font images, for tests and benchmarks: well-formed headers of all
+// the supported formats, of configurable sizes, and malformed ones that make
+// the parsers walk as far as they can. No real font files needed, and the
+// same parameters make the same bytes.
+//
+namespace xpdf::fofi::corpus {
+
+inline std::string be32(size_t n)
+{
+    std::string s;
+
+    for (int i = 24; i >= 0; i -= 8)
+        s += char((n >> i) & 0xff);
+
+    return s;
+}
+
+inline std::string be16(size_t n)
+{
+    return be32(n).substr(2);
+}
+
+inline std::string le32(size_t n)
+{
+    std::string s;
+
+    for (int i = 0; i < 32; i += 8)
+        s += char((n >> i) & 0xff);
+
+    return s;
+}
+
+//
+// A Type 1 font program header, padded with comment lines to `size':
+//
+inline std::string make_pfa(size_t size = 0)
+{
+    std::string s = "%!PS-AdobeFont-1.0: Synthetic 001.000\n";
+
+    while (s.size() < size)
+        s += "% padding\n";
+
+    return s;
+}
+
+//
+// The same, in the first ASCII segment of a PFB:
+//
+inline std::string make_pfb(size_t size = 0)
+{
+    const auto pfa = make_pfa(size > 6 ? size - 6 : 0);
+    return std::string("\x80\x01", 2) + le32(pfa.size()) + pfa;
+}
+
+//
+// A CFF font with one name and a Top DICT with a ROS operator for a CID font,
+// or a CharStrings one otherwise, padded to `size':
+//
+inline std::string make_cff(bool cid, size_t size = 0)
+{
+    std::string s("\x01\x00\x04\x01", 4);
+
+    s += std::string("\x00\x01\x01\x01\x02" "A", 6);
+
+    if (cid)
+        s += std::string("\x00\x01\x01\x01\x06" "\x8b\x8b\x8b\x0c\x1e", 10);
+    else
+        s += std::string("\x00\x01\x01\x01\x03" "\x8b\x11", 7);
+
+    if (s.size() < size)
+        s.resize(size, '\0');
+
+    return s;
+}
+
+//
+// A CFF INDEX of the given elements, with the smallest offset size that fits:
+//
+inline std::string cff_index(const std::vector< std::string > &xs)
+{
+    if (xs.empty())
+        return be16(0);
+
+    size_t total = 1;
+
+    for (const auto &x : xs)
+        total += x.size();
+
+    const size_t off_size =
+        total < 0x100 ? 1 : total < 0x10000 ? 2 : total < 0x1000000 ? 3 : 4;
+
+    std::string s = be16(xs.size()) + char(off_size), data;
+
+    const auto offset = [&](size_t n) {
+        s += be32(n).substr(4 - off_size);
+    };
+
+    offset(1);
+
+    for (const auto &x : xs) {
+        data += x;
+        offset(data.size() + 1);
+    }
+
+    return s + data;
+}
+
+//
+// A DICT integer operand, always in the five-byte form so that offsets can be
+// filled in once the font is laid out:
+//
+inline std::string cff_int(size_t n)
+{
+    return '\x1d' + be32(n);
+}
+
+//
+// A structurally complete CFF font: a Top DICT with CharStrings, for `nglyphs'
+// glyphs, and a Private DICT with local Subrs; for a CID font, an FDArray and
+// FDSelect, with a Private DICT for each of the `nfds' Font DICTs.
+//
+inline std::string make_cff_font(bool cid, size_t nglyphs, size_t nfds = 1)
+{
+    //
+    // Two bytes of Private DICT, Subrs at 2, followed by the Subrs INDEX:
+    //
+    const std::string private_dict =
+        std::string("\x8d\x13", 2) + cff_index({ "\x0b" });
+
+    const auto header = std::string("\x01\x00\x04\x04", 4);
+    const auto names = cff_index({ "Synthetic" });
+    const auto strings = cff_index({ "Adobe", "Identity" });
+    const auto gsubrs = cff_index({ });
+    const auto charstrings = cff_index(
+        std::vector< std::string >(nglyphs, "\x0e"));
+
+    const auto top_dict = [&](size_t off) {
+        const auto charstrings_off = off;
+        off += charstrings.size();
+
+        std::string s;
+
+        if (cid) {
+            s += cff_int(391) + cff_int(392) + cff_int(0) + "\x0c\x1e";
+            s += cff_int(charstrings_off) + "\x11";
+
+            const size_t fdarray = off;
+            off += cff_index(std::vector< std::string >(
+                nfds, std::string(11, '\0'))).size();
+
+            s += cff_int(fdarray) + "\x0c\x24";
+            s += cff_int(off) + "\x0c\x25";
+        } else {
+            s += cff_int(charstrings_off) + "\x11";
+            s += cff_int(2) + cff_int(off) + "\x12";
+        }
+
+        return s;
+    };
+
+    //
+    // The Top DICT size does not depend on the offsets in it:
+    //
+    const size_t top_size = cff_index({ top_dict(0) }).size();
+
+    size_t off = header.size() + names.size() + top_size + strings.size() +
+        gsubrs.size();
+
+    auto s = header + names + cff_index({ top_dict(off) }) + strings +
+        gsubrs + charstrings;
+
+    if (cid) {
+        off = s.size() + cff_index(std::vector< std::string >(
+            nfds, std::string(11, '\0'))).size() + 1 + nglyphs;
+
+        std::vector< std::string > fds;
+
+        for (size_t i = 0; i < nfds; ++i)
+            fds.push_back(
+                cff_int(2) + cff_int(off + i * private_dict.size()) + "\x12");
+
+        s += cff_index(fds) + '\0';
+
+        for (size_t i = 0; i < nglyphs; ++i)
+            s += char(i % nfds);
+
+        for (size_t i = 0; i < nfds; ++i)
+            s += private_dict;
+    } else {
+        s += private_dict;
+    }
+
+    return s;
+}
+
+//
+// An OpenType font with a single CFF table, at `off':
+//
+inline std::string make_otf(const std::string &cff, size_t off)
+{
+    std::string s("OTTO\x00\x01\x00\x10\x00\x00\x00\x00", 12);
+
+    s += "CFF " + be32(0) + be32(off) + be32(cff.size());
+
+    s.resize(off, '\0');
+    return s + cff;
+}
+
+//
+// An sfnt with the given version tag and tables, laid out in order right after
+// the table directory, to be placed at `base' in the file:
+//
+inline std::string
+make_sfnt(const std::string &tag,
+          const std::vector< std::pair< std::string, std::string > > &tables,
+          size_t base = 0)
+{
+    std::string s = tag, data;
+
+    s += be16(tables.size());
+    s += std::string(6, '\0');
+
+    size_t off = base + 12 + 16 * tables.size();
+
+    for (const auto &[name, content] : tables) {
+        s += name + be32(0) + be32(off + data.size()) + be32(content.size());
+        data += content;
+    }
+
+    return s + data;
+}
+
+//
+// The sum of the big-endian words of [off, off + len), the last one padded with
+// zeros, the slow and obvious way:
+//
+inline std::uint32_t
+sfnt_checksum(const std::string &s, size_t off, size_t len)
+{
+    std::uint32_t sum = 0;
+
+    for (size_t i = 0; i < len; ++i)
+        sum += std::uint32_t(std::uint8_t(s[off + i])) << (24 - 8 * (i % 4));
+
+    return sum;
+}
+
+//
+// Fills in the table checksums of the face at `base' in `s' and, if asked to,
+// the head checkSumAdjustment that makes the whole of `s' sum up right:
+//
+inline std::string
+seal_sfnt(std::string s, size_t base = 0, bool adjust = true)
+{
+    const auto at = [&](size_t off) {
+        return size_t(sfnt_checksum(s, off, 4));
+    };
+
+    const size_t ntables = at(base + 4) >> 16;
+
+    size_t head = 0;
+
+    for (size_t i = 0; i < ntables; ++i) {
+        const size_t rec = base + 12 + 16 * i;
+
+        auto sum = sfnt_checksum(s, at(rec + 8), at(rec + 12));
+
+        //
+        // The checksum of head is made with checkSumAdjustment as zero:
+        //
+        if (s.compare(rec, 4, "head") == 0) {
+            head = at(rec + 8);
+            sum -= at(head + 8);
+
+            if (adjust)
+                s.replace(head + 8, 4, be32(0));
+        }
+
+        s.replace(rec + 4, 4, be32(sum));
+    }
+
+    if (adjust && head)
+        s.replace(head + 8, 4,
+                  be32(0xb1b0afba - sfnt_checksum(s, 0, s.size())));
+
+    return s;
+}
+
+//
+// A collection of sfnt faces, each of which must have been made for its
+// offset in the collection, see make_sfnt:
+//
+inline std::string make_ttc(const std::vector< std::string > &faces)
+{
+    std::string s = "ttcf" + be32(0x00010000) + be32(faces.size()), data;
+
+    const size_t base = s.size() + 4 * faces.size();
+
+    for (const auto &face : faces) {
+        s += be32(base + data.size());
+        data += face;
+    }
+
+    return s + data;
+}
+
+//
+// A resource fork with the faces as sfnt resources:
+//
+inline std::string make_dfont(const std::vector< std::string > &faces)
+{
+    std::string data, refs;
+
+    for (size_t i = 0; i < faces.size(); ++i) {
+        refs += be16(128 + i) + be16(0xffff) + '\0' + be32(data.size()).substr(1);
+        refs += be32(0);
+
+        data += be32(faces[i].size()) + faces[i];
+    }
+
+    std::string map(16 + 4 + 2 + 2, '\0');
+
+    map += be16(28) + be16(28 + 2 + 8 + refs.size());
+    map += be16(0) + "sfnt" + be16(faces.size() - 1) + be16(2 + 8) + refs;
+
+    std::string s = be32(256) + be32(256 + data.size()) + be32(data.size()) +
+        be32(map.size());
+
+    s.resize(256, '\0');
+    return s + data + map;
+}
+
+enum kind_t {
+    PFA, PFB, CFF_8BIT, CFF_CID, TTF, TTC, OTF_8BIT, OTF_CID, DFONT,
+
+    //
+    // Malformed:
+    //
+    TRUNCATED_OTF,   // cut in the middle of the CFF header
+    HUGE_OFFSET_OTF, // CFF table offset way past the end
+    HUGE_INDEX_CFF,  // Name INDEX with 65535 entries and 4-byte offsets
+    TABLE_FLOOD_OTF, // 65535 table records announced, none of them CFF
+    NOISE,           // a valid signature followed by random bytes
+
+    KIND_MAX
+};
+
+inline const char *name(kind_t kind)
+{
+    static const char *names[] = {
+        "pfa", "pfb", "cff-8bit", "cff-cid", "ttf", "ttc", "otf-8bit",
+        "otf-cid", "dfont", "truncated-otf", "huge-offset-otf",
+        "huge-index-cff", "table-flood-otf", "noise"
+    };
+
+    static_assert(sizeof names / sizeof *names == KIND_MAX);
+
+    return names[kind];
+}
+
+//
+// A sample of the given kind, of about `size' bytes: the font programs are
+// padded to it and the CFF table of OpenType fonts is placed at its end, the
+// way it is in large CJK fonts.
+//
+inline std::string generate(kind_t kind, size_t size, unsigned seed = 0)
+{
+    static const std::string glyf("\x00\x01\x00\x00", 4);
+
+    const auto tables = [](size_t n, size_t size) {
+        static const char *tags[] = {
+            "OS/2", "cmap", "cvt ", "fpgm", "gasp", "glyf", "head", "hhea",
+            "hmtx", "loca", "maxp", "name", "post", "prep", "GPOS", "GSUB"
+        };
+
+        std::vector< std::pair< std::string, std::string > > xs;
+
+        for (size_t i = 0; i < n; ++i)
+            xs.emplace_back(tags[i % 16], std::string(size / n, 'x'));
+
+        return xs;
+    };
+
+    const auto otf = [&](bool cid) {
+        const auto cff = make_cff(cid);
+        return make_otf(cff, size > 12 + 16 + cff.size() ? size - cff.size() : 28);
+    };
+
+    switch (kind) {
+    case PFA:
+        return make_pfa(size);
+
+    case PFB:
+        return make_pfb(size);
+
+    case CFF_8BIT:
+    case CFF_CID:
+        return make_cff(kind == CFF_CID, size);
+
+    case TTF:
+        return make_sfnt(glyf, tables(16, size));
+
+    case TTC: {
+        std::vector< std::string > faces;
+        size_t base = 12 + 4 * 4;
+
+        for (size_t i = 0; i < 4; ++i) {
+            faces.push_back(make_sfnt(glyf, tables(16, size / 4), base));
+            base += faces.back().size();
+        }
+
+        return make_ttc(faces);
+    }
+
+    case OTF_8BIT:
+    case OTF_CID:
+        return otf(kind == OTF_CID);
+
+    case DFONT:
+        return make_dfont({ make_sfnt(glyf, tables(16, size)) });
+
+    case TRUNCATED_OTF: {
+        auto s = otf(true);
+        s.resize(s.size() - make_cff(true).size() + 3);
+        return s;
+    }
+
+    case HUGE_OFFSET_OTF: {
+        auto s = otf(false);
+        s.replace(20, 4, be32(0x7ffffff0));
+        return s;
+    }
+
+    case HUGE_INDEX_CFF: {
+        std::string s("\x01\x00\x04\x04", 4);
+        s += be16(0xffff) + '\x04';
+
+        for (size_t i = 0; s.size() < size; ++i)
+            s += be32(0x7fffffff - i);
+
+        return s;
+    }
+
+    case TABLE_FLOOD_OTF: {
+        std::string s = "OTTO" + be16(0xffff) + std::string(6, '\0');
+
+        for (size_t i = 0; s.size() < size; ++i)
+            s += "glyf" + be32(0) + be32(12) + be32(0);
+
+        return s;
+    }
+
+    case NOISE: {
+        static const char *signatures[] = {
+            "%!PS-AdobeFont-1", "\x80\x01", "true", "ttcf", "OTTO", "\x01\x00"
+        };
+
+        std::mt19937 gen(seed);
+
+        //
+        // The two-byte signatures are NUL-terminated in the table:
+        //
+        const size_t i = gen() % 6;
+        std::string s(signatures[i], i == 5 ? 2 : std::string(signatures[i]).size());
+
+        while (s.size() < size)
+            s += char(gen());
+
+        return s;
+    }
+
+    default:
+        break;
+    }
+
+    return { };
+}
+
+} // namespace xpdf::fofi::corpus
+
+#endif // FOFI_CORPUS_HH
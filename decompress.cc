@@ -0,0 +1,446 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <cstdint>
+#include <exception>
+#include <ios>
+#include <memory>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/lzma.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/read.hpp>
+namespace io = boost::iostreams;
+
+#include <brotli/decode.h>
+
+#include <decompress.hh>
+#include <stream.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+using detail::magic;
+
+//
+// A Source over an iterator range, which feeds the compressed data to the
+// filters as they ask for it:
+//
+template< typename Iterator >
+struct range_device
+{
+    using char_type = char;
+    using category = io::source_tag;
+
+    std::streamsize read(char *s, std::streamsize n)
+    {
+        std::streamsize i = 0;
+
+        for (; i < n && iter != last; ++i, ++iter)
+            s[i] = *iter;
+
+        return i ? i : -1;
+    }
+
+    Iterator iter, last;
+};
+
+//
+// Boost.Iostreams has no Brotli filter, for WOFF2:
+//
+struct brotli_decompressor
+{
+    using char_type = char;
+
+    struct category
+        : io::multichar_input_filter_tag, io::closable_tag
+    { };
+
+    brotli_decompressor() : impl(std::make_shared< impl_t >())
+    { }
+
+    template< typename Source >
+    std::streamsize read(Source &src, char *s, std::streamsize n)
+    {
+        auto &x = *impl;
+
+        size_t avail_out = n;
+        auto next_out = reinterpret_cast< std::uint8_t * >(s);
+
+        for (;;) {
+            if (0 == x.avail_in && !x.eof) {
+                const auto result = io::read(
+                    src, reinterpret_cast< char * >(x.buf), sizeof x.buf);
+
+                if (result > 0) {
+                    x.next_in = x.buf;
+                    x.avail_in = result;
+                } else {
+                    x.eof = true;
+                }
+            }
+
+            const auto result = BrotliDecoderDecompressStream(
+                x.state.get(), &x.avail_in, &x.next_in, &avail_out, &next_out,
+                0);
+
+            const std::streamsize produced = n - avail_out;
+
+            switch (result) {
+            case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+                if (produced || x.eof)
+                    return produced ? produced : -1;
+                break;
+
+            case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+                return produced;
+
+            case BROTLI_DECODER_RESULT_SUCCESS:
+                return produced ? produced : -1;
+
+            default:
+                throw std::ios_base::failure("brotli: malformed stream");
+            }
+        }
+    }
+
+    template< typename Source >
+    void close(Source &)
+    {
+        impl = std::make_shared< impl_t >();
+    }
+
+private:
+    struct impl_t
+    {
+        std::unique_ptr<
+            BrotliDecoderState, decltype(&BrotliDecoderDestroyInstance) >
+        state{ BrotliDecoderCreateInstance(0, 0, 0),
+               &BrotliDecoderDestroyInstance };
+
+        std::uint8_t buf[4096];
+        const std::uint8_t *next_in = buf;
+        size_t avail_in = 0;
+        bool eof = false;
+    };
+
+    //
+    // Filters are copied into the chain:
+    //
+    std::shared_ptr< impl_t > impl;
+};
+
+enum codec_t { GZIP, BZIP2, XZ, ZSTD, ZLIB, BROTLI };
+
+//
+// Calls f(iter, last) over the decompressed [first, last) and returns what it
+// returns. Malformed data ends the decompressed stream early, to the effect of
+// truncating it.
+//
+template< typename Iterator, typename F >
+bool decompress(Iterator first, Iterator last, codec_t codec, F f)
+{
+    io::filtering_streambuf< io::input > sb;
+
+    switch (codec) {
+    case GZIP:   sb.push(io::gzip_decompressor());  break;
+    case BZIP2:  sb.push(io::bzip2_decompressor()); break;
+    case XZ:     sb.push(io::lzma_decompressor());  break;
+    case ZSTD:   sb.push(io::zstd_decompressor());  break;
+    case ZLIB:   sb.push(io::zlib_decompressor());  break;
+    case BROTLI: sb.push(brotli_decompressor());    break;
+    }
+
+    sb.push(range_device< Iterator >{ first, last });
+
+    //
+    // The parsers only go forward past the headers, no need to keep more:
+    //
+    stream_source src(sb, stream_source::default_window);
+    return f(src.begin(), src.end());
+}
+
+template< typename Iterator >
+bool uint32(Iterator &iter, Iterator last, std::uint32_t &x)
+{
+    if (!detail::integral(iter, last, x))
+        return false;
+
+    boost::endian::big_to_native_inplace(x);
+    return true;
+}
+
+template< typename Iterator >
+bool uint16(Iterator &iter, Iterator last, std::uint16_t &x)
+{
+    if (!detail::integral(iter, last, x))
+        return false;
+
+    boost::endian::big_to_native_inplace(x);
+    return true;
+}
+
+inline bool is_truetype(std::uint32_t flavor)
+{
+    return flavor == magic("\x00\x01\x00\x00") || flavor == magic("true");
+}
+
+template< typename Iterator >
+bool identify_woff(Iterator first, Iterator last, font_type &result)
+{
+    auto iter = first;
+
+    std::uint32_t signature = 0, flavor = 0;
+    std::uint16_t ntables = 0;
+
+    //
+    // Signature, flavor, length, table count, then 30 more bytes of header:
+    //
+    if (!uint32(iter, last, signature) || !uint32(iter, last, flavor) ||
+        !detail::safe_advance(first, iter, last, 4) ||
+        !uint16(iter, last, ntables) ||
+        !detail::safe_advance(first, iter, last, 30))
+        return false;
+
+    if (flavor == magic("OTTO")) {
+        for (size_t i = 0; i < ntables; ++i) {
+            std::uint32_t tag, off, comp_length, orig_length, checksum;
+
+            if (!uint32(iter, last, tag) || !uint32(iter, last, off) ||
+                !uint32(iter, last, comp_length) ||
+                !uint32(iter, last, orig_length) ||
+                !uint32(iter, last, checksum))
+                return false;
+
+            if (tag != magic("CFF "))
+                continue;
+
+            auto table = first, end = first;
+
+            if (!detail::safe_advance(first, table, last, off))
+                return false;
+
+            if (!detail::safe_advance(
+                    first, end, last, std::uint64_t(off) + comp_length))
+                end = last;
+
+            font_type type = FONT_UNKNOWN;
+
+            //
+            // Tables are zlib-compressed unless that would not save space:
+            //
+            const bool success = comp_length < orig_length
+                ? decompress(table, end, ZLIB, [&](auto iter, auto last) {
+                      return detail::identify_cff(iter, last, type);
+                  })
+                : detail::identify_cff(table, end, type);
+
+            if (success)
+                result = detail::opentype(type);
+
+            return success;
+        }
+
+        return false;
+    }
+
+    if (is_truetype(flavor))
+        return result = FONT_TRUETYPE, true;
+
+    return false;
+}
+
+template< typename Iterator >
+bool base128(Iterator &iter, Iterator last, std::uint32_t &x)
+{
+    x = 0;
+
+    for (size_t i = 0; i < 5; ++i) {
+        unsigned char c = 0;
+
+        if (!detail::integral(iter, last, c))
+            return false;
+
+        //
+        // No leading zeroes, no overflow:
+        //
+        if ((0 == i && c == 0x80) || (x & 0xfe000000))
+            return false;
+
+        x = x << 7 | (c & 0x7f);
+
+        if (0 == (c & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+template< typename Iterator >
+bool identify_woff2(Iterator first, Iterator last, font_type &result)
+{
+    //
+    // The tags of the table directory entries, by index:
+    //
+    static const char known[][5] = {
+        "cmap", "head", "hhea", "hmtx", "maxp", "name", "OS/2", "post",
+        "cvt ", "fpgm", "glyf", "loca", "prep", "CFF ", "VORG", "EBDT",
+        "EBLC", "gasp", "hdmx", "kern", "LTSH", "PCLT", "VDMX", "vhea",
+        "vmtx", "BASE", "GDEF", "GPOS", "GSUB", "EBSC", "JSTF", "MATH",
+        "CBDT", "CBLC", "COLR", "CPAL", "SVG ", "sbix", "acnt", "avar",
+        "bdat", "bloc", "bsln", "cvar", "fdsc", "feat", "fmtx", "fvar",
+        "gvar", "hsty", "just", "lcar", "mort", "morx", "opbd", "prop",
+        "trak", "Zapf", "Silf", "Glat", "Gloc", "Feat", "Sill"
+    };
+
+    auto iter = first;
+
+    std::uint32_t signature = 0, flavor = 0, compressed_length = 0;
+    std::uint16_t ntables = 0;
+
+    //
+    // Signature, flavor, length, table count, reserved, total sfnt size, total
+    // compressed size, then 24 more bytes of header:
+    //
+    if (!uint32(iter, last, signature) || !uint32(iter, last, flavor) ||
+        !detail::safe_advance(first, iter, last, 4) ||
+        !uint16(iter, last, ntables) ||
+        !detail::safe_advance(first, iter, last, 6) ||
+        !uint32(iter, last, compressed_length) ||
+        !detail::safe_advance(first, iter, last, 24))
+        return false;
+
+    if (flavor == magic("ttcf"))
+        return result = FONT_TRUETYPE_COLLECTION, true;
+
+    if (is_truetype(flavor))
+        return result = FONT_TRUETYPE, true;
+
+    if (flavor != magic("OTTO"))
+        return false;
+
+    //
+    // All tables are compressed together, in directory order, each taking
+    // its transformed length if it has one:
+    //
+    std::uint32_t off = 0, cff_off = 0;
+    bool found = false;
+
+    for (size_t i = 0; i < ntables; ++i) {
+        unsigned char flags = 0;
+
+        if (!detail::integral(iter, last, flags))
+            return false;
+
+        std::uint32_t tag = 0;
+
+        if ((flags & 0x3f) == 0x3f) {
+            if (!uint32(iter, last, tag))
+                return false;
+        } else if ((flags & 0x3f) < sizeof known / sizeof *known) {
+            tag = magic(known[flags & 0x3f]);
+        } else {
+            return false;
+        }
+
+        std::uint32_t length = 0;
+
+        if (!base128(iter, last, length))
+            return false;
+
+        const auto version = flags >> 6;
+
+        const bool transformed = tag == magic("glyf") || tag == magic("loca")
+            ? version != 3 : version != 0;
+
+        if (transformed && !base128(iter, last, length))
+            return false;
+
+        if (!found && tag == magic("CFF ")) {
+            cff_off = off;
+            found = true;
+        }
+
+        off += length;
+    }
+
+    if (!found)
+        return false;
+
+    auto end = iter;
+
+    if (!detail::safe_advance(first, end, last, compressed_length))
+        end = last;
+
+    font_type type = FONT_UNKNOWN;
+
+    const bool success = decompress(iter, end, BROTLI, [&](auto iter, auto last) {
+        return detail::safe_advance(iter, iter, last, cff_off) &&
+            detail::identify_cff(iter, last, type);
+    });
+
+    if (success)
+        result = detail::opentype(type);
+
+    return success;
+}
+
+template< typename Iterator >
+bool identify_compressed(Iterator first, Iterator last, font_type &result)
+{
+    const auto word = detail::leading_word(first, last);
+
+    const auto f = [&](auto iter, auto last) {
+        return detail::identify(iter, last, result);
+    };
+
+    try {
+        if ((word >> 16) == 0x1f8b)
+            return decompress(first, last, GZIP, f);
+
+        if ((word >> 8) == magic("BZh\0") >> 8)
+            return decompress(first, last, BZIP2, f);
+
+        if (word == magic("\xfd" "7zX"))
+            return decompress(first, last, XZ, f);
+
+        if (word == magic("\x28\xb5\x2f\xfd"))
+            return decompress(first, last, ZSTD, f);
+
+        if (word == magic("wOFF"))
+            return identify_woff(first, last, result);
+
+        if (word == magic("wOF2"))
+            return identify_woff2(first, last, result);
+    } catch (const std::exception &) {
+    }
+
+    return false;
+}
+
+} // anonymous namespace
+
+bool identify_compressed(const char *pbuf, size_t n, font_type &result)
+{
+    return identify_compressed< const char * >(pbuf, pbuf + n, result);
+}
+
+bool identify_compressed(
+    file_reader::iterator first, file_reader::iterator last,
+    font_type &result)
+{
+    return identify_compressed< file_reader::iterator >(first, last, result);
+}
+
+bool identify_compressed(
+    stream_source::iterator first, stream_source::iterator last,
+    font_type &result)
+{
+    return identify_compressed< stream_source::iterator >(first, last, result);
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,30 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_DECOMPRESS_HH
+#define FOFI_DECOMPRESS_HH
+
+#include <fofi.hh>
+#include <reader.hh>
+#include <stream.hh>
+
+namespace xpdf::fofi {
+
+//
+// Identifies the font inside a gzip, bzip2, xz or zstd stream, or inside a WOFF
+// or WOFF2 container, as the type of that font. The data is decompressed on
+// the fly, only as far as the probes read: the header of the font for the
+// compressed streams and, for the containers, the beginning of their CFF
+// table, if any.
+//
+bool identify_compressed(const char *, size_t, xpdf::fofi::font_type &);
+
+bool identify_compressed(
+    file_reader::iterator, file_reader::iterator, xpdf::fofi::font_type &);
+
+bool identify_compressed(
+    stream_source::iterator, stream_source::iterator, xpdf::fofi::font_type &);
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_DECOMPRESS_HH
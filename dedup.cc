@@ -0,0 +1,207 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <dedup.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+constexpr std::uint64_t p1 = 0x9e3779b185ebca87ULL;
+constexpr std::uint64_t p2 = 0xc2b2ae3d27d4eb4fULL;
+constexpr std::uint64_t p3 = 0x165667b19e3779f9ULL;
+constexpr std::uint64_t p4 = 0x85ebca77c2b2ae63ULL;
+constexpr std::uint64_t p5 = 0x27d4eb2f165667c5ULL;
+
+inline std::uint64_t rotl(std::uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+//
+// The words are little-endian, whatever the host:
+//
+template< typename T >
+inline T load_le(const char *p)
+{
+    T x;
+    std::memcpy(&x, p, sizeof x);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if constexpr (sizeof x == 8)
+        x = __builtin_bswap64(x);
+    else
+        x = __builtin_bswap32(x);
+#endif
+
+    return x;
+}
+
+inline std::uint64_t mix(std::uint64_t acc, std::uint64_t x)
+{
+    return rotl(acc + x * p2, 31) * p1;
+}
+
+inline std::uint64_t merge(std::uint64_t acc, std::uint64_t x)
+{
+    return (acc ^ mix(0, x)) * p1 + p4;
+}
+
+} // anonymous namespace
+
+std::uint64_t hash64(const char *p, size_t n, std::uint64_t seed)
+{
+    const char *last = p + n;
+
+    std::uint64_t h;
+
+    if (n >= 32) {
+        //
+        // Four lanes, 32 bytes at a time:
+        //
+        std::uint64_t v1 = seed + p1 + p2, v2 = seed + p2;
+        std::uint64_t v3 = seed, v4 = seed - p1;
+
+        for (; last - p >= 32; p += 32) {
+            v1 = mix(v1, load_le< std::uint64_t >(p));
+            v2 = mix(v2, load_le< std::uint64_t >(p + 8));
+            v3 = mix(v3, load_le< std::uint64_t >(p + 16));
+            v4 = mix(v4, load_le< std::uint64_t >(p + 24));
+        }
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    } else {
+        h = seed + p5;
+    }
+
+    h += n;
+
+    for (; last - p >= 8; p += 8)
+        h = rotl(h ^ mix(0, load_le< std::uint64_t >(p)), 27) * p1 + p4;
+
+    if (last - p >= 4) {
+        h = rotl(h ^ load_le< std::uint32_t >(p) * p1, 23) * p2 + p3;
+        p += 4;
+    }
+
+    for (; p != last; ++p)
+        h = rotl(h ^ std::uint8_t(*p) * p5, 11) * p1;
+
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+bool content_key_of(const char *filepath, content_key &key)
+{
+    const int fd = ::open(filepath, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (0 != ::fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    key.size = st.st_size;
+
+    if (0 == st.st_size) {
+        ::close(fd);
+        return key.hash = hash64("", 0), true;
+    }
+
+    void *p = ::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (MAP_FAILED == p)
+        return false;
+
+    ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    key.hash = hash64(static_cast< const char * >(p), st.st_size);
+
+    ::munmap(p, st.st_size);
+    return true;
+}
+
+dedup_index::dedup_index(const std::vector< std::string > &files,
+                         size_t jobs)
+    : keys(files.size()), readable(files.size())
+{
+    ASSERT(files.size() < UINT32_MAX);
+
+    parallel_for(files.size(), jobs, [&](size_t i) {
+        readable[i] = content_key_of(files[i].c_str(), keys[i]);
+    });
+
+    //
+    // The readable files by key, each key in input order, then the unreadable
+    // ones:
+    //
+    members.resize(files.size());
+    std::iota(members.begin(), members.end(), 0);
+
+    std::stable_sort(
+        members.begin(), members.end(), [&](auto a, auto b) {
+            if (readable[a] != readable[b])
+                return bool(readable[a]);
+
+            return readable[a] && keys[a] < keys[b];
+        });
+
+    std::vector< std::uint32_t > bounds;
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        const auto a = members[i];
+
+        if (0 == i || !readable[a] || !(keys[a] == keys[members[i - 1]]))
+            bounds.push_back(i);
+    }
+
+    bounds.push_back(members.size());
+
+    //
+    // The groups, by their first files:
+    //
+    std::vector< std::uint32_t > order(bounds.size() - 1);
+    std::iota(order.begin(), order.end(), 0);
+
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+        return members[bounds[a]] < members[bounds[b]];
+    });
+
+    std::vector< std::uint32_t > sorted;
+    sorted.reserve(members.size());
+
+    offsets.push_back(0);
+
+    for (auto g : order) {
+        sorted.insert(sorted.end(), members.data() + bounds[g],
+                      members.data() + bounds[g + 1]);
+        offsets.push_back(sorted.size());
+    }
+
+    members.swap(sorted);
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,124 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_DEDUP_HH
+#define FOFI_DEDUP_HH
+
+#include <fofi.hh>
+#include <pool.hh>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xpdf::fofi {
+
+//
+// XXH64 of the buffer, a fast non-cryptographic 64-bit hash:
+//
+std::uint64_t hash64(const char *, size_t, std::uint64_t seed = 0);
+
+//
+// What tells files apart by content, short of comparing them:
+//
+struct content_key
+{
+    std::uint64_t size, hash;
+
+    bool operator==(const content_key &other) const
+    {
+        return size == other.size && hash == other.hash;
+    }
+
+    bool operator<(const content_key &other) const
+    {
+        return size < other.size || (size == other.size && hash < other.hash);
+    }
+};
+
+//
+// The content key of a file, read whole. Fails on files that cannot be read.
+//
+bool content_key_of(const char *filepath, content_key &);
+
+//
+// The files of a corpus grouped by content, the keys computed on a pool of
+// `jobs' threads (0 for one per core). Groups are numbered in the order of
+// their first files, the files of a group being in input order. Files that
+// cannot be read are groups of their own.
+//
+struct dedup_index
+{
+    struct group_t
+    {
+        const std::uint32_t *first, *last;
+
+        size_t size() const { return last - first; }
+    };
+
+    explicit dedup_index(const std::vector< std::string > &files,
+                         size_t jobs = 0);
+
+    size_t size() const { return keys.size(); }
+    size_t ngroups() const { return offsets.size() - 1; }
+
+    group_t group(size_t g) const
+    {
+        const auto p = members.data();
+        return { p + offsets[g], p + offsets[g + 1] };
+    }
+
+    //
+    // The key of the i-th file, if it could be read:
+    //
+    bool key(size_t i, content_key &k) const
+    {
+        return k = keys[i], readable[i];
+    }
+
+private:
+    std::vector< content_key > keys;
+    std::vector< char > readable;
+
+    std::vector< std::uint32_t > members, offsets;
+};
+
+//
+// Identifies the content of every group in the index once, through its first
+// file, on a pool of `jobs' threads, and reports the result for all of the
+// files of the group via f(index, success, type), in no particular order and
+// possibly concurrently. The files named for their type, see
+// identify_byextension, get that type instead, as they would without the
+// index; the content of a group of only such files is not read at all.
+//
+template< typename F >
+void identify(const std::vector< std::string > &files, size_t jobs,
+              const dedup_index &index, F &&f)
+{
+    parallel_for(index.ngroups(), jobs, [&](size_t g) {
+        const auto group = index.group(g);
+
+        font_type type = FONT_UNKNOWN;
+        bool success = false, parsed = false;
+
+        for (auto iter = group.first; iter != group.last; ++iter) {
+            font_type named;
+
+            if (identify_byextension(files[*iter].c_str(), named)) {
+                f(*iter, true, named);
+                continue;
+            }
+
+            if (!parsed) {
+                success = identify_bycontent(files[*group.first].c_str(), type);
+                parsed = true;
+            }
+
+            f(*iter, success, type);
+        }
+    });
+}
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_DEDUP_HH
@@ -9,4 +9,16 @@
 #define FOFI_ASSERT assert
 #define ASSERT FOFI_ASSERT
 
+//
+// With FOFI_CLONES defined (the release builds of the Makefile), the function
+// is compiled once per x86-64 microarchitecture level, the parsers inlined in
+// it included, and the best one for the processor is picked at load time:
+//
+#if defined(FOFI_CLONES) && defined(__x86_64__)
+#  define FOFI_TARGET_CLONES __attribute__((target_clones( \
+        "default", "arch=x86-64-v2", "arch=x86-64-v3")))
+#else
+#  define FOFI_TARGET_CLONES
+#endif // FOFI_CLONES
+
 #endif // FOFI_DEFS_HH
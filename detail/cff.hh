@@ -0,0 +1,502 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_DETAIL_CFF_HH
+#define FOFI_DETAIL_CFF_HH
+
+#include <fofi.hh>
+#include <detail/fofi.hh>
+
+#include <cstdint>
+
+//
+// A structural parser for CFF fonts: the header, the Name, Top DICT, String
+// and Global Subr INDEXes, then the CharStrings, Private DICT and FDArray the
+// Top DICT points to. All positions are offsets from the beginning of the CFF
+// data, checked against its end before anything is read there, and held in 64
+// bits so that no sum of malformed 32-bit offsets wraps around. Nothing is
+// allocated; the parse is a single pass over each structure.
+//
+namespace xpdf::fofi::detail::cff {
+
+//
+// A big-endian unsigned value of `n' bytes:
+//
+template< typename Iterator >
+bool card(Iterator &iter, Iterator last, size_t n, std::uint32_t &x)
+{
+    x = 0;
+
+    for (; n && iter != last; --n, ++iter)
+        x = x << 8 | std::uint8_t(*iter);
+
+    return 0 == n;
+}
+
+//
+// An iterator at `off', if that is within the data:
+//
+template< typename Iterator >
+bool seek(Iterator first, Iterator last, std::uint64_t off, Iterator &iter)
+{
+    iter = first;
+    return off <= UINT32_MAX && safe_advance(first, iter, last, off);
+}
+
+struct index_t
+{
+    std::uint32_t count = 0, off_size = 0;
+
+    //
+    // Where the offset array and the data begin, and where the INDEX ends:
+    //
+    std::uint64_t offsets = 0, data = 0, end = 0;
+};
+
+template< typename Iterator >
+bool read_index(Iterator first, Iterator last, std::uint64_t off,
+                index_t &index)
+{
+    Iterator iter;
+
+    if (!seek(first, last, off, iter) || !card(iter, last, 2, index.count))
+        return false;
+
+    if (0 == index.count) {
+        index.end = off + 2;
+        return true;
+    }
+
+    if (!card(iter, last, 1, index.off_size) ||
+        index.off_size < 1 || 4 < index.off_size)
+        return false;
+
+    index.offsets = off + 3;
+    index.data = index.offsets + (index.count + 1ULL) * index.off_size - 1;
+
+    //
+    // The first offset is always 1, the last one makes for the data size:
+    //
+    std::uint32_t a = 0, b = 0;
+
+    if (!card(iter, last, index.off_size, a) || a != 1 ||
+        !seek(first, last, index.data + 1 - index.off_size, iter) ||
+        !card(iter, last, index.off_size, b) || b < 1)
+        return false;
+
+    index.end = index.data + b;
+
+    return seek(first, last, index.end, iter);
+}
+
+//
+// The [begin, end) range of the i-th element of an INDEX:
+//
+template< typename Iterator >
+bool element(Iterator first, Iterator last, const index_t &index, size_t i,
+             std::uint64_t &begin, std::uint64_t &end)
+{
+    Iterator iter;
+
+    std::uint32_t a = 0, b = 0;
+
+    if (i >= index.count ||
+        !seek(first, last, index.offsets + i * index.off_size, iter) ||
+        !card(iter, last, index.off_size, a) ||
+        !card(iter, last, index.off_size, b) ||
+        a < 1 || b < a)
+        return false;
+
+    begin = index.data + a;
+    end = index.data + b;
+
+    return end <= index.end;
+}
+
+//
+// The kinds of the DICT bytes, by the value of the byte:
+//
+enum byte_kind : std::uint8_t {
+    OPERATOR, ESCAPE, SHORTINT, LONGINT, REAL, SMALL, POSITIVE, NEGATIVE,
+    RESERVED
+};
+
+constexpr byte_kind kind_of(unsigned b)
+{
+    return
+        b == 12 ? ESCAPE :
+        b <= 21 ? OPERATOR :
+        b == 28 ? SHORTINT :
+        b == 29 ? LONGINT :
+        b == 30 ? REAL :
+        32 <= b && b <= 246 ? SMALL :
+        247 <= b && b <= 250 ? POSITIVE :
+        251 <= b && b <= 254 ? NEGATIVE : RESERVED;
+}
+
+struct byte_kinds
+{
+    constexpr byte_kinds() : xs{ }
+    {
+        for (unsigned b = 0; b < 256; ++b)
+            xs[b] = kind_of(b);
+    }
+
+    byte_kind xs[256];
+};
+
+constexpr byte_kinds kinds;
+
+//
+// Two-byte operators are 12 followed by the second byte:
+//
+constexpr unsigned escaped(unsigned b)
+{
+    return 0x0c00 | b;
+}
+
+//
+// Calls f(op, operands, n) for every operator in the DICT at [begin, end), with
+// the operands preceding it. Real operands are passed as zero; nothing in a
+// DICT that we look at is real.
+//
+template< typename Iterator, typename F >
+bool parse_dict(Iterator first, Iterator last, std::uint64_t begin,
+                std::uint64_t end, F f)
+{
+    //
+    // The maximum in the specification:
+    //
+    static constexpr size_t max_operands = 48;
+
+    Iterator iter, stop;
+
+    if (!seek(first, last, begin, iter) || !seek(first, last, end, stop))
+        return false;
+
+    std::int32_t operands[max_operands];
+    size_t n = 0;
+
+    while (iter != stop) {
+        const unsigned b0 = std::uint8_t(*iter++);
+
+        std::uint32_t x = 0;
+
+        switch (kinds.xs[b0]) {
+        case OPERATOR:
+            if (!f(b0, operands, n))
+                return false;
+
+            n = 0;
+            continue;
+
+        case ESCAPE:
+            if (!card(iter, stop, 1, x) || !f(escaped(x), operands, n))
+                return false;
+
+            n = 0;
+            continue;
+
+        case SHORTINT:
+            if (!card(iter, stop, 2, x))
+                return false;
+
+            x = std::uint32_t(std::int32_t(std::int16_t(x)));
+            break;
+
+        case LONGINT:
+            if (!card(iter, stop, 4, x))
+                return false;
+            break;
+
+        case REAL:
+            //
+            // Nibbles, up to the one that ends the number:
+            //
+            for (;;) {
+                if (!card(iter, stop, 1, x))
+                    return false;
+
+                if ((x & 0x0f) == 0x0f || (x & 0xf0) == 0xf0)
+                    break;
+            }
+
+            x = 0;
+            break;
+
+        case SMALL:
+            x = std::uint32_t(int(b0) - 139);
+            break;
+
+        case POSITIVE:
+            if (!card(iter, stop, 1, x))
+                return false;
+
+            x = (b0 - 247) * 256 + x + 108;
+            break;
+
+        case NEGATIVE:
+            if (!card(iter, stop, 1, x))
+                return false;
+
+            x = std::uint32_t(-int(b0 - 251) * 256 - int(x) - 108);
+            break;
+
+        default:
+            return false;
+        }
+
+        if (n == max_operands)
+            return false;
+
+        operands[n++] = std::int32_t(x);
+    }
+
+    //
+    // No operands without an operator:
+    //
+    return 0 == n;
+}
+
+//
+// The operands of an operator that are offsets or sizes, which must be:
+//
+inline bool unsigned_operands(const std::int32_t *xs, size_t n, size_t count)
+{
+    if (n < count)
+        return false;
+
+    for (size_t i = 0; i < count; ++i)
+        if (xs[n - count + i] < 0)
+            return false;
+
+    return true;
+}
+
+//
+// The Subrs of a Private DICT, at an offset from its beginning:
+//
+template< typename Iterator >
+bool private_dict(Iterator first, Iterator last, const cff_range &range,
+                  std::uint32_t &nsubrs)
+{
+    const std::uint64_t begin = range.offset, end = begin + range.size;
+
+    std::uint64_t subrs = 0;
+
+    const bool success = parse_dict(
+        first, last, begin, end, [&](auto op, auto xs, auto n) {
+            if (op == 19) {
+                if (!unsigned_operands(xs, n, 1))
+                    return false;
+
+                subrs = begin + std::uint32_t(xs[n - 1]);
+            }
+
+            return true;
+        });
+
+    if (!success)
+        return false;
+
+    nsubrs = 0;
+
+    if (subrs) {
+        index_t index;
+
+        if (!read_index(first, last, subrs, index))
+            return false;
+
+        nsubrs = index.count;
+    }
+
+    return true;
+}
+
+//
+// The Private operator takes the size, then the offset:
+//
+inline bool private_operands(const std::int32_t *xs, size_t n, cff_range &r)
+{
+    if (!unsigned_operands(xs, n, 2))
+        return false;
+
+    r.size = xs[n - 2];
+    r.offset = xs[n - 1];
+
+    return true;
+}
+
+template< typename Iterator >
+bool fdarray(Iterator first, Iterator last, cff_info &info)
+{
+    index_t index;
+
+    if (!read_index(first, last, info.fdarray, index) || 0 == index.count)
+        return false;
+
+    info.nfds = index.count;
+
+    for (size_t i = 0; i < index.count; ++i) {
+        std::uint64_t begin = 0, end = 0;
+
+        if (!element(first, last, index, i, begin, end))
+            return false;
+
+        cff_range range{ 0, 0 };
+
+        const bool success = parse_dict(
+            first, last, begin, end, [&](auto op, auto xs, auto n) {
+                return op != 18 || private_operands(xs, n, range);
+            });
+
+        //
+        // A Font DICT without a Private DICT is not much use:
+        //
+        if (!success || 0 == range.offset)
+            return false;
+
+        std::uint32_t nsubrs = 0;
+
+        if (!private_dict(first, last, range, nsubrs))
+            return false;
+
+        if (i < cff_info::max_fds)
+            info.fd_private_dicts[i] = range;
+    }
+
+    return true;
+}
+
+template< typename Iterator >
+bool top_dict(Iterator first, Iterator last, std::uint64_t begin,
+              std::uint64_t end, cff_info &info)
+{
+    return parse_dict(
+        first, last, begin, end, [&](auto op, auto xs, auto n) {
+            switch (op) {
+            case escaped(30):
+                info.cid = true;
+                break;
+
+            case escaped(6):
+                if (n < 1)
+                    return false;
+
+                info.charstring_type = xs[n - 1];
+                break;
+
+            case 15:
+            case 16:
+            case 17:
+            case escaped(36):
+            case escaped(37): {
+                if (!unsigned_operands(xs, n, 1))
+                    return false;
+
+                const std::uint32_t x = xs[n - 1];
+
+                switch (op) {
+                case 15:          info.charset = x;     break;
+                case 16:          info.encoding = x;    break;
+                case 17:          info.charstrings = x; break;
+                case escaped(36): info.fdarray = x;     break;
+                case escaped(37): info.fdselect = x;    break;
+                }
+
+                break;
+            }
+
+            case 18:
+                return private_operands(xs, n, info.private_dict);
+
+            default:
+                break;
+            }
+
+            return true;
+        });
+}
+
+inline void clear(cff_info &info)
+{
+    info.nfonts = info.nstrings = info.nglobal_subrs = 0;
+    info.cid = false;
+
+    //
+    // The default CharstringType:
+    //
+    info.charstring_type = 2;
+    info.charset = info.encoding = 0;
+
+    info.charstrings = info.ncharstrings = 0;
+
+    info.private_dict = { 0, 0 };
+    info.nlocal_subrs = 0;
+
+    info.fdarray = info.fdselect = info.nfds = 0;
+}
+
+template< typename Iterator >
+bool parse(Iterator first, Iterator last, cff_info &info)
+{
+    clear(info);
+
+    auto iter = first;
+
+    //
+    // Version 1, as version 2 is laid out differently:
+    //
+    std::uint32_t major = 0, minor = 0, hdr_size = 0, off_size = 0;
+
+    if (!card(iter, last, 1, major) || !card(iter, last, 1, minor) ||
+        !card(iter, last, 1, hdr_size) || !card(iter, last, 1, off_size) ||
+        major != 1 || hdr_size < 4 || off_size < 1 || 4 < off_size)
+        return false;
+
+    index_t names, tops, strings, gsubrs;
+
+    if (!read_index(first, last, hdr_size, names) || 0 == names.count ||
+        !read_index(first, last, names.end, tops) || 0 == tops.count ||
+        !read_index(first, last, tops.end, strings) ||
+        !read_index(first, last, strings.end, gsubrs))
+        return false;
+
+    info.nfonts = names.count;
+    info.nstrings = strings.count;
+    info.nglobal_subrs = gsubrs.count;
+
+    std::uint64_t begin = 0, end = 0;
+
+    if (!element(first, last, tops, 0, begin, end) ||
+        !top_dict(first, last, begin, end, info))
+        return false;
+
+    index_t charstrings;
+
+    if (0 == info.charstrings ||
+        !read_index(first, last, info.charstrings, charstrings))
+        return false;
+
+    info.ncharstrings = charstrings.count;
+
+    if (info.private_dict.offset &&
+        !private_dict(first, last, info.private_dict, info.nlocal_subrs))
+        return false;
+
+    if (info.fdarray && !fdarray(first, last, info))
+        return false;
+
+    if (info.fdselect) {
+        Iterator iter;
+
+        if (!seek(first, last, info.fdselect, iter) || iter == last)
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace xpdf::fofi::detail::cff
+
+#endif // FOFI_DETAIL_CFF_HH
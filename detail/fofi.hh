@@ -6,9 +6,16 @@
 #define FOFI_DETAIL_FOFI_HH
 
 #include <fofi.hh>
+#include <stats.hh>
 
 #include <boost/endian/conversion.hpp>
 
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
 namespace xpdf::fofi::detail {
 
 template< typename Iterator >
@@ -36,7 +43,13 @@ struct iterator_guard_t
     ITERATOR_RELEASE;                           \
     return true
 
-#define S_(x) std::string(x, sizeof x - 1)
+//
+// A failure and its reason, e.g., PARSE_FAILURE(TRUNCATED):
+//
+#define PARSE_FAILURE(x)                                                 \
+    return ::xpdf::fofi::stats::reject(::xpdf::fofi::stats::REJECT_##x)
+
+#define S_(x) std::string_view(x, sizeof x - 1)
 
 #define ITERATOR_CONDITIONAL(x)                                                  \
     template< typename T >                                                       \
@@ -56,7 +69,13 @@ template< typename Iterator, typename Distance >
 inline typename std::enable_if_t< is_forward_iterator< Iterator >, bool >
 safe_advance(Iterator, Iterator &iter, Iterator last, Distance n)
 {
-    ASSERT(0 == n || 0 < n);
+    //
+    // Malformed offsets can make for negative distances, which cannot be
+    // walked with a forward iterator:
+    //
+    if (n < 0)
+        return false;
+
     for (; n && iter != last; --n, ++iter) ;
     return 0 == n;
 }
@@ -111,6 +130,34 @@ void big_to_native_inplace(T &arg, size_t size)
     }
 }
 
+//
+// Big-endian value of a four-character signature, e.g., magic("OTTO"):
+//
+constexpr std::uint32_t magic(const char (&s)[5])
+{
+    return
+        std::uint32_t(std::uint8_t(s[0])) << 24 |
+        std::uint32_t(std::uint8_t(s[1])) << 16 |
+        std::uint32_t(std::uint8_t(s[2])) <<  8 |
+        std::uint32_t(std::uint8_t(s[3]));
+}
+
+//
+// Loads the first four bytes as a big-endian word, zero-padded if the input is
+// shorter, without moving the iterator.
+//
+template< typename Iterator >
+std::uint32_t leading_word(Iterator iter, Iterator last)
+{
+    std::uint32_t word = 0;
+
+    size_t i = 0;
+    for (; i < 4 && iter != last; ++i, ++iter)
+        word = word << 8 | std::uint8_t(*iter);
+
+    return word << (8 * (4 - i));
+}
+
 template< typename Iterator >
 bool literal_char(Iterator &iter, Iterator last, char c)
 {
@@ -128,7 +175,7 @@ bool literal_char(Iterator &iter, Iterator last, char c)
 }
 
 template< typename Iterator >
-bool literal_string(Iterator &iter, Iterator last, const std::string &s)
+bool literal_string(Iterator &iter, Iterator last, std::string_view s)
 {
     ITERATOR_GUARD(iter);
 
@@ -143,6 +190,27 @@ bool literal_string(Iterator &iter, Iterator last, const std::string &s)
     return false;
 }
 
+//
+// String literals, embedded NULs included, are matched with their length known
+// at compile time; over contiguous memory that is a bounds check and a
+// fixed-size memcmp, which the compiler turns into a couple of word loads.
+//
+template< typename Iterator, size_t N >
+bool literal_string(Iterator &iter, Iterator last, const char (&s)[N])
+{
+    constexpr size_t n = N - 1;
+
+    if constexpr (std::is_pointer_v< Iterator >) {
+        if (size_t(last - iter) < n || 0 != std::memcmp(iter, s, n))
+            return false;
+
+        iter += n;
+        return true;
+    } else {
+        return literal_string(iter, last, std::string_view(s, n));
+    }
+}
+
 template< typename Iterator >
 bool literal_int(Iterator &iter, Iterator last, int &i)
 {
@@ -211,7 +279,7 @@ bool identify_pfa(Iterator &iter, Iterator last, font_type &result)
         return true;
     }
 
-    return false;
+    PARSE_FAILURE(SIGNATURE);
 }
 
 template< typename Iterator >
@@ -231,24 +299,7 @@ bool identify_pfb(Iterator &iter, Iterator last, font_type &result)
         }
     }
 
-    return false;
-}
-
-template< typename Iterator >
-bool identify_ttf(Iterator &iter, Iterator last, font_type &result)
-{
-    if (literal_string(iter, last, std::string("\x00\x01\x00\x00", 4)) ||
-        literal_string(iter, last, "true")) {
-        result = FONT_TRUETYPE;
-        return true;
-    }
-
-    if (literal_string(iter, last, "ttcf")) {
-        result = FONT_TRUETYPE_COLLECTION;
-        return true;
-    }
-
-    return false;
+    PARSE_FAILURE(SIGNATURE);
 }
 
 template< typename Iterator >
@@ -259,27 +310,27 @@ bool identify_cff(Iterator &iter, Iterator last, font_type &result)
     ITERATOR_GUARD(iter);
     const auto first = iter;
 
-    if (!literal_string(iter, last, std::string("\x01\x00", 2)))
-        return false;
+    if (!literal_string(iter, last, "\x01\x00"))
+        PARSE_FAILURE(SIGNATURE);
 
     {
         unsigned char a = 0, b = 0;
 
         if (!integral(iter, last, a) || !integral(iter, last, b))
-            return false;
+            PARSE_FAILURE(TRUNCATED);
 
         if (b < 1 || 4 < b || a < 4)
-            return false;
+            PARSE_FAILURE(MALFORMED);
 
         if (!safe_advance(first, iter, last, int(a) - 4))
-            return false;
+            PARSE_FAILURE(TRUNCATED);
     }
 
     {
         unsigned short n;
 
         if (!integral(iter, last, n))
-            return false;
+            PARSE_FAILURE(TRUNCATED);
 
         endian::big_to_native_inplace(n);
 
@@ -287,41 +338,47 @@ bool identify_cff(Iterator &iter, Iterator last, font_type &result)
             unsigned char x;
 
             if (!integral(iter, last, x))
-                return false;
+                PARSE_FAILURE(TRUNCATED);
 
             if (!safe_advance(first, iter, last, n * x))
-                return false;
+                PARSE_FAILURE(TRUNCATED);
 
             unsigned long y = 0;
 
             if (!sized_integral(iter, last, y, x))
-                return false;
+                PARSE_FAILURE(TRUNCATED);
 
             big_to_native_inplace(y, x);
 
             if (!safe_advance(first, iter, last, long(y) - 1))
-                return false;
+                PARSE_FAILURE(TRUNCATED);
         }
     }
 
     {
         unsigned short n = 0;
 
-        if (!integral(iter, last, n) || 0 == n)
-            return false;
+        if (!integral(iter, last, n))
+            PARSE_FAILURE(TRUNCATED);
+
+        if (0 == n)
+            PARSE_FAILURE(MALFORMED);
 
         endian::big_to_native_inplace(n);
 
         unsigned char x = 0;
 
         if (!integral(iter, last, x))
-            return false;
+            PARSE_FAILURE(TRUNCATED);
 
         unsigned long y = 0, z = 0;
 
         if (!sized_integral(iter, last, y, x) ||
-            !sized_integral(iter, last, z, x) || y > z)
-            return false;
+            !sized_integral(iter, last, z, x))
+            PARSE_FAILURE(TRUNCATED);
+
+        if (y > z)
+            PARSE_FAILURE(MALFORMED);
 
         big_to_native_inplace(y, x);
         big_to_native_inplace(z, x);
@@ -332,24 +389,24 @@ bool identify_cff(Iterator &iter, Iterator last, font_type &result)
 
             if (!safe_advance(first, iter, end, (n - 1) * x + y - 1) ||
                 !safe_advance(first, last, end, (n - 1) * x + z - 1))
-                return false;
+                PARSE_FAILURE(TRUNCATED);
         }
 
         for (size_t i = 0; i < 3; ++i) {
             unsigned char c = 0;
 
             if (!integral(iter, last, c))
-                return false;
+                PARSE_FAILURE(TRUNCATED);
 
             if (c == 0x1c) {
                 if (!safe_advance(first, iter, last, 2))
-                    return false;
+                    PARSE_FAILURE(TRUNCATED);
             } else if (c == 0x1d) {
                 if (!safe_advance(first, iter, last, 4))
-                    return false;
+                    PARSE_FAILURE(TRUNCATED);
             } else if (c >= 0xf7 && c <= 0xfe) {
                 if (!safe_advance(first, iter, last, 1))
-                    return false;
+                    PARSE_FAILURE(TRUNCATED);
             } else if (c < 0x20 || c > 0xf6) {
                 result = FONT_CFF_8BIT;
                 PARSE_SUCCESS;
@@ -376,94 +433,706 @@ bool identify_cff(Iterator &iter, Iterator last, font_type &result)
     return false;
 }
 
+//
+// Reads the table count and the table records of an sfnt offset table, `iter'
+// being right past its version tag, and calls f(index, count, record) for each
+// record until f returns false.
+//
+template< typename Iterator, typename F >
+bool table_directory(Iterator first, Iterator &iter, Iterator last, F f)
+{
+    namespace endian = boost::endian;
+
+    ITERATOR_GUARD(iter);
+
+    unsigned short n = 0;
+
+    //
+    // nTables follows the version tag, at offset 4.
+    //
+    if (!integral(iter, last, n))
+        PARSE_FAILURE(TRUNCATED);
+
+    endian::big_to_native_inplace(n);
+
+    if (!safe_advance(first, iter, last, 6))
+        PARSE_FAILURE(TRUNCATED);
+
+    //
+    // First table record starts at offset 12. Each table record is 16 bytes
+    // long.
+    //
+    for (size_t i = 0; i < n; ++i) {
+        table_record rec;
+
+        if (!integral(iter, last, rec.tag) ||
+            !integral(iter, last, rec.checksum) ||
+            !integral(iter, last, rec.offset) ||
+            !integral(iter, last, rec.length))
+            PARSE_FAILURE(TRUNCATED);
+
+        endian::big_to_native_inplace(rec.tag);
+        endian::big_to_native_inplace(rec.checksum);
+        endian::big_to_native_inplace(rec.offset);
+        endian::big_to_native_inplace(rec.length);
+
+        if (!f(i, size_t(n), rec))
+            break;
+    }
+
+    PARSE_SUCCESS;
+}
+
+inline void record_table(font_info *info, size_t i, size_t n,
+                         const table_record &rec)
+{
+    if (info) {
+        info->ntables = n;
+
+        if (i < font_info::max_tables)
+            info->tables[i] = rec;
+    }
+}
+
+inline font_type opentype(font_type type)
+{
+    return type == FONT_CFF_CID ? FONT_OPENTYPE_CFF_CID : FONT_OPENTYPE_CFF_8BIT;
+}
+
+//
+// Walks the table directory of an sfnt font, `iter' being right past its
+// version tag and the table offsets being relative to `first', passing every
+// record to f. The first CFF table that identifies sets `result' to its CFF
+// font type and `off' to its offset; the walk stops there unless `all' is set.
+//
+template< typename Iterator, typename F >
+bool sfnt_tables(Iterator first, Iterator &iter, Iterator last,
+                 font_type &result, std::uint32_t &off, bool all, F f)
+{
+    bool found = false;
+
+    return table_directory(first, iter, last, [&](auto i, auto n, auto &rec) {
+        f(i, n, rec);
+
+        if (!found && rec.tag == magic("CFF ") && rec.offset < INT_MAX) {
+            //
+            // The offset from beginning(!) of file:
+            //
+            auto iter2 = first;
+
+            if (safe_advance(first, iter2, last, rec.offset) &&
+                identify_cff(iter2, last, result)) {
+                off = rec.offset;
+                found = true;
+            }
+        }
+
+        return !found || all;
+    });
+}
+
+//
+// Classifies the sfnt face at `iter', with table offsets relative to `base':
+// faces with a CFF table are what OpenType fonts would be on their own,
+// glyf-flavored ones plain TrueType. The CFF offset is relative to `base'.
+//
+template< typename Iterator >
+bool classify_face(Iterator base, Iterator iter, Iterator last,
+                   font_type &result, std::uint32_t &cff_offset)
+{
+    const auto word = leading_word(iter, last);
+
+    if (word != magic("\x00\x01\x00\x00") && word != magic("true") &&
+        word != magic("OTTO"))
+        return false;
+
+    if (!safe_advance(base, iter, last, 4))
+        return false;
+
+    font_type type = FONT_UNKNOWN;
+    sfnt_tables(base, iter, last, type, cff_offset, false,
+                [](auto, auto, auto &) { });
+
+    if (type != FONT_UNKNOWN)
+        result = opentype(type);
+    else if (word != magic("OTTO"))
+        result = FONT_TRUETYPE;
+    else
+        return false;
+
+    return true;
+}
+
+//
+// Classifies every face of a collection, `iter' being right past the `ttcf'
+// tag. The faces are read in place, at their offsets from `first'.
+//
+template< typename Iterator >
+void collection_faces(Iterator first, Iterator iter, Iterator last,
+                      font_info &info)
+{
+    namespace endian = boost::endian;
+
+    std::uint32_t n = 0;
+
+    //
+    // The number of fonts follows the tag and the version:
+    //
+    if (!safe_advance(first, iter, last, 4) || !integral(iter, last, n))
+        return;
+
+    endian::big_to_native_inplace(n);
+    info.nfaces = n;
+
+    for (size_t i = 0; i < n && i < font_info::max_faces; ++i) {
+        std::uint32_t off = 0;
+
+        if (!integral(iter, last, off))
+            break;
+
+        endian::big_to_native_inplace(off);
+
+        auto &face = info.faces[i];
+
+        face.type = FONT_UNKNOWN;
+        face.offset = off;
+        face.cff_offset = 0;
+
+        auto iter2 = first;
+
+        if (safe_advance(first, iter2, last, off))
+            classify_face(first, iter2, last, face.type, face.cff_offset);
+    }
+}
+
+template< typename Iterator >
+bool identify_ttf(Iterator &iter, Iterator last, font_type &result,
+                  font_info *info = 0)
+{
+    const auto first = iter;
+
+    if (literal_string(iter, last, "\x00\x01\x00\x00") ||
+        literal_string(iter, last, "true")) {
+        result = FONT_TRUETYPE;
+
+        if (info) {
+            auto iter2 = iter;
+
+            table_directory(first, iter2, last, [&](auto i, auto n, auto &rec) {
+                return record_table(info, i, n, rec), true;
+            });
+        }
+
+        return true;
+    }
+
+    if (literal_string(iter, last, "ttcf")) {
+        result = FONT_TRUETYPE_COLLECTION;
+
+        if (info)
+            collection_faces(first, iter, last, *info);
+
+        return true;
+    }
+
+    PARSE_FAILURE(SIGNATURE);
+}
+
 template< typename Iterator >
-bool identify_otf(Iterator &iter, Iterator last, font_type &result)
+bool identify_otf(Iterator &iter, Iterator last, font_type &result,
+                  font_info *info = 0)
+{
+    ITERATOR_GUARD(iter);
+    const auto first = iter;
+
+    if (!literal_string(iter, last, "OTTO"))
+        PARSE_FAILURE(SIGNATURE);
+
+    font_type type = FONT_UNKNOWN;
+    std::uint32_t off = 0;
+
+    //
+    // The rest of the directory is only of interest to the caller:
+    //
+    sfnt_tables(first, iter, last, type, off, 0 != info, [&](auto i, auto n, auto &rec) {
+        record_table(info, i, n, rec);
+    });
+
+    if (type == FONT_UNKNOWN)
+        PARSE_FAILURE(MISSING);
+
+    result = opentype(type);
+
+    if (info) {
+        info->cff = true;
+        info->cff_offset = off;
+    }
+
+    PARSE_SUCCESS;
+}
+
+//
+// A Mac OS resource fork, the sfnt resources of which are the faces. The fork
+// starts with the offsets and lengths of the resource data and of the resource
+// map; the map holds the type list, and each type a list of references to its
+// resources, which are length-prefixed in the data.
+//
+template< typename Iterator >
+bool identify_dfont(Iterator &iter, Iterator last, font_type &result,
+                    font_info *info = 0)
 {
     namespace endian = boost::endian;
 
     ITERATOR_GUARD(iter);
     const auto first = iter;
 
-    if (literal_string(iter, last, "OTTO")) {
-        int short n = 0;
+    std::uint32_t data_off = 0, map_off = 0, data_len = 0, map_len = 0;
+
+    if (!integral(iter, last, data_off) || !integral(iter, last, map_off) ||
+        !integral(iter, last, data_len) || !integral(iter, last, map_len))
+        PARSE_FAILURE(TRUNCATED);
+
+    endian::big_to_native_inplace(data_off);
+    endian::big_to_native_inplace(map_off);
+    endian::big_to_native_inplace(data_len);
+    endian::big_to_native_inplace(map_len);
+
+    //
+    // The map header is 28 bytes, followed at least by the type count:
+    //
+    if (map_len < 30 || map_off < 16 || data_off < 16)
+        PARSE_FAILURE(MALFORMED);
+
+    auto map = first;
+
+    //
+    // The type list offset is at offset 24 in the map, from the map start:
+    //
+    if (!safe_advance(first, map, last, map_off))
+        PARSE_FAILURE(TRUNCATED);
+
+    std::uint16_t type_list_off = 0;
+
+    {
+        auto iter2 = map;
+
+        if (!safe_advance(first, iter2, last, 24) ||
+            !integral(iter2, last, type_list_off))
+            PARSE_FAILURE(TRUNCATED);
+
+        endian::big_to_native_inplace(type_list_off);
+    }
+
+    auto type_list = map;
+
+    if (!safe_advance(first, type_list, last, type_list_off))
+        PARSE_FAILURE(TRUNCATED);
+
+    auto types = type_list;
+    std::uint16_t ntypes = 0;
+
+    if (!integral(types, last, ntypes))
+        PARSE_FAILURE(TRUNCATED);
+
+    endian::big_to_native_inplace(ntypes);
+
+    bool found = false;
+    size_t nfaces = 0;
+
+    //
+    // Type and reference counts are stored minus one:
+    //
+    for (size_t i = 0; i <= ntypes; ++i) {
+        std::uint32_t tag = 0;
+        std::uint16_t count = 0, ref_list_off = 0;
+
+        if (!integral(types, last, tag) || !integral(types, last, count) ||
+            !integral(types, last, ref_list_off))
+            PARSE_FAILURE(TRUNCATED);
+
+        endian::big_to_native_inplace(tag);
+
+        if (tag != magic("sfnt"))
+            continue;
+
+        found = true;
+
+        if (0 == info)
+            break;
+
+        endian::big_to_native_inplace(count);
+        endian::big_to_native_inplace(ref_list_off);
+
+        auto refs = type_list;
+
+        if (!safe_advance(first, refs, last, ref_list_off))
+            PARSE_FAILURE(TRUNCATED);
 
         //
-        // nTables follows the identifier "OTTO", at offset 4.
+        // Each reference: id, name offset and attributes, then the 3-byte
+        // offset of the resource in the data and a reserved handle:
         //
-        if (integral(iter, last, n)) {
-            endian::big_to_native_inplace(n);
-            assert(n >= 0);
+        for (size_t j = 0; j <= count; ++j, ++nfaces) {
+            unsigned long off = 0;
 
-            if (!safe_advance(first, iter, last, 6))
-                return false;
+            if (!safe_advance(first, refs, last, 5) ||
+                !sized_integral(refs, last, off, 3) ||
+                !safe_advance(first, refs, last, 4))
+                PARSE_FAILURE(TRUNCATED);
 
-            //
-            // First table record starts at offset 12. Each table record is 16
-            // bytes long.
-            //
-            for (size_t i = 0; i < size_t(n); ++i) {
-                if (literal_string(iter, last, "CFF ")) {
-                    //
-                    // The table tag is CFF:
-                    //
-                    if (!safe_advance(first, iter, last, 4))
-                        return false;
-
-                    int off = 0;
-
-                    //
-                    // The offset from beginning(!) of file:
-                    //
-                    if (integral(iter, last, off)) {
-                        endian::big_to_native_inplace(off);
-
-                        if (off < INT_MAX) {
-                            auto iter2 = first;
-
-                            if (!safe_advance(first, iter2, last, off))
-                                break;
-
-                            if (identify_cff(iter2, last, result)) {
-                                switch (result) {
-                                case FONT_CFF_8BIT:
-                                    result = FONT_OPENTYPE_CFF_8BIT;
-                                    PARSE_SUCCESS;
-
-                                case FONT_CFF_CID:
-                                    result = FONT_OPENTYPE_CFF_CID;
-                                    PARSE_SUCCESS;
-
-                                default:
-                                    break;
-                                }
-                            }
-                        }
-
-                        if (!safe_advance(first, iter, last, 4))
-                            return false;
-                    } else {
-                        return false;
-                    }
-                }
-
-                if (!safe_advance(first, iter, last, 16))
-                    return false;
-            }
+            big_to_native_inplace(off, 3);
+
+            if (nfaces >= font_info::max_faces)
+                continue;
+
+            auto &face = info->faces[nfaces];
+
+            face.type = FONT_UNKNOWN;
+            face.offset = data_off + off + 4;
+            face.cff_offset = 0;
+
+            auto sfnt = first;
+
+            if (safe_advance(first, sfnt, last, face.offset) &&
+                classify_face(sfnt, sfnt, last, face.type, face.cff_offset) &&
+                face.cff_offset)
+                face.cff_offset += face.offset;
+        }
+    }
+
+    if (!found)
+        PARSE_FAILURE(MISSING);
+
+    result = FONT_DFONT;
+
+    if (info)
+        info->nfaces = nfaces;
+
+    PARSE_SUCCESS;
+}
+
+inline void clear(font_info &info)
+{
+    info.type = FONT_UNKNOWN;
+    info.nfaces = info.ntables = 0;
+    info.cff = info.cid = false;
+    info.cff_offset = 0;
+}
+
+//
+// The formats, each with a probe. The leading signatures of all the formats
+// are distinct, so the first word picks the one probe that can match and only
+// that probe runs. The probes still check their complete signature, e.g., the
+// rest of `%!PS-AdobeFont-1'.
+//
+enum probe_t {
+    PROBE_NONE, PROBE_PFA, PROBE_PFB, PROBE_CFF, PROBE_TTF, PROBE_OTF,
+    PROBE_DFONT, PROBE_MAX
+};
+
+//
+// A leading word matches a signature if the bits in the mask are the same:
+//
+struct signature_t
+{
+    std::uint32_t word, mask;
+
+    constexpr bool matches(std::uint32_t x) const
+    {
+        return (x & mask) == word;
+    }
+};
+
+//
+// The descriptor of a format: its name, its signatures, the font types it
+// identifies and its probe, which sets `result' to one of them. A new format
+// is a new probe_t value, a specialization of this template and an entry in
+// the registry below.
+//
+template< probe_t >
+struct format;
+
+template<>
+struct format< PROBE_PFA >
+{
+    static constexpr const char *name = "pfa";
+
+    static constexpr signature_t signatures[] = {
+        { magic("%!PS"), 0xffffffff }, { magic("%!Fo"), 0xffffffff }
+    };
+
+    static constexpr font_type types[] = { FONT_TYPE1_PFA };
+
+    template< typename Iterator >
+    static bool identify(Iterator &iter, Iterator last, font_type &result,
+                         font_info *)
+    {
+        return identify_pfa(iter, last, result);
+    }
+};
+
+template<>
+struct format< PROBE_PFB >
+{
+    static constexpr const char *name = "pfb";
+
+    static constexpr signature_t signatures[] = {
+        { 0x80010000, 0xffff0000 }
+    };
+
+    static constexpr font_type types[] = { FONT_TYPE1_PFB };
+
+    template< typename Iterator >
+    static bool identify(Iterator &iter, Iterator last, font_type &result,
+                         font_info *)
+    {
+        return identify_pfb(iter, last, result);
+    }
+};
+
+template<>
+struct format< PROBE_CFF >
+{
+    static constexpr const char *name = "cff";
+
+    static constexpr signature_t signatures[] = {
+        { 0x01000000, 0xffff0000 }
+    };
+
+    static constexpr font_type types[] = { FONT_CFF_8BIT, FONT_CFF_CID };
+
+    template< typename Iterator >
+    static bool identify(Iterator &iter, Iterator last, font_type &result,
+                         font_info *)
+    {
+        return identify_cff(iter, last, result);
+    }
+};
+
+template<>
+struct format< PROBE_TTF >
+{
+    static constexpr const char *name = "ttf";
+
+    static constexpr signature_t signatures[] = {
+        { magic("\x00\x01\x00\x00"), 0xffffffff },
+        { magic("true"), 0xffffffff }, { magic("ttcf"), 0xffffffff }
+    };
+
+    static constexpr font_type types[] = { FONT_TRUETYPE, FONT_TRUETYPE_COLLECTION };
+
+    template< typename Iterator >
+    static bool identify(Iterator &iter, Iterator last, font_type &result,
+                         font_info *info)
+    {
+        return identify_ttf(iter, last, result, info);
+    }
+};
+
+template<>
+struct format< PROBE_OTF >
+{
+    static constexpr const char *name = "otf";
+
+    static constexpr signature_t signatures[] = {
+        { magic("OTTO"), 0xffffffff }
+    };
+
+    static constexpr font_type types[] = { FONT_OPENTYPE_CFF_8BIT, FONT_OPENTYPE_CFF_CID };
+
+    template< typename Iterator >
+    static bool identify(Iterator &iter, Iterator last, font_type &result,
+                         font_info *info)
+    {
+        return identify_otf(iter, last, result, info);
+    }
+};
+
+template<>
+struct format< PROBE_DFONT >
+{
+    static constexpr const char *name = "dfont";
+
+    static constexpr signature_t signatures[] = {
+        { magic("\x00\x00\x01\x00"), 0xffffffff }
+    };
+
+    static constexpr font_type types[] = { FONT_DFONT };
+
+    template< typename Iterator >
+    static bool identify(Iterator &iter, Iterator last, font_type &result,
+                         font_info *info)
+    {
+        return identify_dfont(iter, last, result, info);
+    }
+};
+
+//
+// Whether a format is built in; a build can leave any of them out, e.g., with
+// make WITHOUT="PFA PFB" for -DFOFI_NO_PFA -DFOFI_NO_PFB:
+//
+template< probe_t >
+constexpr bool built_in = true;
+
+#if defined(FOFI_NO_PFA)
+template<> constexpr bool built_in< PROBE_PFA > = false;
+#endif // FOFI_NO_PFA
+
+#if defined(FOFI_NO_PFB)
+template<> constexpr bool built_in< PROBE_PFB > = false;
+#endif // FOFI_NO_PFB
+
+#if defined(FOFI_NO_CFF)
+template<> constexpr bool built_in< PROBE_CFF > = false;
+#endif // FOFI_NO_CFF
+
+#if defined(FOFI_NO_TTF)
+template<> constexpr bool built_in< PROBE_TTF > = false;
+#endif // FOFI_NO_TTF
+
+#if defined(FOFI_NO_OTF)
+template<> constexpr bool built_in< PROBE_OTF > = false;
+#endif // FOFI_NO_OTF
+
+#if defined(FOFI_NO_DFONT)
+template<> constexpr bool built_in< PROBE_DFONT > = false;
+#endif // FOFI_NO_DFONT
+
+template< probe_t P >
+constexpr bool matches(std::uint32_t word)
+{
+    for (const auto &sig : format< P >::signatures)
+        if (sig.matches(word))
+            return true;
+
+    return false;
+}
+
+template< probe_t P >
+constexpr bool identifies(font_type type)
+{
+    for (auto x : format< P >::types)
+        if (x == type)
+            return true;
+
+    return false;
+}
+
+//
+// Runs the probe of P if it is the one picked, and only instantiates it if P
+// is built in:
+//
+template< probe_t P, typename Iterator >
+bool run_if(probe_t which, Iterator &iter, Iterator last, font_type &result,
+            font_info *info, bool &success)
+{
+    if constexpr (built_in< P >) {
+        if (which == P) {
+            success = format< P >::identify(iter, last, result, info);
+            return true;
         }
     }
 
     return false;
 }
 
+//
+// A set of formats, the dispatch over which is generated at compile time:
+// probe_for is a chain of masked compares, which folds to a constant for a
+// constant word, and run goes straight to the probe picked. The formats not
+// built in are left out of both.
+//
+template< probe_t... Ps >
+struct registry
+{
+    static constexpr probe_t probe_for(std::uint32_t word)
+    {
+        probe_t which = PROBE_NONE;
+
+        (void)((built_in< Ps > && matches< Ps >(word) &&
+                (which = Ps, true)) || ...);
+
+        return which;
+    }
+
+    template< typename Iterator >
+    static bool run(probe_t which, Iterator &iter, Iterator last,
+                    font_type &result, font_info *info)
+    {
+        bool success = false;
+
+        if (!(run_if< Ps >(which, iter, last, result, info, success) || ...))
+            PARSE_FAILURE(SIGNATURE);
+
+        return success;
+    }
+
+    //
+    // Whether any of the formats built in identifies fonts of the type:
+    //
+    static constexpr bool supports(font_type type)
+    {
+        return ((built_in< Ps > && identifies< Ps >(type)) || ...);
+    }
+
+    static constexpr const char *name(probe_t which)
+    {
+        const char *s = "none";
+
+        (void)((which == Ps && (s = format< Ps >::name, true)) || ...);
+
+        return s;
+    }
+};
+
+using formats = registry<
+    PROBE_PFA, PROBE_PFB, PROBE_CFF, PROBE_TTF, PROBE_OTF, PROBE_DFONT >;
+
+constexpr probe_t probe_for(std::uint32_t word)
+{
+    return formats::probe_for(word);
+}
+
 template< typename Iterator >
-bool identify(Iterator &iter, Iterator last, font_type &result)
+bool probe(probe_t which, Iterator &iter, Iterator last, font_type &result,
+           font_info *info)
 {
-    return
-        identify_pfa(iter, last, result) ||
-        identify_pfb(iter, last, result) ||
-        identify_ttf(iter, last, result) ||
-        identify_otf(iter, last, result) ||
-        identify_cff(iter, last, result);
+    const auto start = stats::now();
+    stats::enter_probe(which);
+
+    return stats::leave_probe(
+        which, formats::run(which, iter, last, result, info), start);
+}
+
+template< typename Iterator >
+bool dispatch(Iterator &iter, Iterator last, font_type &result, font_info *info)
+{
+    return probe(probe_for(leading_word(iter, last)), iter, last, result, info);
+}
+
+template< typename Iterator >
+bool identify(Iterator &iter, Iterator last, font_type &result,
+              font_info *info = 0)
+{
+    if (info)
+        clear(*info);
+
+    if (!dispatch(iter, last, result, info))
+        return false;
+
+    if (info) {
+        info->type = result;
+
+        if (result != FONT_TRUETYPE_COLLECTION && result != FONT_DFONT)
+            info->nfaces = 1;
+
+        if (result == FONT_CFF_8BIT || result == FONT_CFF_CID)
+            info->cff = true;
+
+        info->cid = result == FONT_CFF_CID || result == FONT_OPENTYPE_CFF_CID;
+    }
+
+    return true;
 }
 
 } // namespace xpdf::fofi::detail
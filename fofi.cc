@@ -2,71 +2,178 @@
 // Copyright 2009 Glyph & Cog, LLC
 // Copyright 2019 Thinkoid, LLC
 
-#include <iostream>
-#include <filesystem>
-namespace fs = std::filesystem;
+#include <string_view>
 
-#include <boost/iostreams/device/mapped_file.hpp>
-namespace io = boost::iostreams;
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <fofi.hh>
+#include <decompress.hh>
+#include <detail/cff.hh>
 #include <detail/fofi.hh>
+#include <reader.hh>
+#include <stats.hh>
+#include <stream.hh>
 
 namespace xpdf::fofi {
 
 bool identify_byextension(const char *filepath, xpdf::fofi::font_type &result)
 {
-    if (fs::path(filepath).extension() == ".dfont")
+    //
+    // Same as fs::path::extension, without building a path:
+    //
+    std::string_view name(filepath);
+    name.remove_prefix(name.rfind('/') + 1);
+
+    const auto pos = name.rfind('.');
+
+    if (pos != 0 && pos != name.npos && name.substr(pos) == ".dfont")
         return result = xpdf::fofi::FONT_DFONT, true;
 
     return false;
 }
 
-bool identify_bycontent(const char *filepath, xpdf::fofi::font_type &result)
+namespace {
+
+FOFI_TARGET_CLONES
+bool bycontent(int fd, font_type &result, font_info *info)
 {
-    if (fs::exists(filepath)) {
-        io::mapped_file_source src(filepath);
+    struct stat st;
+
+    if (0 == ::fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        file_reader src(fd, st.st_size);
+
         auto iter = src.begin(), last = src.end();
-        return detail::identify(iter, last, result);
+        bool success;
+
+        {
+            stats::scoped_stage stage(stats::STAGE_PROBE);
+            success = detail::identify(iter, last, result, info);
+        }
+
+        if (!success && !src.failed()) {
+            stats::scoped_stage stage(stats::STAGE_DECOMPRESS);
+
+            if (identify_compressed(src.begin(), src.end(), result)) {
+                if (info)
+                    info->type = result, info->nfaces = 1;
+
+                success = true;
+            }
+        }
+
+        if (src.failed()) {
+            result = FONT_ERROR, success = false;
+
+            if (info)
+                info->type = FONT_ERROR;
+        }
+
+        stats::result(success || src.failed() ? result : FONT_UNKNOWN);
+        return success;
     }
 
+    stats::result(FONT_ERROR);
     return result = FONT_ERROR, false;
 }
 
+bool bycontent(const char *filepath, font_type &result, font_info *info)
+{
+    stats::scoped_stage file(stats::STAGE_FILE);
+
+    int fd;
+
+    {
+        stats::scoped_stage stage(stats::STAGE_OPEN);
+        fd = ::open(filepath, O_RDONLY | O_CLOEXEC);
+    }
+
+    if (fd < 0) {
+        stats::result(FONT_ERROR);
+        return result = FONT_ERROR, false;
+    }
+
+    const bool success = bycontent(fd, result, info);
+
+    ::close(fd);
+    return success;
+}
+
+} // anonymous namespace
+
+bool identify_bycontent(const char *filepath, xpdf::fofi::font_type &result)
+{
+    return bycontent(filepath, result, 0);
+}
+
+bool identify_fd(int fd, xpdf::fofi::font_type &result)
+{
+    return bycontent(fd, result, 0);
+}
+
 bool identify(const char *filepath, xpdf::fofi::font_type &result)
 {
     return identify_byextension(filepath, result) ||
            identify_bycontent(filepath, result);
 }
 
+FOFI_TARGET_CLONES
 bool identify(const char *pbuf, size_t n, xpdf::fofi::font_type &type)
 {
-    return detail::identify(pbuf, pbuf + n, type);
+    bool success;
+
+    {
+        stats::scoped_stage stage(stats::STAGE_PROBE);
+        success = detail::identify(pbuf, pbuf + n, type);
+    }
+
+    if (!success) {
+        stats::scoped_stage stage(stats::STAGE_DECOMPRESS);
+        success = identify_compressed(pbuf, n, type);
+    }
+
+    stats::result(success ? type : FONT_UNKNOWN);
+    return success;
 }
 
-} // namespace xpdf::fofi
+bool identify(std::streambuf &sb, xpdf::fofi::font_type &type)
+{
+    stream_source src(sb, stream_source::default_window);
+
+    auto iter = src.begin(), last = src.end();
+
+    return detail::identify(iter, last, type) ||
+           identify_compressed(src.begin(), src.end(), type);
+}
 
-int main(int, char **argv)
+bool identify_ex(const char *filepath, xpdf::fofi::font_info &info)
 {
-    static const char *names[] = {
-        "Type1 font in PFA format",
-        "Type1 font in PFB format",
-        "8-bit CFF font",
-        "CID CFF font",
-        "TrueType font",
-        "TrueType font collection",
-        "OpenType container of 8-bit CFF fonts",
-        "OpenType container of CID-keyed CFF fonts",
-        "(unknown)"
-    };
-
-    xpdf::fofi::font_type type;
-
-    if (xpdf::fofi::identify(argv[1], type)) {
-        std::cout << names[type] << std::endl;
-        return 0;
-    }
+    //
+    // The content first, for the faces of dfonts:
+    //
+    font_type type = FONT_UNKNOWN;
+
+    if (bycontent(filepath, type, &info))
+        return true;
+
+    detail::clear(info);
 
-    std::cerr << "error" << std::endl;
-    return 1;
+    if (identify_byextension(filepath, info.type))
+        return info.nfaces = 1, true;
+
+    return info.type = type, false;
 }
+
+bool identify_ex(const char *pbuf, size_t n, xpdf::fofi::font_info &info)
+{
+    font_type type = FONT_UNKNOWN;
+    return detail::identify(pbuf, pbuf + n, type, &info);
+}
+
+bool parse_cff(const char *pbuf, size_t n, xpdf::fofi::cff_info &info)
+{
+    return detail::cff::parse(pbuf, pbuf + n, info);
+}
+
+} // namespace xpdf::fofi
@@ -7,6 +7,10 @@
 
 #include <defs.hh>
 
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
 namespace xpdf::fofi {
 
 enum font_type {
@@ -23,12 +27,110 @@ enum font_type {
     FONT_ERROR
 };
 
+//
+// An sfnt table directory record, tag and all in native byte order.
+//
+struct table_record
+{
+    std::uint32_t tag, checksum, offset, length;
+};
+
+//
+// A face of a collection: FONT_TRUETYPE for glyf-flavored faces, or one of the
+// FONT_OPENTYPE_CFF types, or FONT_UNKNOWN. Offsets are from the beginning of
+// the file.
+//
+struct face_record
+{
+    font_type type;
+    std::uint32_t offset, cff_offset;
+};
+
+//
+// What the identification learns on its way through the font, besides the type.
+// Only the first max_tables table records are kept, ntables is the count in the
+// directory. Likewise for the faces of a collection, which have no table
+// records of their own here. The CFF offset is from the beginning of the file
+// and zero for a bare CFF font.
+//
+struct font_info
+{
+    static constexpr size_t max_tables = 64;
+    static constexpr size_t max_faces = 64;
+
+    font_type type;
+
+    std::uint32_t nfaces;
+    face_record faces[max_faces];
+
+    std::uint32_t ntables;
+    table_record tables[max_tables];
+
+    bool cff, cid;
+    std::uint32_t cff_offset;
+};
+
+//
+// A range of bytes in a CFF font, from the beginning of the CFF data.
+//
+struct cff_range
+{
+    std::uint32_t offset, size;
+};
+
+//
+// The structure of a CFF font, as far as its first Top DICT goes. Offsets are
+// from the beginning of the CFF data and zero for items the font does not
+// have; charset and encoding may also be the ids of the predefined ones. Only
+// the Private DICT ranges of the first max_fds Font DICTs of a CID font are
+// kept, nfds is the count in the FDArray.
+//
+struct cff_info
+{
+    static constexpr size_t max_fds = 64;
+
+    std::uint32_t nfonts, nstrings, nglobal_subrs;
+
+    bool cid;
+    std::uint32_t charstring_type, charset, encoding;
+
+    std::uint32_t charstrings, ncharstrings;
+
+    cff_range private_dict;
+    std::uint32_t nlocal_subrs;
+
+    std::uint32_t fdarray, fdselect, nfds;
+    cff_range fd_private_dicts[max_fds];
+};
+
 bool identify_byextension(const char *, xpdf::fofi::font_type &);
 bool identify_bycontent(const char *, xpdf::fofi::font_type &);
 
 bool identify(const char *, xpdf::fofi::font_type &);
 bool identify(const char *, size_t, xpdf::fofi::font_type &);
 
+//
+// Identifies the content of an open regular file, e.g., a memfd, from its
+// beginning. The descriptor is left open and its offset is not used.
+//
+bool identify_fd(int, xpdf::fofi::font_type &);
+
+//
+// Identifies the font read from a single-pass stream, e.g., a pipe. Only a
+// bounded window of the stream is kept in memory as it is read.
+//
+bool identify(std::streambuf &, xpdf::fofi::font_type &);
+
+bool identify_ex(const char *, xpdf::fofi::font_info &);
+bool identify_ex(const char *, size_t, xpdf::fofi::font_info &);
+
+//
+// Walks the INDEXes and DICTs of the CFF font in the buffer, e.g., the CFF
+// table of an OpenType font, see font_info::cff_offset. Fails on a font that
+// is malformed anywhere along the way.
+//
+bool parse_cff(const char *, size_t, xpdf::fofi::cff_info &);
+
 } // namespace xpdf::fofi
 
 #endif // FOFI_FOFI_HH
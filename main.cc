@@ -0,0 +1,747 @@
+// -*- mode: c++; -*-
+// Copyright 2009 Glyph & Cog, LLC
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fofi.hh>
+#include <batch.hh>
+#include <cache.hh>
+#include <dedup.hh>
+#include <mapped.hh>
+#include <pool.hh>
+#include <results.hh>
+#include <server.hh>
+#include <stats.hh>
+#include <uring.hh>
+#include <verify.hh>
+#include <watch.hh>
+
+namespace {
+
+const char *names[] = {
+    "Type1 font in PFA format",
+    "Type1 font in PFB format",
+    "8-bit CFF font",
+    "CID CFF font",
+    "TrueType font",
+    "TrueType font collection",
+    "OpenType container of 8-bit CFF fonts",
+    "OpenType container of CID-keyed CFF fonts",
+    "Mac OSX dfont",
+    "(unknown)"
+};
+
+void usage(const char *program)
+{
+    std::cerr
+        << "Usage: " << program << " FILE\n"
+        << "       " << program << " [-dkmv] [-a DEPTH] [-c CACHE] [-j JOBS] [-f LIST]... [-o FILE | -u FILE [-w]] [-x] [-S FMT] [PATH]...\n"
+        << "       " << program << " [-S FMT] -s SOCKET\n"
+        << "\n"
+        << "Identifies the type of font files. With a single FILE operand,\n"
+        << "prints the type of that file, - being the standard input.\n"
+        << "Otherwise, prints one `path : type' line for every file in the\n"
+        << "PATH operands, directories being walked recursively. With -s,\n"
+        << "serves identification requests on the SOCKET until interrupted.\n"
+        << "\n"
+        << "  -a DEPTH read with asynchronous I/O, DEPTH files at a time\n"
+        << "           (0 for the default; not with -c)\n"
+        << "  -c CACHE keep the results in the CACHE file across runs\n"
+        << "  -d       identify files with the same content once, and list\n"
+        << "           them in groups after the results (not with -a or -c)\n"
+        << "  -f LIST  read further paths from LIST, one per line (- for stdin)\n"
+        << "  -j JOBS  number of worker threads (default: one per core, at\n"
+        << "           most 64 per core)\n"
+        << "  -k       keep the output in input order\n"
+        << "  -m       read through memory mappings, reading ahead only what\n"
+        << "           the parsers will reach (not with -a or -c)\n"
+        << "  -o FILE  write the results to the columnar FILE instead, see\n"
+        << "           results.hh\n"
+        << "  -u FILE  same as -o, identifying only the files that are new or\n"
+        << "           changed since FILE was written\n"
+        << "  -S FMT   write the probe statistics to the standard error at the\n"
+        << "           end, FMT being json or prometheus (make STATS=1 builds)\n"
+        << "  -v       verify the table bounds and checksums of TrueType and\n"
+        << "           OpenType fonts, failing the ones that are corrupt\n"
+        << "  -w       with -u, keep FILE current with the changes in the\n"
+        << "           directories until interrupted (inotify)\n"
+        << "  -x       with -o, record the faces, tables and CFF flags of the\n"
+        << "           fonts as well, reading them again\n";
+}
+
+//
+// A count in decimal, no sign or blanks, 0 included, up to `max':
+//
+bool parse_count(const char *s, size_t max, size_t &n)
+{
+    if (!std::isdigit(static_cast< unsigned char >(*s)))
+        return false;
+
+    char *end = 0;
+
+    errno = 0;
+    const auto value = std::strtoul(s, &end, 10);
+
+    if (errno || *end || value > max)
+        return false;
+
+    n = value;
+    return true;
+}
+
+struct options_t
+{
+    std::vector< std::string > paths, lists;
+    std::string cache, output, socket, stats;
+    size_t jobs = 0, depth = 0;
+    bool async = false, dedup = false, mapped = false, ordered = false;
+    bool metadata = false, update = false, verify = false, watch = false;
+};
+
+bool parse_options(int argc, char **argv, options_t &options)
+{
+    for (int c; -1 != (c = getopt(argc, argv, "a:c:df:j:kmo:s:u:vwxS:"));) {
+        switch (c) {
+        case 'a':
+            options.async = true;
+
+            if (!parse_count(optarg, ULONG_MAX, options.depth))
+                return false;
+
+            break;
+
+        case 'c':
+            options.cache = optarg;
+            break;
+
+        case 'd':
+            options.dedup = true;
+            break;
+
+        case 'f':
+            options.lists.push_back(optarg);
+            break;
+
+        case 'j':
+            //
+            // More threads than that only contend for the cores:
+            //
+            if (!parse_count(optarg, 64 * xpdf::fofi::default_jobs(),
+                             options.jobs))
+                return false;
+
+            break;
+
+        case 'k':
+            options.ordered = true;
+            break;
+
+        case 'm':
+            options.mapped = true;
+            break;
+
+        case 'o':
+            options.output = optarg;
+            break;
+
+        case 's':
+            options.socket = optarg;
+            break;
+
+        case 'u':
+            options.output = optarg;
+            options.update = true;
+            break;
+
+        case 'v':
+            options.verify = true;
+            break;
+
+        case 'w':
+            options.watch = true;
+            break;
+
+        case 'x':
+            options.metadata = true;
+            break;
+
+        case 'S':
+            if (std::string(optarg) != "json" &&
+                std::string(optarg) != "prometheus")
+                return false;
+
+            options.stats = optarg;
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    options.paths.assign(argv + optind, argv + argc);
+
+    if ((options.metadata && options.output.empty()) ||
+        (options.watch && !options.update))
+        return false;
+
+    if (!options.socket.empty())
+        return options.paths.empty() && options.lists.empty();
+
+    return !options.paths.empty() || !options.lists.empty();
+}
+
+bool collect(const options_t &options, std::vector< std::string > &files)
+{
+    bool success = true;
+
+    for (const auto &path : options.paths) {
+        if (!xpdf::fofi::collect(path, files)) {
+            std::cerr << path << " : cannot walk directory" << std::endl;
+            success = false;
+        }
+    }
+
+    for (const auto &list : options.lists) {
+        if (list == "-") {
+            success = xpdf::fofi::collect(std::cin, files) && success;
+        } else {
+            std::ifstream stream(list);
+
+            if (!stream) {
+                std::cerr << list << " : cannot read list" << std::endl;
+                success = false;
+                continue;
+            }
+
+            success = xpdf::fofi::collect(stream, files) && success;
+        }
+    }
+
+    return success;
+}
+
+//
+// Verifies the sfnt fonts if asked to. Fonts that are not sfnts, compressed
+// ones included, pass as they are:
+//
+bool verify(const options_t &options, const std::string &path,
+            xpdf::fofi::font_type type, xpdf::fofi::verify_result &result)
+{
+    using namespace xpdf::fofi;
+
+    result = { VERIFY_OK, 0, 0 };
+
+    switch (type) {
+    case FONT_TRUETYPE:
+    case FONT_TRUETYPE_COLLECTION:
+    case FONT_OPENTYPE_CFF_8BIT:
+    case FONT_OPENTYPE_CFF_CID:
+        break;
+
+    default:
+        return true;
+    }
+
+    if (!options.verify || xpdf::fofi::verify(path.c_str(), result) ||
+        result.error == VERIFY_FORMAT)
+        return result.error = VERIFY_OK, true;
+
+    return false;
+}
+
+void print(std::ostream &stream, const xpdf::fofi::verify_result &result)
+{
+    stream << to_string(result.error);
+
+    if (result.tag) {
+        stream << " (";
+
+        for (int i = 24; i >= 0; i -= 8)
+            stream << char((result.tag >> i) & 0xff);
+
+        stream << ")";
+    }
+}
+
+void print(const std::string &path, bool success, xpdf::fofi::font_type type,
+           const xpdf::fofi::verify_result &result)
+{
+    //
+    // A font that fails the verification is reported with its type:
+    //
+    const bool failed = result.error != xpdf::fofi::VERIFY_OK;
+
+    std::cout << path << " : " << (success || failed ? names[type] : "error");
+
+    if (failed)
+        print(std::cout << " : ", result);
+
+    std::cout << '\n';
+}
+
+template< typename F >
+void identify(const std::vector< std::string > &files, const options_t &options,
+              const xpdf::fofi::dedup_index *index, F &&f)
+{
+    if (index) {
+        xpdf::fofi::identify(files, options.jobs, *index, f);
+    } else if (options.cache.empty()) {
+        if (options.async)
+            xpdf::fofi::identify_async(files, options.depth, f);
+        else if (options.mapped)
+            xpdf::fofi::identify_mapped(files, options.jobs, f);
+        else
+            xpdf::fofi::identify(files, options.jobs, f);
+    } else {
+        xpdf::fofi::cache cache(options.cache.c_str());
+
+        if (!cache.is_open())
+            std::cerr << options.cache << " : cannot open cache" << std::endl;
+
+        xpdf::fofi::identify(files, options.jobs, cache, f);
+    }
+}
+
+//
+// The groups of files with the same content, one `hash-size : path' line per
+// file:
+//
+void report(const std::vector< std::string > &files,
+            const xpdf::fofi::dedup_index &index)
+{
+    size_t ngroups = 0, nredundant = 0;
+
+    for (size_t g = 0; g < index.ngroups(); ++g) {
+        if (index.group(g).size() > 1) {
+            ++ngroups;
+            nredundant += index.group(g).size() - 1;
+        }
+    }
+
+    std::cout << "\nduplicates : " << ngroups << " groups, " << nredundant
+              << " redundant files\n";
+
+    for (size_t g = 0; g < index.ngroups(); ++g) {
+        const auto group = index.group(g);
+
+        if (group.size() < 2)
+            continue;
+
+        xpdf::fofi::content_key key;
+        index.key(*group.first, key);
+
+        for (auto iter = group.first; iter != group.last; ++iter) {
+            std::cout << std::hex << std::setw(16) << std::setfill('0')
+                      << key.hash << std::dec << '-' << key.size << " : "
+                      << files[*iter] << '\n';
+        }
+    }
+}
+
+//
+// Takes the rows of the paths outside `changed' over to `writer', as they are:
+//
+void keep(const xpdf::fofi::results_file &previous,
+          const std::vector< std::string > &changed,
+          xpdf::fofi::results_writer &writer)
+{
+    std::vector< bool > skip(previous.size());
+
+    for (const auto &path : changed) {
+        const size_t i = previous.find(path);
+
+        if (i != previous.npos)
+            skip[i] = true;
+
+        //
+        // And everything underneath, should it be a directory:
+        //
+        const auto prefix = path + "/";
+
+        for (size_t j = previous.lower_bound(prefix); j < previous.size() &&
+                 0 == previous.path(j).compare(0, prefix.size(), prefix); ++j)
+            skip[j] = true;
+    }
+
+    for (size_t i = 0; i < previous.size(); ++i)
+        if (!skip[i])
+            writer.add(previous, i);
+}
+
+//
+// Takes the files that have not changed since the previous results out of
+// `files', and their rows over to `writer'. Errors are not taken over, and
+// neither is anything when the metadata is asked for but was not recorded:
+//
+void reuse(const options_t &options, const xpdf::fofi::results_file &previous,
+           std::vector< std::string > &files,
+           xpdf::fofi::results_writer &writer, bool &success)
+{
+    using namespace xpdf::fofi;
+
+    if (options.metadata && !previous.has_metadata())
+        return;
+
+    const auto last = std::remove_if(
+        files.begin(), files.end(), [&](const std::string &path) {
+            struct stat st;
+
+            if (0 != ::stat(path.c_str(), &st))
+                return false;
+
+            const size_t i = previous.find(path, st);
+
+            if (i == previous.npos || previous.type(i) == FONT_ERROR)
+                return false;
+
+            if (options.metadata)
+                writer.add(previous, i);
+            else
+                writer.add(path, previous.type(i), st);
+
+            success = previous.type(i) != FONT_UNKNOWN && success;
+            return true;
+        });
+
+    files.erase(last, files.end());
+}
+
+//
+// Identifies the files and writes the results file. With -u, the files that
+// have not changed since it was last written are not read again, and if the
+// `changed' paths are given, only the files under them are looked at: the
+// rows of all others are kept.
+//
+bool record(const options_t &options, std::vector< std::string > files,
+            const std::vector< std::string > *changed = 0)
+{
+    using namespace xpdf::fofi;
+
+    bool success = true;
+
+    results_writer writer;
+
+    if (options.update) {
+        results_file previous(options.output.c_str());
+
+        if (changed)
+            keep(previous, *changed, writer);
+
+        reuse(options, previous, files, writer, success);
+    }
+
+    std::unique_ptr< dedup_index > index;
+
+    if (options.dedup)
+        index = std::make_unique< dedup_index >(files, options.jobs);
+
+    std::mutex mtx;
+
+    identify(
+        files, options, index.get(),
+        [&](size_t i, bool b, font_type type) {
+            verify_result check;
+            b = verify(options, files[i], type, check) && b;
+
+            struct stat st = { };
+            ::stat(files[i].c_str(), &st);
+
+            //
+            // Unrecognized files are FONT_UNKNOWN, fonts that fail the
+            // verification are errors:
+            //
+            if (check.error != VERIFY_OK)
+                type = FONT_ERROR;
+
+            font_info info;
+
+            const bool rich = options.metadata && b &&
+                identify_ex(files[i].c_str(), info);
+
+            std::lock_guard< std::mutex > lock(mtx);
+
+            if (rich)
+                writer.add(files[i], type, st, info);
+            else
+                writer.add(files[i], type, st);
+
+            success = b && success;
+        });
+
+    if (!writer.write(options.output.c_str())) {
+        std::cerr << options.output << " : cannot write results" << std::endl;
+        success = false;
+    } else if (options.update) {
+        std::cout << options.output << " : " << writer.size() << " files, "
+                  << files.size() << " identified\n";
+    }
+
+    if (index)
+        report(files, *index);
+
+    std::cout << std::flush;
+
+    return success;
+}
+
+int scan(const options_t &options)
+{
+    std::vector< std::string > files;
+    bool success = collect(options, files);
+
+    if (!options.output.empty())
+        return record(options, std::move(files)) && success ? 0 : 1;
+
+    std::unique_ptr< xpdf::fofi::dedup_index > index;
+
+    if (options.dedup)
+        index = std::make_unique< xpdf::fofi::dedup_index >(
+            files, options.jobs);
+
+    std::mutex mtx;
+
+    if (options.ordered) {
+        //
+        // Completed results are held back until all the ones preceding them
+        // in input order have been printed:
+        //
+        std::vector< signed char > results(files.size(), -1);
+        std::vector< xpdf::fofi::font_type > types(files.size());
+        std::vector< xpdf::fofi::verify_result > checks(files.size());
+
+        size_t next = 0;
+
+        identify(
+            files, options, index.get(),
+            [&](size_t i, bool b, xpdf::fofi::font_type type) {
+                b = verify(options, files[i], type, checks[i]) && b;
+
+                std::lock_guard< std::mutex > lock(mtx);
+
+                results[i] = b;
+                types[i] = type;
+
+                for (; next < files.size() && results[next] >= 0; ++next) {
+                    print(files[next], results[next], types[next],
+                          checks[next]);
+                    success = results[next] && success;
+                }
+            });
+    } else {
+        identify(
+            files, options, index.get(),
+            [&](size_t i, bool b, xpdf::fofi::font_type type) {
+                xpdf::fofi::verify_result check;
+                b = verify(options, files[i], type, check) && b;
+
+                std::lock_guard< std::mutex > lock(mtx);
+
+                print(files[i], b, type, check);
+                success = b && success;
+            });
+    }
+
+    if (index)
+        report(files, *index);
+
+    std::cout << std::flush;
+
+    return success ? 0 : 1;
+}
+
+xpdf::fofi::server *running;
+xpdf::fofi::watcher *watching;
+
+void interrupt(int)
+{
+    if (running)
+        running->stop();
+
+    if (watching)
+        watching->stop();
+}
+
+void catch_signals()
+{
+    struct sigaction sa = { };
+    sa.sa_handler = interrupt;
+
+    ::sigaction(SIGINT, &sa, 0);
+    ::sigaction(SIGTERM, &sa, 0);
+}
+
+int serve(const options_t &options)
+{
+    xpdf::fofi::server server(options.socket.c_str());
+
+    if (!server.is_open()) {
+        std::cerr << options.socket << " : cannot listen" << std::endl;
+        return 1;
+    }
+
+    running = &server;
+    catch_signals();
+
+    server.run();
+
+    return 0;
+}
+
+//
+// Updates the results file with what changes in the directory operands, until
+// interrupted:
+//
+int watch(const options_t &options)
+{
+    std::vector< std::string > roots;
+
+    for (const auto &path : options.paths)
+        if (fs::is_directory(path))
+            roots.push_back(path);
+
+    xpdf::fofi::watcher watcher(roots);
+
+    if (!watcher.is_open()) {
+        std::cerr << "cannot watch directories" << std::endl;
+        return 1;
+    }
+
+    watching = &watcher;
+    catch_signals();
+
+    //
+    // The watches are in place before the trees are looked at, so that no
+    // change falls in between:
+    //
+    std::vector< std::string > files;
+    collect(options, files);
+
+    record(options, std::move(files));
+
+    for (std::vector< std::string > changed; watcher.wait(changed);
+         changed.clear()) {
+        std::sort(changed.begin(), changed.end());
+        changed.erase(
+            std::unique(changed.begin(), changed.end()), changed.end());
+
+        //
+        // The files that are still there, deleted ones only going away:
+        //
+        for (const auto &path : changed)
+            xpdf::fofi::collect(path, files);
+
+        std::sort(files.begin(), files.end());
+
+        files.erase(
+            std::unique(files.begin(), files.end()), files.end());
+
+        files.erase(
+            std::remove_if(files.begin(), files.end(), [](auto &path) {
+                struct stat st;
+                return 0 != ::stat(path.c_str(), &st) || !S_ISREG(st.st_mode);
+            }), files.end());
+
+        record(options, std::move(files), &changed);
+        files.clear();
+    }
+
+    return 0;
+}
+
+//
+// Writes the statistics if asked to, and passes the exit status through:
+//
+int finish(const options_t &options, int status)
+{
+    if (options.stats.empty())
+        return status;
+
+    xpdf::fofi::stats::snapshot_t snapshot;
+    xpdf::fofi::stats::snapshot(snapshot);
+
+    if (options.stats == "json")
+        xpdf::fofi::stats::write_json(std::cerr, snapshot);
+    else
+        xpdf::fofi::stats::write_prometheus(std::cerr, snapshot);
+
+    return status;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    options_t options;
+
+    if (!parse_options(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!options.stats.empty() && !xpdf::fofi::stats::enabled) {
+        std::cerr << "-S : built without statistics, see make STATS=1"
+                  << std::endl;
+        return 2;
+    }
+
+    if (!options.socket.empty())
+        return finish(options, serve(options));
+
+    //
+    // A single file operand keeps the original, bare output:
+    //
+    if (options.paths.size() == 1 && options.lists.empty() &&
+        options.output.empty() && !fs::is_directory(options.paths[0])) {
+        bool success = false;
+        xpdf::fofi::font_type type;
+
+        if (options.paths[0] == "-") {
+            success = xpdf::fofi::identify(*std::cin.rdbuf(), type);
+        } else {
+            identify(options.paths, options, 0, [&](size_t, bool b, auto t) {
+                success = b;
+                type = t;
+            });
+        }
+
+        xpdf::fofi::verify_result check;
+
+        if (success && !verify(options, options.paths[0], type, check)) {
+            print(std::cerr, check);
+            std::cerr << std::endl;
+            return finish(options, 1);
+        }
+
+        if (success) {
+            std::cout << names[type] << std::endl;
+            return finish(options, 0);
+        }
+
+        std::cerr << "error" << std::endl;
+        return finish(options, 1);
+    }
+
+    if (options.watch)
+        return finish(options, watch(options));
+
+    return finish(options, scan(options));
+}
@@ -0,0 +1,235 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mapped.hh>
+#include <stats.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+//
+// Enough of a CFF table for the header and the first INDEX headers, which
+// is as far as identify_cff goes in all but the oddest fonts:
+//
+constexpr std::uint64_t cff_window = 4096;
+
+std::uint32_t load_be32(const char *p)
+{
+    return
+        std::uint32_t(std::uint8_t(p[0])) << 24 |
+        std::uint32_t(std::uint8_t(p[1])) << 16 |
+        std::uint32_t(std::uint8_t(p[2])) <<  8 |
+        std::uint32_t(std::uint8_t(p[3]));
+}
+
+void add(access_plan &plan, std::uint64_t off, std::uint64_t len,
+         std::uint64_t size)
+{
+    if (off >= size || 0 == len || plan.n == access_plan::max_ranges)
+        return;
+
+    plan.ranges[plan.n++] = { off, std::min(len, size - off) };
+}
+
+//
+// In file order, the overlapping and adjacent ranges merged:
+//
+void normalize(access_plan &plan)
+{
+    auto first = plan.ranges, last = plan.ranges + plan.n;
+
+    std::sort(first, last, [](auto &a, auto &b) {
+        return a.offset < b.offset;
+    });
+
+    size_t n = 0;
+
+    for (auto iter = first; iter != last; ++iter) {
+        if (n && plan.ranges[n - 1].offset + plan.ranges[n - 1].size >=
+            iter->offset) {
+            auto &prev = plan.ranges[n - 1];
+
+            prev.size = std::max(
+                prev.offset + prev.size, iter->offset + iter->size) -
+                prev.offset;
+        } else {
+            plan.ranges[n++] = *iter;
+        }
+    }
+
+    plan.n = n;
+}
+
+void plan_sfnt(const char *head, size_t n, std::uint64_t size,
+               access_plan &plan, bool cff)
+{
+    if (n < 12)
+        return;
+
+    const std::uint64_t ntables = std::uint8_t(head[4]) << 8 |
+        std::uint8_t(head[5]);
+
+    add(plan, 12, 16 * ntables, size);
+
+    if (!cff)
+        return;
+
+    //
+    // The CFF table, if its record is within the head:
+    //
+    auto iter = head + 4;
+
+    detail::table_directory(
+        head, iter, head + n, [&](auto, auto, auto &rec) {
+            if (rec.tag != detail::magic("CFF "))
+                return true;
+
+            add(plan, rec.offset, std::min(
+                    std::uint64_t(rec.length), cff_window), size);
+
+            return false;
+        });
+}
+
+void plan_dfont(const char *head, size_t n, std::uint64_t size,
+                access_plan &plan)
+{
+    if (n < 16)
+        return;
+
+    add(plan, load_be32(head + 4), load_be32(head + 12), size);
+}
+
+} // anonymous namespace
+
+void plan_access(const char *head, size_t n, std::uint64_t size,
+                 access_plan &plan)
+{
+    plan.n = 0;
+
+    switch (detail::leading_word(head, head + n)) {
+    case detail::magic("\x00\x01\x00\x00"):
+    case detail::magic("true"):
+        plan_sfnt(head, n, size, plan, false);
+        break;
+
+    case detail::magic("OTTO"):
+        plan_sfnt(head, n, size, plan, true);
+        break;
+
+    case detail::magic("\x00\x00\x01\x00"):
+        plan_dfont(head, n, size, plan);
+        break;
+
+    default:
+        break;
+    }
+
+    //
+    // What is in the head already is no news:
+    //
+    for (size_t i = 0; i < plan.n; ++i) {
+        auto &r = plan.ranges[i];
+
+        if (r.offset + r.size <= n)
+            r.size = 0;
+    }
+
+    plan.n = std::remove_if(
+        plan.ranges, plan.ranges + plan.n, [](auto &r) {
+            return 0 == r.size;
+        }) - plan.ranges;
+
+    normalize(plan);
+}
+
+namespace {
+
+bool bymapping(int fd, font_type &result)
+{
+    struct stat st;
+
+    if (0 != ::fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        stats::result(FONT_ERROR);
+        return result = FONT_ERROR, false;
+    }
+
+    if (0 == st.st_size)
+        return identify("", 0, result);
+
+    const size_t size = st.st_size;
+    const bool small = size <= populate_size;
+
+    void *p = ::mmap(0, size, PROT_READ,
+                     MAP_PRIVATE | (small ? MAP_POPULATE : 0), fd, 0);
+
+    if (MAP_FAILED == p) {
+        stats::result(FONT_ERROR);
+        return result = FONT_ERROR, false;
+    }
+
+    const auto buf = static_cast< const char * >(p);
+
+    if (!small) {
+        //
+        // No readahead around the faults; the pages in the plan are read
+        // ahead, all at once, instead:
+        //
+        ::madvise(p, size, MADV_RANDOM);
+
+        static const size_t page = ::sysconf(_SC_PAGESIZE);
+
+        access_plan plan;
+        plan_access(buf, std::min(size, page), size, plan);
+
+        for (size_t i = 0; i < plan.n; ++i) {
+            const auto &r = plan.ranges[i];
+            const auto first = r.offset - r.offset % page;
+
+            ::madvise(static_cast< char * >(p) + first,
+                      r.offset + r.size - first, MADV_WILLNEED);
+        }
+    }
+
+    const bool success = identify(buf, size, result);
+
+    ::munmap(p, size);
+    return success;
+}
+
+} // anonymous namespace
+
+bool identify_mapped(const char *filepath, xpdf::fofi::font_type &result)
+{
+    if (identify_byextension(filepath, result))
+        return true;
+
+    stats::scoped_stage file(stats::STAGE_FILE);
+
+    int fd;
+
+    {
+        stats::scoped_stage stage(stats::STAGE_OPEN);
+        fd = ::open(filepath, O_RDONLY | O_CLOEXEC);
+    }
+
+    if (fd < 0) {
+        stats::result(FONT_ERROR);
+        return result = FONT_ERROR, false;
+    }
+
+    const bool success = bymapping(fd, result);
+
+    ::close(fd);
+    return success;
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,72 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_MAPPED_HH
+#define FOFI_MAPPED_HH
+
+#include <fofi.hh>
+#include <pool.hh>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xpdf::fofi {
+
+struct access_range
+{
+    std::uint64_t offset, size;
+};
+
+//
+// The ranges of a file the identification will read past its first bytes, in
+// file order, without overlaps. Only what the parsers must reach is planned:
+// the table directory of an sfnt and the beginning of its CFF table, or the
+// resource map of a dfont.
+//
+struct access_plan
+{
+    static constexpr size_t max_ranges = 4;
+
+    size_t n;
+    access_range ranges[max_ranges];
+};
+
+//
+// Plans the reads from the first `n' bytes of a file of `size' bytes, e.g.,
+// its first page. Ranges are clipped to the file; structures that are not
+// within `head' are left to the parsers.
+//
+void plan_access(const char *head, size_t n, std::uint64_t size,
+                 access_plan &);
+
+//
+// Identifies a file through a memory mapping, with the same results as
+// identify(path). Small files are mapped populated, in one go; larger ones are
+// mapped for random access, and only the pages in the plan are read ahead.
+// Like all mappings, not for files that may shrink while being read.
+//
+bool identify_mapped(const char *, xpdf::fofi::font_type &);
+
+//
+// Files up to this size are mapped populated:
+//
+constexpr size_t populate_size = 64 << 10;
+
+//
+// Same as identify(files, jobs, f) in batch.hh, through memory mappings.
+//
+template< typename F >
+void identify_mapped(const std::vector< std::string > &files, size_t jobs,
+                     F &&f)
+{
+    parallel_for(files.size(), jobs, [&](size_t i) {
+        font_type type = FONT_UNKNOWN;
+        const bool success = identify_mapped(files[i].c_str(), type);
+        f(i, success, type);
+    });
+}
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_MAPPED_HH
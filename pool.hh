@@ -0,0 +1,129 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_POOL_HH
+#define FOFI_POOL_HH
+
+#include <defs.hh>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xpdf::fofi {
+namespace detail {
+
+//
+// A contiguous slice [first, last) of the index range owned by one worker.
+//
+struct slice_t
+{
+    std::mutex mtx;
+    size_t first = 0, last = 0;
+};
+
+inline bool pop(slice_t &slice, size_t &i)
+{
+    std::lock_guard< std::mutex > lock(slice.mtx);
+
+    if (slice.first < slice.last) {
+        i = slice.first++;
+        return true;
+    }
+
+    return false;
+}
+
+inline bool steal(std::vector< slice_t > &slices, size_t self)
+{
+    const auto n = slices.size();
+
+    for (size_t i = 1; i < n; ++i) {
+        auto &victim = slices[(self + i) % n];
+
+        size_t first, last;
+
+        {
+            std::lock_guard< std::mutex > lock(victim.mtx);
+
+            if (victim.first == victim.last)
+                continue;
+
+            //
+            // Take the back half, rounding up so that a single remaining
+            // index can be stolen as well:
+            //
+            last = victim.last;
+            first = victim.last -= (victim.last - victim.first + 1) / 2;
+        }
+
+        std::lock_guard< std::mutex > lock(slices[self].mtx);
+        slices[self].first = first;
+        slices[self].last = last;
+
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace detail
+
+inline size_t default_jobs()
+{
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+//
+// Calls f(i) for every i in [0, n) on up to `jobs' threads, the calling thread
+// included. Each worker starts with an equal contiguous slice of the range and
+// consumes it front to back; a worker that runs dry steals the back half of
+// another worker's slice, until no work is left anywhere.
+//
+template< typename F >
+void parallel_for(size_t n, size_t jobs, F &&f)
+{
+    if (0 == jobs)
+        jobs = default_jobs();
+
+    jobs = std::min(jobs, n);
+
+    if (jobs < 2) {
+        for (size_t i = 0; i < n; ++i)
+            f(i);
+
+        return;
+    }
+
+    std::vector< detail::slice_t > slices(jobs);
+
+    for (size_t i = 0; i < jobs; ++i) {
+        slices[i].first = n * i / jobs;
+        slices[i].last = n * (i + 1) / jobs;
+    }
+
+    auto worker = [&](size_t self) {
+        for (size_t i = 0;;) {
+            if (detail::pop(slices[self], i))
+                f(i);
+            else if (!detail::steal(slices, self))
+                break;
+        }
+    };
+
+    std::vector< std::thread > threads;
+    threads.reserve(jobs - 1);
+
+    for (size_t i = 1; i < jobs; ++i)
+        threads.emplace_back(worker, i);
+
+    worker(0);
+
+    for (auto &t : threads)
+        t.join();
+}
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_POOL_HH
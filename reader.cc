@@ -0,0 +1,120 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <unistd.h>
+
+#include <reader.hh>
+#include <stats.hh>
+
+namespace xpdf::fofi {
+
+buffer_pool::buffer_pool(size_t capacity)
+    : capacity(capacity)
+{
+    free.reserve(capacity);
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (auto p : free)
+        delete [] p;
+}
+
+char *buffer_pool::acquire()
+{
+    {
+        std::lock_guard< std::mutex > lock(mtx);
+
+        if (!free.empty()) {
+            auto p = free.back();
+            free.pop_back();
+            return p;
+        }
+    }
+
+    return new char[block_size];
+}
+
+void buffer_pool::release(char *p)
+{
+    {
+        std::lock_guard< std::mutex > lock(mtx);
+
+        if (free.size() < capacity) {
+            free.push_back(p);
+            return;
+        }
+    }
+
+    delete [] p;
+}
+
+buffer_pool &buffer_pool::instance()
+{
+    //
+    // Enough for every core to hold a few blocks at once:
+    //
+    static buffer_pool pool(8 * std::max(1U, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+file_reader::file_reader(int fd, size_t size, buffer_pool &pool)
+    : current(blocks), pool(pool), fd(fd), size_(size)
+{ }
+
+file_reader::~file_reader()
+{
+    for (auto &block : blocks)
+        if (block.p)
+            pool.release(block.p);
+}
+
+const char &file_reader::load(size_t off)
+{
+    const size_t base = off - off % buffer_pool::block_size;
+
+    for (auto &block : blocks) {
+        if (block.p && block.base == base && block.size) {
+            current = &block;
+            return block.p[off - base];
+        }
+    }
+
+    auto &block = blocks[next];
+    next = (next + 1) % nblocks;
+
+    if (0 == block.p)
+        block.p = pool.acquire();
+
+    block.base = base;
+    block.size = std::min(buffer_pool::block_size, size_ - base);
+
+    for (size_t n = 0; n < block.size;) {
+        const auto result = ::pread(fd, block.p + n, block.size - n, base + n);
+
+        if (result > 0) {
+            n += result;
+        } else if (result < 0 && errno == EINTR) {
+            continue;
+        } else {
+            //
+            // Error, or the file shrunk underneath us:
+            //
+            memset(block.p + n, 0, block.size - n);
+            failed_ = true;
+            break;
+        }
+    }
+
+    stats::io(block.size, base != sequential, failed_);
+    sequential = base + block.size;
+
+    current = &block;
+    return block.p[off - base];
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,172 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_READER_HH
+#define FOFI_READER_HH
+
+#include <defs.hh>
+
+#include <cstddef>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+namespace xpdf::fofi {
+
+//
+// A bounded pool of fixed-size read buffers, shared by all readers. Buffers
+// released while the pool already holds `capacity' free ones are freed.
+//
+struct buffer_pool
+{
+    static constexpr size_t block_size = 4096;
+
+    explicit buffer_pool(size_t capacity);
+    ~buffer_pool();
+
+    buffer_pool(const buffer_pool &) = delete;
+    buffer_pool &operator=(const buffer_pool &) = delete;
+
+    char *acquire();
+    void release(char *);
+
+    static buffer_pool &instance();
+
+private:
+    std::mutex mtx;
+    std::vector< char * > free;
+    size_t capacity;
+};
+
+//
+// A random-access iterator over the bytes of a source read on demand, through
+// its at(offset) member:
+//
+template< typename Source >
+struct offset_iterator
+{
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const char *;
+    using reference = const char &;
+
+    offset_iterator() = default;
+    offset_iterator(Source *src, size_t off) : src(src), off(off) { }
+
+    reference operator*() const { return src->at(off); }
+    reference operator[](difference_type n) const { return src->at(off + n); }
+
+    offset_iterator &operator++() { return ++off, *this; }
+    offset_iterator &operator--() { return --off, *this; }
+    offset_iterator operator++(int) { auto tmp = *this; return ++off, tmp; }
+    offset_iterator operator--(int) { auto tmp = *this; return --off, tmp; }
+
+    offset_iterator &operator+=(difference_type n) { return off += n, *this; }
+    offset_iterator &operator-=(difference_type n) { return off -= n, *this; }
+
+    offset_iterator operator+(difference_type n) const
+    {
+        return { src, off + n };
+    }
+
+    offset_iterator operator-(difference_type n) const
+    {
+        return { src, off - n };
+    }
+
+    friend offset_iterator
+    operator+(difference_type n, const offset_iterator &other)
+    {
+        return other + n;
+    }
+
+    difference_type operator-(const offset_iterator &other) const
+    {
+        return difference_type(off) - difference_type(other.off);
+    }
+
+    using self = offset_iterator;
+
+    bool operator==(const self &other) const { return off == other.off; }
+    bool operator!=(const self &other) const { return off != other.off; }
+    bool operator< (const self &other) const { return off <  other.off; }
+    bool operator> (const self &other) const { return off >  other.off; }
+    bool operator<=(const self &other) const { return off <= other.off; }
+    bool operator>=(const self &other) const { return off >= other.off; }
+
+    Source *src = 0;
+    size_t off = 0;
+};
+
+//
+// A file read on demand with pread, one pool block at a time: only the blocks
+// touched by the parsers are ever read, and a handful of them are kept. Read
+// errors make the reader `failed' and read as zeroes.
+//
+struct file_reader
+{
+    using iterator = offset_iterator< file_reader >;
+
+    file_reader(int fd, size_t size, buffer_pool &pool = buffer_pool::instance());
+    ~file_reader();
+
+    file_reader(const file_reader &) = delete;
+    file_reader &operator=(const file_reader &) = delete;
+
+    iterator begin();
+    iterator end();
+
+    size_t size() const { return size_; }
+    bool failed() const { return failed_; }
+
+    const char &at(size_t off)
+    {
+        ASSERT(off < size_);
+
+        if (off - current->base < current->size)
+            return current->p[off - current->base];
+
+        return load(off);
+    }
+
+private:
+    const char &load(size_t);
+
+private:
+    struct block_t
+    {
+        size_t base = 0, size = 0;
+        char *p = 0;
+    };
+
+    static constexpr size_t nblocks = 4;
+
+    block_t blocks[nblocks], *current;
+    size_t next = 0;
+
+    //
+    // Where a sequential read would continue, for the statistics:
+    //
+    size_t sequential = 0;
+
+    buffer_pool &pool;
+
+    int fd;
+    size_t size_;
+    bool failed_ = false;
+};
+
+inline file_reader::iterator file_reader::begin()
+{
+    return { this, 0 };
+}
+
+inline file_reader::iterator file_reader::end()
+{
+    return { this, size_ };
+}
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_READER_HH
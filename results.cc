@@ -0,0 +1,360 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <results.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+constexpr size_t alignment = 64;
+
+//
+// Written as a word in the byte order of the host, so that a file from a host
+// of the other order does not match:
+//
+constexpr std::uint64_t results_magic = 0x6f666973656c7331ULL; // "ofiselr1"
+constexpr std::uint32_t results_version = 1;
+
+struct column_entry
+{
+    std::uint64_t offset, size;
+};
+
+//
+// The header, followed by `ncolumns' entries, by column_t; an absent column
+// has a zero offset. Readers ignore the columns they do not know.
+//
+struct header_t
+{
+    std::uint64_t magic;
+    std::uint32_t version, ncolumns;
+    std::uint64_t nrows;
+};
+
+//
+// The width of the elements of a column, 1 for the path data:
+//
+constexpr size_t widths[] = { 8, 1, 1, 8, 8, 4, 4, 1 };
+static_assert(sizeof widths / sizeof *widths == COLUMN_MAX);
+
+size_t align(size_t n)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+bool write_all(int fd, const void *pbuf, size_t n)
+{
+    for (auto p = static_cast< const char * >(pbuf); n;) {
+        const auto result = ::write(fd, p, n);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        p += result;
+        n -= result;
+    }
+
+    return true;
+}
+
+std::int64_t mtime_of(const struct stat &st)
+{
+    return std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+} // anonymous namespace
+
+void results_writer::add(std::string path, font_type type,
+                         const struct stat &st)
+{
+    rows.push_back({
+            std::move(path), std::uint64_t(st.st_size), mtime_of(st), 0, 0,
+            std::uint8_t(type), 0 });
+}
+
+void results_writer::add(std::string path, font_type type,
+                         const struct stat &st, const font_info &info)
+{
+    add(std::move(path), type, st);
+
+    auto &row = rows.back();
+
+    row.nfaces = info.nfaces;
+    row.ntables = info.ntables;
+    row.flags = (info.cff ? RESULT_CFF : 0) | (info.cid ? RESULT_CID : 0);
+
+    metadata = true;
+}
+
+void results_writer::add(const results_file &other, size_t i)
+{
+    rows.push_back({
+            std::string(other.path(i)), other.file_size(i), other.mtime(i),
+            other.nfaces(i), other.ntables(i), std::uint8_t(other.type(i)),
+            other.flags(i) });
+
+    metadata = metadata || other.has_metadata();
+}
+
+bool results_writer::write(const char *filepath) const
+{
+    std::vector< const row_t * > sorted(rows.size());
+
+    std::transform(rows.begin(), rows.end(), sorted.begin(), [](auto &row) {
+        return &row;
+    });
+
+    std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+        return a->path < b->path;
+    });
+
+    const size_t n = rows.size();
+
+    size_t ndata = 0;
+
+    for (auto p : sorted)
+        ndata += p->path.size();
+
+    //
+    // The layout, the header and the directory first:
+    //
+    column_entry dir[COLUMN_MAX] = { };
+
+    const size_t sizes[] = {
+        8 * (n + 1), ndata, n, 8 * n, 8 * n, 4 * n, 4 * n, n
+    };
+
+    static_assert(sizeof sizes / sizeof *sizes == COLUMN_MAX);
+
+    const size_t ncolumns = metadata ? COLUMN_MAX : COLUMN_FACES;
+
+    size_t off = sizeof(header_t) + sizeof dir;
+
+    for (size_t i = 0; i < ncolumns; ++i) {
+        dir[i] = { align(off), sizes[i] };
+        off = dir[i].offset + sizes[i];
+    }
+
+    std::string buf(off, '\0');
+
+    const header_t header = {
+        results_magic, results_version, COLUMN_MAX, n
+    };
+
+    memcpy(&buf[0], &header, sizeof header);
+    memcpy(&buf[sizeof header], dir, sizeof dir);
+
+    const auto column = [&](column_t i) {
+        return &buf[dir[i].offset];
+    };
+
+    //
+    // The columns, row by row:
+    //
+    std::uint64_t pos = 0;
+    memcpy(column(COLUMN_PATH_OFFSET), &pos, 8);
+
+    for (size_t i = 0; i < n; ++i) {
+        const auto &row = *sorted[i];
+
+        memcpy(column(COLUMN_PATH_DATA) + pos, row.path.data(),
+               row.path.size());
+        pos += row.path.size();
+
+        memcpy(column(COLUMN_PATH_OFFSET) + 8 * (i + 1), &pos, 8);
+        memcpy(column(COLUMN_TYPE) + i, &row.type, 1);
+        memcpy(column(COLUMN_SIZE) + 8 * i, &row.size, 8);
+        memcpy(column(COLUMN_MTIME) + 8 * i, &row.mtime, 8);
+
+        if (metadata) {
+            memcpy(column(COLUMN_FACES) + 4 * i, &row.nfaces, 4);
+            memcpy(column(COLUMN_TABLES) + 4 * i, &row.ntables, 4);
+            memcpy(column(COLUMN_FLAGS) + i, &row.flags, 1);
+        }
+    }
+
+    std::string temp = std::string(filepath) + ".XXXXXX";
+
+    const int fd = ::mkstemp(&temp[0]);
+
+    if (fd < 0)
+        return false;
+
+    bool success = 0 == ::fchmod(fd, 0644) &&
+        write_all(fd, buf.data(), buf.size()) && 0 == ::fdatasync(fd);
+
+    success = 0 == ::close(fd) && success;
+    success = success && 0 == ::rename(temp.c_str(), filepath);
+
+    if (!success)
+        ::unlink(temp.c_str());
+
+    return success;
+}
+
+results_file::results_file(const char *filepath)
+{
+    const int fd = ::open(filepath, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return;
+
+    struct stat st;
+
+    if (0 == ::fstat(fd, &st) && size_t(st.st_size) >= sizeof(header_t)) {
+        void *p = ::mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (MAP_FAILED != p) {
+            base = static_cast< const char * >(p);
+            length = st.st_size;
+        }
+    }
+
+    ::close(fd);
+
+    if (base && !validate()) {
+        ::munmap(const_cast< char * >(base), length);
+
+        base = 0, length = 0, n = 0;
+        offsets = 0, paths = 0, types_ = 0, sizes_ = 0, mtimes_ = 0;
+        faces_ = 0, tables_ = 0, flags_ = 0;
+    }
+}
+
+results_file::~results_file()
+{
+    if (base)
+        ::munmap(const_cast< char * >(base), length);
+}
+
+bool results_file::validate()
+{
+    header_t header;
+    memcpy(&header, base, sizeof header);
+
+    if (header.magic != results_magic ||
+        header.version != results_version ||
+        header.ncolumns < COLUMN_FACES ||
+        (length - sizeof header) / sizeof(column_entry) < header.ncolumns ||
+        header.nrows >= length)
+        return false;
+
+    const size_t nrows = header.nrows;
+
+    //
+    // Every column is aligned, within the file, and as long as it must be:
+    //
+    const char *columns[COLUMN_MAX] = { };
+
+    const size_t ncolumns = std::min< size_t >(header.ncolumns, COLUMN_MAX);
+
+    for (size_t i = 0; i < ncolumns; ++i) {
+        column_entry e;
+        memcpy(&e, base + sizeof header + i * sizeof e, sizeof e);
+
+        if (0 == e.offset)
+            continue;
+
+        if (e.offset % alignment || e.offset > length ||
+            length - e.offset < e.size)
+            return false;
+
+        const size_t count = COLUMN_PATH_OFFSET == i ? nrows + 1 : nrows;
+
+        if (COLUMN_PATH_DATA != i && e.size != count * widths[i])
+            return false;
+
+        columns[i] = base + e.offset;
+
+        if (COLUMN_PATH_DATA == i) {
+            //
+            // The path offsets are checked against the size of the data:
+            //
+            if (!columns[COLUMN_PATH_OFFSET])
+                return false;
+
+            auto q = reinterpret_cast< const std::uint64_t * >(
+                columns[COLUMN_PATH_OFFSET]);
+
+            for (size_t j = 0; j < nrows; ++j)
+                if (q[j] > q[j + 1])
+                    return false;
+
+            if (q[0] != 0 || q[nrows] != e.size)
+                return false;
+        }
+    }
+
+    for (size_t i = 0; i < COLUMN_FACES; ++i)
+        if (!columns[i])
+            return false;
+
+    //
+    // The metadata columns go together:
+    //
+    if (!columns[COLUMN_FACES] != !columns[COLUMN_TABLES] ||
+        !columns[COLUMN_FACES] != !columns[COLUMN_FLAGS])
+        return false;
+
+    n = nrows;
+
+    offsets = reinterpret_cast< const std::uint64_t * >(
+        columns[COLUMN_PATH_OFFSET]);
+    paths = columns[COLUMN_PATH_DATA];
+
+    types_ = reinterpret_cast< const std::uint8_t * >(columns[COLUMN_TYPE]);
+    sizes_ = reinterpret_cast< const std::uint64_t * >(columns[COLUMN_SIZE]);
+    mtimes_ = reinterpret_cast< const std::int64_t * >(columns[COLUMN_MTIME]);
+
+    faces_ = reinterpret_cast< const std::uint32_t * >(columns[COLUMN_FACES]);
+    tables_ = reinterpret_cast< const std::uint32_t * >(
+        columns[COLUMN_TABLES]);
+    flags_ = reinterpret_cast< const std::uint8_t * >(columns[COLUMN_FLAGS]);
+
+    return true;
+}
+
+size_t results_file::lower_bound(std::string_view key) const
+{
+    size_t first = 0, last = n;
+
+    while (first < last) {
+        const size_t mid = first + (last - first) / 2;
+
+        if (path(mid) < key)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    return first;
+}
+
+size_t results_file::find(std::string_view key) const
+{
+    const size_t i = lower_bound(key);
+    return i < n && path(i) == key ? i : npos;
+}
+
+size_t results_file::find(std::string_view key, const struct stat &st) const
+{
+    const size_t i = find(key);
+
+    return i != npos && sizes_[i] == std::uint64_t(st.st_size) &&
+        mtimes_[i] == mtime_of(st) ? i : npos;
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,181 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_RESULTS_HH
+#define FOFI_RESULTS_HH
+
+#include <fofi.hh>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace xpdf::fofi {
+
+//
+// The results of a scan in a columnar file, for the jobs that query and join
+// them later, see results_file. The rows are sorted by path, and every column
+// is an array at a cache line boundary, in the byte order of the host:
+//
+//   COLUMN_PATH_OFFSET  u64 x (n + 1)  the paths, in COLUMN_PATH_DATA
+//   COLUMN_PATH_DATA    char           the paths, back to back, no terminators
+//   COLUMN_TYPE         u8             the font_type, see below
+//   COLUMN_SIZE         u64            the file size
+//   COLUMN_MTIME        i64            the modification time, in ns
+//
+// and optionally, the metadata of identify_ex:
+//
+//   COLUMN_FACES        u32            the faces of a collection or a dfont
+//   COLUMN_TABLES       u32            the tables of an sfnt
+//   COLUMN_FLAGS        u8             RESULT_CFF, RESULT_CID
+//
+// The type of a file that is not recognized is FONT_UNKNOWN, the one of a file
+// that cannot be read or fails its verification FONT_ERROR.
+//
+enum column_t {
+    COLUMN_PATH_OFFSET,
+    COLUMN_PATH_DATA,
+    COLUMN_TYPE,
+    COLUMN_SIZE,
+    COLUMN_MTIME,
+    COLUMN_FACES,
+    COLUMN_TABLES,
+    COLUMN_FLAGS,
+    COLUMN_MAX
+};
+
+enum result_flags_t {
+    RESULT_CFF = 1,
+    RESULT_CID = 2
+};
+
+struct results_file;
+
+//
+// Collects the rows of a scan and writes them out. The metadata columns are
+// written if any row has metadata; the rows without have zeroes there.
+//
+struct results_writer
+{
+    void add(std::string, font_type, const struct stat &);
+    void add(std::string, font_type, const struct stat &, const font_info &);
+
+    //
+    // A row of an earlier file, as it is:
+    //
+    void add(const results_file &, size_t);
+
+    size_t size() const { return rows.size(); }
+
+    //
+    // Writes to a temporary file next to the destination, then renames it
+    // over, so that readers that have the previous file mapped keep it:
+    //
+    bool write(const char *) const;
+
+private:
+    struct row_t
+    {
+        std::string path;
+        std::uint64_t size;
+        std::int64_t mtime;
+        std::uint32_t nfaces, ntables;
+        std::uint8_t type, flags;
+    };
+
+    std::vector< row_t > rows;
+    bool metadata = false;
+};
+
+//
+// A results file, mapped read-only and validated when opened. A file that
+// cannot be opened, is truncated, or was written on a host of the other byte
+// order is not open, and has no rows.
+//
+struct results_file
+{
+    static constexpr size_t npos = size_t(-1);
+
+    explicit results_file(const char *);
+    ~results_file();
+
+    results_file(const results_file &) = delete;
+    results_file &operator=(const results_file &) = delete;
+
+    bool is_open() const { return base; }
+
+    size_t size() const { return n; }
+    bool has_metadata() const { return faces_; }
+
+    std::string_view path(size_t i) const
+    {
+        return { paths + offsets[i], size_t(offsets[i + 1] - offsets[i]) };
+    }
+
+    //
+    // A type out of range is taken for an error:
+    //
+    font_type type(size_t i) const
+    {
+        return font_type(std::min< unsigned >(types_[i], FONT_ERROR));
+    }
+
+    std::uint64_t file_size(size_t i) const { return sizes_[i]; }
+    std::int64_t mtime(size_t i) const { return mtimes_[i]; }
+
+    //
+    // Zero without metadata:
+    //
+    std::uint32_t nfaces(size_t i) const { return faces_ ? faces_[i] : 0; }
+    std::uint32_t ntables(size_t i) const { return tables_ ? tables_[i] : 0; }
+    std::uint8_t flags(size_t i) const { return flags_ ? flags_[i] : 0; }
+
+    //
+    // The row of a path, or npos, by binary search:
+    //
+    size_t find(std::string_view) const;
+
+    //
+    // Same as above, if the row has the size and modification time in the
+    // stat data, i.e., the file has not changed since:
+    //
+    size_t find(std::string_view, const struct stat &) const;
+
+    //
+    // The first row whose path is not less than the argument, e.g., the first
+    // of the files under a directory, size() if none:
+    //
+    size_t lower_bound(std::string_view) const;
+
+    //
+    // The columns as arrays of size() elements, for scans over all rows:
+    //
+    const std::uint8_t *types() const { return types_; }
+    const std::uint64_t *sizes() const { return sizes_; }
+    const std::int64_t *mtimes() const { return mtimes_; }
+
+private:
+    bool validate();
+
+private:
+    const char *base = 0;
+    size_t length = 0, n = 0;
+
+    const std::uint64_t *offsets = 0;
+    const char *paths = 0;
+
+    const std::uint8_t *types_ = 0;
+    const std::uint64_t *sizes_ = 0;
+    const std::int64_t *mtimes_ = 0;
+
+    const std::uint32_t *faces_ = 0, *tables_ = 0;
+    const std::uint8_t *flags_ = 0;
+};
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_RESULTS_HH
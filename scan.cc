@@ -0,0 +1,183 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define FOFI_SCAN_X86 1
+#endif
+
+#include <scan.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+//
+// The first two bytes of all signatures: OpenType, TrueType collection and
+// `true' TrueType fonts, 1.0 TrueType fonts -- and dfonts, from their second
+// byte on -- Type 1 fonts, in both forms, and CFF fonts.
+//
+constexpr unsigned char pairs[][2] = {
+    { 'O', 'T' }, { 't', 't' }, { 't', 'r' }, { 0x00, 0x01 }, { '%', '!' },
+    { 0x80, 0x01 }, { 0x01, 0x00 }
+};
+
+struct scanner
+{
+    scanner(const char *p, size_t n, std::vector< scan_hit > &hits)
+        : p(p), n(n), hits(hits)
+    { }
+
+    //
+    // Runs the probe the word at `off' selects, if any:
+    //
+    void probe(size_t off)
+    {
+        const char *iter = p + off, *last = p + n;
+
+        const auto which = detail::probe_for(detail::leading_word(iter, last));
+
+        font_type type = FONT_UNKNOWN;
+
+        if (which != detail::PROBE_NONE &&
+            detail::probe(which, iter, last, type, 0))
+            hits.push_back({ off, type });
+    }
+
+    //
+    // A candidate pair at `off':
+    //
+    void check(size_t off)
+    {
+        //
+        // The dfont signature, 00 00 01 00, is found by its second byte:
+        //
+        if (off && 0 == p[off - 1] && 0 == p[off] && 1 == p[off + 1])
+            probe(off - 1);
+
+        probe(off);
+    }
+
+    //
+    // Up to the last but one byte, all signatures being longer than that:
+    //
+    void scalar(size_t from)
+    {
+        for (size_t i = from; i + 1 < n; ++i) {
+            const auto a = static_cast< unsigned char >(p[i]);
+            const auto b = static_cast< unsigned char >(p[i + 1]);
+
+            for (const auto &pair : pairs) {
+                if (a == pair[0] && b == pair[1]) {
+                    check(i);
+                    break;
+                }
+            }
+        }
+    }
+
+#if defined(FOFI_SCAN_X86)
+    __attribute__((target("sse2"))) void sse2()
+    {
+        size_t i = 0;
+
+        for (; i + 17 <= n; i += 16) {
+            const auto v0 = _mm_loadu_si128(
+                reinterpret_cast< const __m128i * >(p + i));
+            const auto v1 = _mm_loadu_si128(
+                reinterpret_cast< const __m128i * >(p + i + 1));
+
+            auto m = _mm_setzero_si128();
+
+            for (const auto &pair : pairs) {
+                m = _mm_or_si128(m, _mm_and_si128(
+                    _mm_cmpeq_epi8(v0, _mm_set1_epi8(char(pair[0]))),
+                    _mm_cmpeq_epi8(v1, _mm_set1_epi8(char(pair[1])))));
+            }
+
+            for (unsigned mask = _mm_movemask_epi8(m); mask; mask &= mask - 1)
+                check(i + __builtin_ctz(mask));
+        }
+
+        scalar(i);
+    }
+
+    __attribute__((target("avx2"))) void avx2()
+    {
+        size_t i = 0;
+
+        for (; i + 33 <= n; i += 32) {
+            const auto v0 = _mm256_loadu_si256(
+                reinterpret_cast< const __m256i * >(p + i));
+            const auto v1 = _mm256_loadu_si256(
+                reinterpret_cast< const __m256i * >(p + i + 1));
+
+            auto m = _mm256_setzero_si256();
+
+            for (const auto &pair : pairs) {
+                m = _mm256_or_si256(m, _mm256_and_si256(
+                    _mm256_cmpeq_epi8(v0, _mm256_set1_epi8(char(pair[0]))),
+                    _mm256_cmpeq_epi8(v1, _mm256_set1_epi8(char(pair[1])))));
+            }
+
+            for (unsigned mask = _mm256_movemask_epi8(m); mask;
+                 mask &= mask - 1)
+                check(i + __builtin_ctz(mask));
+        }
+
+        scalar(i);
+    }
+#endif // FOFI_SCAN_X86
+
+    const char *p;
+    size_t n;
+
+    std::vector< scan_hit > &hits;
+};
+
+} // anonymous namespace
+
+scan_impl_t scan_impl(scan_impl_t impl)
+{
+#if defined(FOFI_SCAN_X86)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    static const bool has_sse2 = __builtin_cpu_supports("sse2");
+
+    if (impl == SCAN_AUTO || impl == SCAN_AVX2) {
+        if (has_avx2)
+            return SCAN_AVX2;
+
+        impl = SCAN_SSE2;
+    }
+
+    if (impl == SCAN_SSE2 && has_sse2)
+        return SCAN_SSE2;
+#else
+    (void)impl;
+#endif // FOFI_SCAN_X86
+
+    return SCAN_SCALAR;
+}
+
+size_t scan(const char *pbuf, size_t n, std::vector< scan_hit > &hits,
+            scan_impl_t impl)
+{
+    const auto size = hits.size();
+
+    scanner s(pbuf, n, hits);
+
+    switch (scan_impl(impl)) {
+#if defined(FOFI_SCAN_X86)
+    case SCAN_AVX2: s.avx2(); break;
+    case SCAN_SSE2: s.sse2(); break;
+#endif // FOFI_SCAN_X86
+
+    default:
+        s.scalar(0);
+        break;
+    }
+
+    return hits.size() - size;
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,48 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_SCAN_HH
+#define FOFI_SCAN_HH
+
+#include <fofi.hh>
+
+#include <cstddef>
+#include <vector>
+
+namespace xpdf::fofi {
+
+struct scan_hit
+{
+    size_t offset;
+    font_type type;
+};
+
+//
+// The implementations of the scan, the best one the processor supports being
+// picked at run time by default. Asking for one it does not support gets the
+// best one it does.
+//
+enum scan_impl_t { SCAN_AUTO, SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+
+//
+// Finds the fonts embedded anywhere in a larger buffer, e.g., a PDF stream or
+// a memory dump, and appends an (offset, type) hit for each to `hits', in
+// offset order. Returns the number of hits appended.
+//
+// The buffer is searched, 16 or 32 bytes at a time, for the first two bytes
+// of the signatures the probes recognize; the probes run only where these
+// occur. A font is taken to extend to the end of the buffer, and fonts within
+// fonts, e.g., the CFF table of an OpenType font, are reported as well.
+//
+size_t scan(const char *, size_t, std::vector< scan_hit > &hits,
+            scan_impl_t = SCAN_AUTO);
+
+//
+// The implementation SCAN_AUTO stands for, or the one that would be used in
+// place of the given one:
+//
+scan_impl_t scan_impl(scan_impl_t = SCAN_AUTO);
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_SCAN_HH
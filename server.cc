@@ -0,0 +1,589 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <server.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+//
+// The descriptors that can come along with a single read:
+//
+constexpr size_t max_fds = 64;
+
+bool make_address(const char *path, sockaddr_un &addr)
+{
+    std::memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+
+    if (std::strlen(path) >= sizeof addr.sun_path)
+        return false;
+
+    std::strcpy(addr.sun_path, path);
+    return true;
+}
+
+//
+// Whether the path is free to bind: nothing there, or a socket no server
+// listens on anymore, which is removed. A socket in use, a file that is not a
+// socket, or one that cannot be looked at are left alone:
+//
+bool reclaim(const char *path, const sockaddr_un &addr)
+{
+    struct stat st;
+
+    if (0 != ::lstat(path, &st))
+        return errno == ENOENT;
+
+    if (!S_ISSOCK(st.st_mode))
+        return false;
+
+    const int x = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (x < 0)
+        return false;
+
+    const bool stale = 0 != ::connect(
+        x, reinterpret_cast< const sockaddr * >(&addr), sizeof addr) &&
+        errno == ECONNREFUSED;
+
+    ::close(x);
+
+    return stale && (0 == ::unlink(path) || errno == ENOENT);
+}
+
+bool write_all(int fd, const char *p, size_t n)
+{
+    while (n) {
+        const auto result = ::send(fd, p, n, MSG_NOSIGNAL);
+
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        p += result, n -= result;
+    }
+
+    return true;
+}
+
+//
+// The state of a connection: the bytes read and not yet consumed, the
+// descriptors received and not yet claimed by a request, the mapped segments
+// and the responses not yet written.
+//
+struct connection
+{
+    struct segment_t
+    {
+        const char *p;
+        size_t size;
+    };
+
+    explicit connection(int fd) : fd(fd) { }
+
+    ~connection()
+    {
+        for (auto x : fds)
+            ::close(x);
+
+        for (auto &seg : segments)
+            if (seg.p)
+                ::munmap(const_cast< char * >(seg.p), seg.size);
+    }
+
+    //
+    // Reads what is available, up to a buffer full, with the descriptors
+    // that come along:
+    //
+    bool read()
+    {
+        static constexpr size_t chunk = 64 * 1024;
+
+        const auto size = buf.size();
+        buf.resize(size + chunk);
+
+        iovec iov{ buf.data() + size, chunk };
+
+        alignas(cmsghdr) char control[CMSG_SPACE(max_fds * sizeof(int))];
+
+        msghdr msg{ };
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        ssize_t result;
+
+        do {
+            result = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (result < 0 && errno == EINTR);
+
+        buf.resize(size + std::max(ssize_t(0), result));
+
+        for (auto p = CMSG_FIRSTHDR(&msg); p; p = CMSG_NXTHDR(&msg, p)) {
+            if (p->cmsg_level != SOL_SOCKET || p->cmsg_type != SCM_RIGHTS)
+                continue;
+
+            const size_t n = (p->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            for (size_t i = 0; i < n; ++i) {
+                int x;
+                std::memcpy(&x, CMSG_DATA(p) + i * sizeof x, sizeof x);
+                fds.push_back(x);
+            }
+        }
+
+        return result > 0;
+    }
+
+    //
+    // Serves all the complete requests in the buffer. Fails on a request
+    // that cannot be framed, after which the connection is dropped.
+    //
+    bool serve()
+    {
+        size_t pos = 0;
+
+        while (buf.size() - pos >= sizeof(request_header)) {
+            request_header req;
+            std::memcpy(&req, buf.data() + pos, sizeof req);
+
+            if (req.size > server::max_payload)
+                return false;
+
+            if (buf.size() - pos - sizeof req < req.size)
+                break;
+
+            serve(req, buf.data() + pos + sizeof req);
+            pos += sizeof req + req.size;
+        }
+
+        buf.erase(buf.begin(), buf.begin() + pos);
+        return true;
+    }
+
+    void serve(const request_header &req, const char *payload)
+    {
+        response_t res{ req.id, 0, FONT_ERROR, 0, 0 };
+        font_type type = FONT_ERROR;
+
+        switch (req.kind) {
+        case REQUEST_PATH:
+            type = FONT_UNKNOWN;
+            res.success = identify(
+                std::string(payload, req.size).c_str(), type);
+            break;
+
+        case REQUEST_FD:
+            if (int x; pop(x)) {
+                type = FONT_UNKNOWN;
+                res.success = identify_fd(x, type);
+                ::close(x);
+            }
+            break;
+
+        case REQUEST_ATTACH:
+            if (int x; pop(x)) {
+                res.success = attach(x, res.value);
+                ::close(x);
+            }
+            break;
+
+        case REQUEST_RANGE:
+            if (range_payload r; req.size == sizeof r) {
+                std::memcpy(&r, payload, sizeof r);
+
+                if (r.segment < segments.size()) {
+                    const auto &seg = segments[r.segment];
+
+                    if (seg.p && r.offset <= seg.size &&
+                        seg.size - r.offset >= r.size) {
+                        type = FONT_UNKNOWN;
+                        res.success = identify(
+                            seg.p + r.offset, r.size, type);
+                    }
+                }
+            }
+            break;
+
+        case REQUEST_DETACH:
+            if (std::uint32_t x; req.size == sizeof x) {
+                std::memcpy(&x, payload, sizeof x);
+                res.success = detach(x);
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (req.kind != REQUEST_ATTACH && req.kind != REQUEST_DETACH)
+            res.type = type;
+        else if (res.success)
+            res.type = FONT_UNKNOWN;
+
+        out.push_back(res);
+    }
+
+    bool pop(int &x)
+    {
+        if (fds.empty())
+            return false;
+
+        x = fds.front();
+        fds.pop_front();
+
+        return true;
+    }
+
+    //
+    // Maps a shared memory segment, which must be sealed against shrinking
+    // so that the client cannot pull pages from under the server:
+    //
+    bool attach(int x, std::uint32_t &handle)
+    {
+        struct stat st;
+
+        const int seals = ::fcntl(x, F_GET_SEALS);
+
+        if (seals < 0 || 0 == (seals & F_SEAL_SHRINK) ||
+            0 != ::fstat(x, &st) || 0 == st.st_size)
+            return false;
+
+        void *p = ::mmap(0, st.st_size, PROT_READ, MAP_SHARED, x, 0);
+
+        if (MAP_FAILED == p)
+            return false;
+
+        const segment_t seg{
+            static_cast< const char * >(p), size_t(st.st_size)
+        };
+
+        for (handle = 0; handle < segments.size(); ++handle)
+            if (0 == segments[handle].p)
+                return segments[handle] = seg, true;
+
+        segments.push_back(seg);
+        return true;
+    }
+
+    bool detach(std::uint32_t handle)
+    {
+        if (handle >= segments.size() || 0 == segments[handle].p)
+            return false;
+
+        auto &seg = segments[handle];
+        ::munmap(const_cast< char * >(seg.p), seg.size);
+
+        seg = { 0, 0 };
+        return true;
+    }
+
+    bool flush()
+    {
+        const bool success = write_all(
+            fd, reinterpret_cast< const char * >(out.data()),
+            out.size() * sizeof(response_t));
+
+        out.clear();
+        return success;
+    }
+
+    int fd;
+
+    std::vector< char > buf;
+    std::deque< int > fds;
+
+    std::vector< segment_t > segments;
+    std::vector< response_t > out;
+};
+
+} // anonymous namespace
+
+server::server(const char *path)
+    : path(path), fd(-1), wake{ -1, -1 }, dev(0), ino(0), active(0)
+{
+    sockaddr_un addr;
+
+    if (!make_address(path, addr) || 0 != ::pipe2(wake, O_CLOEXEC))
+        return;
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return;
+
+    if (!reclaim(path, addr) ||
+        0 != ::bind(fd, reinterpret_cast< sockaddr * >(&addr), sizeof addr)) {
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+
+    //
+    // The socket this server bound, so that only that one is removed at the
+    // end, see the destructor:
+    //
+    struct stat st;
+
+    if (0 != ::lstat(path, &st) || 0 != ::listen(fd, SOMAXCONN)) {
+        ::close(fd);
+        fd = -1;
+        ::unlink(path);
+        return;
+    }
+
+    dev = st.st_dev;
+    ino = st.st_ino;
+}
+
+server::~server()
+{
+    if (fd >= 0) {
+        ::close(fd);
+
+        struct stat st;
+
+        if (0 == ::lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode) &&
+            st.st_dev == dev && st.st_ino == ino)
+            ::unlink(path.c_str());
+    }
+
+    for (auto x : wake)
+        if (x >= 0)
+            ::close(x);
+}
+
+void server::run()
+{
+    for (;;) {
+        pollfd fds[] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        if (fds[1].revents)
+            break;
+
+        if (0 == (fds[0].revents & POLLIN))
+            continue;
+
+        const int x = ::accept4(fd, 0, 0, SOCK_CLOEXEC);
+
+        if (x < 0)
+            continue;
+
+        std::lock_guard< std::mutex > lock(mtx);
+
+        connections.push_back(x);
+        ++active;
+
+        std::thread(&server::serve, this, x).detach();
+    }
+
+    //
+    // The connections in progress see the end of their input:
+    //
+    std::unique_lock< std::mutex > lock(mtx);
+
+    for (auto x : connections)
+        ::shutdown(x, SHUT_RDWR);
+
+    cv.wait(lock, [this] { return 0 == active; });
+
+    //
+    // Ready for another run:
+    //
+    char c;
+    while (::read(wake[0], &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void server::stop()
+{
+    const char c = 0;
+    while (::write(wake[1], &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void server::serve(int x)
+{
+    {
+        connection conn(x);
+
+        while (conn.read() && conn.serve() && conn.flush())
+            ;
+    }
+
+    //
+    // Out of the list before the descriptor can be reused:
+    //
+    {
+        std::lock_guard< std::mutex > lock(mtx);
+
+        connections.erase(
+            std::find(connections.begin(), connections.end(), x));
+    }
+
+    ::close(x);
+
+    std::lock_guard< std::mutex > lock(mtx);
+
+    --active;
+    cv.notify_all();
+}
+
+client::client(const char *path)
+    : fd(-1)
+{
+    sockaddr_un addr;
+
+    if (!make_address(path, addr))
+        return;
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd >= 0 &&
+        0 != ::connect(fd, reinterpret_cast< sockaddr * >(&addr),
+                       sizeof addr)) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+client::~client()
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool client::send(std::uint32_t id, request_kind kind, const void *payload,
+                  size_t n, int pass)
+{
+    if (n > server::max_payload)
+        return false;
+
+    request_header req{ id, kind, 0, std::uint32_t(n) };
+
+    char buf[sizeof req + server::max_payload];
+
+    std::memcpy(buf, &req, sizeof req);
+
+    if (n)
+        std::memcpy(buf + sizeof req, payload, n);
+
+    n += sizeof req;
+
+    //
+    // The descriptor goes with the first byte of the request:
+    //
+    iovec iov{ buf, n };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = { };
+
+    msghdr msg{ };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (pass >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        auto p = CMSG_FIRSTHDR(&msg);
+
+        p->cmsg_level = SOL_SOCKET;
+        p->cmsg_type = SCM_RIGHTS;
+        p->cmsg_len = CMSG_LEN(sizeof pass);
+
+        std::memcpy(CMSG_DATA(p), &pass, sizeof pass);
+    }
+
+    ssize_t result;
+
+    do {
+        result = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (result < 0 && errno == EINTR);
+
+    return result >= 0 && write_all(fd, buf + result, n - result);
+}
+
+bool client::send_path(std::uint32_t id, const char *path)
+{
+    return send(id, REQUEST_PATH, path, std::strlen(path));
+}
+
+bool client::send_fd(std::uint32_t id, int x)
+{
+    return x >= 0 && send(id, REQUEST_FD, 0, 0, x);
+}
+
+bool client::send_attach(std::uint32_t id, int x)
+{
+    return x >= 0 && send(id, REQUEST_ATTACH, 0, 0, x);
+}
+
+bool client::send_range(std::uint32_t id, std::uint32_t segment,
+                        std::uint64_t offset, std::uint64_t size)
+{
+    const range_payload r{ segment, 0, offset, size };
+    return send(id, REQUEST_RANGE, &r, sizeof r);
+}
+
+bool client::send_detach(std::uint32_t id, std::uint32_t segment)
+{
+    return send(id, REQUEST_DETACH, &segment, sizeof segment);
+}
+
+bool client::receive(response_t &res)
+{
+    auto p = reinterpret_cast< char * >(&res);
+
+    for (size_t n = 0; n < sizeof res;) {
+        const auto result = ::recv(fd, p + n, sizeof res - n, 0);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        n += result;
+    }
+
+    return true;
+}
+
+bool client::identify(const char *path, font_type &type)
+{
+    response_t res;
+
+    if (!send_path(0, path) || !receive(res))
+        return type = FONT_ERROR, false;
+
+    type = font_type(res.type);
+    return res.success;
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,161 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_SERVER_HH
+#define FOFI_SERVER_HH
+
+#include <fofi.hh>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace xpdf::fofi {
+
+//
+// The framing of the identification service, over a Unix domain stream
+// socket. The fields are in host byte order, the socket being local.
+//
+// A request is a fixed-size header followed by `size' bytes of payload. The
+// descriptors of REQUEST_FD and REQUEST_ATTACH go along in SCM_RIGHTS control
+// messages, in request order, with the header or anywhere before it:
+//
+//   REQUEST_PATH    the path of the file to identify
+//   REQUEST_FD      none, the file or memfd to identify is the descriptor
+//   REQUEST_ATTACH  none, the descriptor is a shared memory segment mapped by
+//                   the server for later REQUEST_RANGE requests; the response
+//                   carries the handle of the segment in `value'
+//   REQUEST_RANGE   a range_payload, the bytes to identify in a segment
+//   REQUEST_DETACH  the 32-bit handle of a segment to unmap
+//
+// Requests may be pipelined; the responses come back in request order, with
+// the id of the request. Segments are private to the connection.
+//
+enum request_kind : std::uint16_t {
+    REQUEST_PATH, REQUEST_FD, REQUEST_ATTACH, REQUEST_RANGE, REQUEST_DETACH
+};
+
+struct request_header
+{
+    std::uint32_t id;
+    std::uint16_t kind, reserved;
+    std::uint32_t size;
+};
+
+struct range_payload
+{
+    std::uint32_t segment, reserved;
+    std::uint64_t offset, size;
+};
+
+//
+// FONT_ERROR for requests that cannot be served, e.g., a path that cannot be
+// read or a range that is not within its segment:
+//
+struct response_t
+{
+    std::uint32_t id;
+    std::uint8_t success, type;
+    std::uint16_t reserved;
+    std::uint32_t value;
+};
+
+static_assert(sizeof(request_header) == 12);
+static_assert(sizeof(range_payload) == 24);
+static_assert(sizeof(response_t) == 12);
+
+//
+// A server that keeps a warm process for its clients: it accepts connections
+// on a Unix domain socket and serves each one on a thread of its own, taking
+// in as many pipelined requests as are available at a time and writing all
+// their responses back at once.
+//
+struct server
+{
+    static constexpr size_t max_payload = 4096;
+
+    //
+    // Listens at `path', replacing a stale socket there, one that no server
+    // listens on anymore. Anything else at the path, a socket in use or a
+    // file that is not a socket, is left alone, and the server is not open.
+    // The socket is removed at the end if it is still the one bound here:
+    //
+    explicit server(const char *path);
+    ~server();
+
+    server(const server &) = delete;
+    server &operator=(const server &) = delete;
+
+    bool is_open() const { return fd >= 0; }
+
+    //
+    // Serves connections until stopped, then waits for the ones in progress
+    // to finish:
+    //
+    void run();
+
+    //
+    // Makes run() return; safe to call from a signal handler:
+    //
+    void stop();
+
+private:
+    void serve(int);
+
+private:
+    std::string path;
+    int fd, wake[2];
+
+    dev_t dev;
+    ino_t ino;
+
+    //
+    // The connections being served, each on a detached thread:
+    //
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    std::vector< int > connections;
+    size_t active;
+};
+
+//
+// A connection to the server. The requests can be pipelined with the send
+// functions, each returning false if the request could not be sent, and the
+// responses read back with receive(); identify() does both for one request.
+//
+struct client
+{
+    explicit client(const char *path);
+    ~client();
+
+    client(const client &) = delete;
+    client &operator=(const client &) = delete;
+
+    bool is_open() const { return fd >= 0; }
+
+    bool send_path(std::uint32_t id, const char *path);
+    bool send_fd(std::uint32_t id, int);
+    bool send_attach(std::uint32_t id, int);
+    bool send_range(std::uint32_t id, std::uint32_t segment,
+                    std::uint64_t offset, std::uint64_t size);
+    bool send_detach(std::uint32_t id, std::uint32_t segment);
+
+    bool receive(response_t &);
+
+    bool identify(const char *path, font_type &);
+
+private:
+    bool send(std::uint32_t id, request_kind, const void *, size_t, int = -1);
+
+private:
+    int fd;
+};
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_SERVER_HH
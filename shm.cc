@@ -0,0 +1,367 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <atomic>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <shm.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+//
+// The queues are shared across processes; their atomics cannot be anything
+// but lock-free:
+//
+using position_t = std::atomic< std::uint64_t >;
+static_assert(position_t::is_always_lock_free);
+
+constexpr size_t cache_line = 64;
+
+constexpr std::uint64_t shm_magic = 0x6f66696673686d31ULL; // "ofifshm1"
+
+//
+// How many times a consumer tries to post a result before giving up on it:
+//
+constexpr size_t max_post_attempts = 1 << 16;
+
+struct request_cell
+{
+    position_t seq;
+    std::uint64_t id, offset, size;
+};
+
+struct result_cell
+{
+    position_t seq;
+    std::uint64_t id;
+    std::uint32_t success, type;
+};
+
+//
+// A bounded MPMC queue after Dmitry Vyukov: every cell has a sequence number
+// that tells the producers and the consumers whose turn it is, and the two
+// positions are claimed with a compare-and-swap each.
+//
+template< typename Cell >
+struct queue_t
+{
+    template< typename F >
+    bool push(Cell *cells, std::uint64_t mask, F f)
+    {
+        auto pos = tail.load(std::memory_order_relaxed);
+
+        for (;;) {
+            auto &cell = cells[pos & mask];
+
+            const auto seq = cell.seq.load(std::memory_order_acquire);
+            const auto diff = std::int64_t(seq - pos);
+
+            if (0 == diff) {
+                if (tail.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        auto &cell = cells[pos & mask];
+        f(cell);
+
+        cell.seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    template< typename F >
+    bool pop(Cell *cells, std::uint64_t mask, F f)
+    {
+        auto pos = head.load(std::memory_order_relaxed);
+
+        for (;;) {
+            auto &cell = cells[pos & mask];
+
+            const auto seq = cell.seq.load(std::memory_order_acquire);
+            const auto diff = std::int64_t(seq - (pos + 1));
+
+            if (0 == diff) {
+                if (head.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        auto &cell = cells[pos & mask];
+        f(cell);
+
+        cell.seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    alignas(cache_line) position_t tail;
+    alignas(cache_line) position_t head;
+};
+
+} // anonymous namespace
+
+//
+// The segment: this header, the request cells, the result cells, then the
+// data area, each at a cache line boundary.
+//
+struct shm_ring::header_t
+{
+    std::uint64_t magic, capacity, data_offset, data_size;
+
+    alignas(cache_line) position_t in_flight;
+
+    queue_t< request_cell > requests;
+    queue_t< result_cell > results;
+
+    //
+    // Taking the capacity of the mapping, not the one in the segment:
+    //
+    request_cell *request_cells()
+    {
+        return reinterpret_cast< request_cell * >(
+            reinterpret_cast< char * >(this) + sizeof *this);
+    }
+
+    result_cell *result_cells(size_t n)
+    {
+        return reinterpret_cast< result_cell * >(request_cells() + n);
+    }
+
+    static size_t layout(size_t capacity)
+    {
+        const size_t n = sizeof(header_t) +
+            capacity * (sizeof(request_cell) + sizeof(result_cell));
+
+        return (n + cache_line - 1) / cache_line * cache_line;
+    }
+};
+
+shm_ring::shm_ring(size_t capacity, size_t data_size)
+    : fd_(-1), header(0), size(0), mask(0), data_(0), data_size_(0)
+{
+    size_t n = 1;
+
+    while (n < capacity)
+        n <<= 1;
+
+    const int fd = ::memfd_create("fofi-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd < 0)
+        return;
+
+    const size_t data_offset = header_t::layout(n);
+
+    //
+    // Sealed, so that no process can pull pages from under the others:
+    //
+    if (0 != ::ftruncate(fd, data_offset + data_size) ||
+        0 != ::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) ||
+        !map(fd)) {
+        ::close(fd);
+        return;
+    }
+
+    //
+    // A fresh memfd is all zeros, the atomics included:
+    //
+    auto p = new (header) header_t;
+
+    p->capacity = n;
+    p->data_offset = data_offset;
+    p->data_size = data_size;
+
+    for (size_t i = 0; i < n; ++i) {
+        new (p->request_cells() + i) request_cell{ { i }, 0, 0, 0 };
+        new (p->result_cells(n) + i) result_cell{ { i }, 0, 0, 0 };
+    }
+
+    mask = n - 1;
+    data_ = reinterpret_cast< char * >(header) + data_offset;
+    data_size_ = data_size;
+
+    std::atomic_thread_fence(std::memory_order_release);
+    p->magic = shm_magic;
+}
+
+shm_ring::shm_ring(int fd)
+    : fd_(-1), header(0), size(0), mask(0), data_(0), data_size_(0)
+{
+    //
+    // A segment that can shrink could fault the mapping, see server.cc:
+    //
+    const int seals = ::fcntl(fd, F_GET_SEALS);
+
+    if (seals < 0 || 0 == (seals & F_SEAL_SHRINK))
+        return;
+
+    const int x = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    if (x < 0)
+        return;
+
+    if (!map(x)) {
+        ::close(x);
+        return;
+    }
+
+    //
+    // The layout must be what the creator said it is, and within the segment:
+    //
+    const auto &h = *header;
+
+    if (h.magic != shm_magic || 0 == h.capacity ||
+        (h.capacity & (h.capacity - 1)) || h.capacity > size ||
+        h.data_offset != header_t::layout(h.capacity) ||
+        h.data_offset > size || size - h.data_offset < h.data_size) {
+        ::munmap(header, size);
+        ::close(x);
+
+        fd_ = -1, header = 0, size = 0;
+        return;
+    }
+
+    //
+    // Kept on this side, the segment being writable by the other processes:
+    //
+    mask = h.capacity - 1;
+    data_ = reinterpret_cast< char * >(header) + h.data_offset;
+    data_size_ = h.data_size;
+}
+
+shm_ring::~shm_ring()
+{
+    if (header) {
+        ::munmap(header, size);
+        ::close(fd_);
+    }
+}
+
+bool shm_ring::map(int fd)
+{
+    struct stat st;
+
+    if (0 != ::fstat(fd, &st) || size_t(st.st_size) < sizeof(header_t))
+        return false;
+
+    void *p = ::mmap(
+        0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == p)
+        return false;
+
+    fd_ = fd;
+    header = static_cast< header_t * >(p);
+    size = st.st_size;
+
+    return true;
+}
+
+bool shm_ring::submit(std::uint64_t id, std::uint64_t offset,
+                      std::uint64_t n)
+{
+    auto &h = *header;
+
+    if (offset > data_size_ || data_size_ - offset < n)
+        return false;
+
+    if (h.in_flight.fetch_add(1, std::memory_order_relaxed) > mask) {
+        h.in_flight.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return h.requests.push(
+        h.request_cells(), mask, [&](auto &cell) {
+            cell.id = id;
+            cell.offset = offset;
+            cell.size = n;
+        });
+}
+
+bool shm_ring::collect(shm_result &result)
+{
+    auto &h = *header;
+
+    const bool success = h.results.pop(
+        h.result_cells(mask + 1), mask, [&](auto &cell) {
+            result.id = cell.id;
+            result.success = cell.success;
+            result.type = font_type(cell.type);
+        });
+
+    if (success)
+        h.in_flight.fetch_sub(1, std::memory_order_relaxed);
+
+    return success;
+}
+
+size_t shm_ring::serve(size_t max)
+{
+    auto &h = *header;
+    auto results = h.result_cells(mask + 1);
+
+    size_t n = 0;
+
+    for (; n < max; ++n) {
+        std::uint64_t id, offset, len;
+
+        const bool success = h.requests.pop(
+            h.request_cells(), mask, [&](auto &cell) {
+                id = cell.id;
+                offset = cell.offset;
+                len = cell.size;
+            });
+
+        if (!success)
+            break;
+
+        //
+        // Checked again, on this side:
+        //
+        font_type type = FONT_ERROR;
+        bool found = false;
+
+        if (offset <= data_size_ && len <= data_size_ - offset) {
+            type = FONT_UNKNOWN;
+            found = identify(data_ + offset, len, type);
+        }
+
+        //
+        // Room is guaranteed by the in-flight limit, but the cell may still be
+        // on its way out of the hands of a slow collector. The limit is kept
+        // by the producers, though, and a result that finds no room for long
+        // is dropped rather than waited for forever:
+        //
+        const auto post = [&](auto &cell) {
+            cell.id = id;
+            cell.success = found;
+            cell.type = type;
+        };
+
+        for (size_t i = 0; i < max_post_attempts; ++i) {
+            if (h.results.push(results, mask, post))
+                break;
+
+            std::this_thread::yield();
+        }
+    }
+
+    return n;
+}
+
+} // namespace xpdf::fofi
@@ -0,0 +1,101 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_SHM_HH
+#define FOFI_SHM_HH
+
+#include <fofi.hh>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xpdf::fofi {
+
+struct shm_result
+{
+    std::uint64_t id;
+    bool success;
+    font_type type;
+};
+
+//
+// A shared memory segment, in a memfd, with a data area and two bounded
+// lock-free MPMC queues: one of requests, each the id and the offset and size
+// of a font in the data area, and one of results. Producers put the fonts in
+// the data area, however they see fit, and submit requests; consumers
+// identify the fonts where they are and post the results, for the producers
+// to collect. Any number of threads, in any number of processes that have the
+// segment mapped, can be producers or consumers.
+//
+// Nothing on the way makes a system call or copies the fonts. The waiting is
+// up to the callers, e.g., spinning for a while, then backing off.
+//
+// At most `capacity' requests can be in flight, from submission to the
+// collection of their results, which is why a consumer never finds the result
+// queue full. The producers are not trusted, though: requests are checked
+// against the bounds of the data area by the consumers, a result that still
+// finds the queue full after a bounded wait is dropped, and the segment is
+// sealed against resizing.
+//
+struct shm_ring
+{
+    //
+    // A new segment, the capacity being rounded up to a power of two:
+    //
+    shm_ring(size_t capacity, size_t data_size);
+
+    //
+    // The segment of the descriptor, e.g., received from another process; the
+    // descriptor is duplicated. A memfd not sealed against shrinking is
+    // refused:
+    //
+    explicit shm_ring(int fd);
+
+    ~shm_ring();
+
+    shm_ring(const shm_ring &) = delete;
+    shm_ring &operator=(const shm_ring &) = delete;
+
+    bool is_open() const { return header != 0; }
+
+    int fd() const { return fd_; }
+
+    size_t capacity() const { return mask + 1; }
+
+    char *data() { return data_; }
+    size_t data_size() const { return data_size_; }
+
+    //
+    // Producers. A submission fails if `capacity' requests are in flight or
+    // the font is not within the data area; a collection fails if no result
+    // is ready.
+    //
+    bool submit(std::uint64_t id, std::uint64_t offset, std::uint64_t size);
+    bool collect(shm_result &);
+
+    //
+    // Consumers. Identifies up to `max' of the pending fonts and returns how
+    // many there were, the ones whose results were dropped included.
+    //
+    size_t serve(size_t max = SIZE_MAX);
+
+private:
+    struct header_t;
+
+    bool map(int fd);
+
+private:
+    int fd_;
+
+    header_t *header;
+    size_t size;
+
+    std::uint64_t mask;
+
+    char *data_;
+    size_t data_size_;
+};
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_SHM_HH
@@ -0,0 +1,408 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <stats.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi::stats {
+namespace {
+
+const char *reject_names[] = {
+    "signature", "truncated", "malformed", "missing", "io"
+};
+
+static_assert(sizeof reject_names / sizeof *reject_names == REJECT_MAX);
+
+const char *stage_names[] = {
+    "file", "open", "probe", "decompress"
+};
+
+static_assert(sizeof stage_names / sizeof *stage_names == STAGE_MAX);
+
+static_assert(detail::PROBE_MAX <= max_probes);
+
+const char *type_names[] = {
+    "type1_pfa", "type1_pfb", "cff_8bit", "cff_cid", "truetype",
+    "truetype_collection", "opentype_cff_8bit", "opentype_cff_cid", "dfont",
+    "unknown", "error"
+};
+
+static_assert(sizeof type_names / sizeof *type_names == FONT_ERROR + 1);
+
+} // anonymous namespace
+
+const char *name(reject_t reason)
+{
+    return reject_names[reason];
+}
+
+const char *name(stage_t stage)
+{
+    return stage_names[stage];
+}
+
+const char *probe_name(size_t i)
+{
+    return i < detail::PROBE_MAX
+        ? detail::formats::name(detail::probe_t(i)) : "";
+}
+
+const char *type_name(font_type type)
+{
+    return type_names[type];
+}
+
+#if defined(FOFI_STATS)
+
+namespace {
+
+//
+// A counter written by its thread only, read by whoever takes a snapshot.
+// Relaxed loads and stores, no locked instructions:
+//
+struct counter_t
+{
+    void add(std::uint64_t x)
+    {
+        n.store(n.load(std::memory_order_relaxed) + x,
+                std::memory_order_relaxed);
+    }
+
+    std::uint64_t get() const { return n.load(std::memory_order_relaxed); }
+
+    std::atomic< std::uint64_t > n;
+};
+
+using block_t = basic_stats< counter_t >;
+
+//
+// The blocks and the snapshot are walked as arrays of words:
+//
+static_assert(sizeof(counter_t) == sizeof(std::uint64_t));
+static_assert(sizeof(block_t) == sizeof(snapshot_t));
+
+constexpr size_t nwords = sizeof(snapshot_t) / sizeof(std::uint64_t);
+
+void add(snapshot_t &dst, const block_t &src)
+{
+    auto p = reinterpret_cast< std::uint64_t * >(&dst);
+    auto q = reinterpret_cast< const counter_t * >(&src);
+
+    for (size_t i = 0; i < nwords; ++i)
+        p[i] += q[i].get();
+}
+
+//
+// The blocks of the live threads, and the sum of the blocks of the threads
+// that are gone:
+//
+struct registry_t
+{
+    std::mutex mtx;
+    std::vector< const block_t * > blocks;
+    snapshot_t retired{ };
+};
+
+registry_t &registry()
+{
+    static registry_t r;
+    return r;
+}
+
+struct local_t
+{
+    local_t()
+    {
+        auto &r = registry();
+
+        std::lock_guard< std::mutex > lock(r.mtx);
+        r.blocks.push_back(&block);
+    }
+
+    ~local_t()
+    {
+        auto &r = registry();
+
+        std::lock_guard< std::mutex > lock(r.mtx);
+        add(r.retired, block);
+
+        r.blocks.erase(std::find(r.blocks.begin(), r.blocks.end(), &block));
+    }
+
+    block_t block{ };
+
+    //
+    // The probe running, and the first reason it gave for failing, if any:
+    //
+    size_t probe = 0;
+    reject_t reason = REJECT_MAX;
+};
+
+thread_local local_t local;
+
+void record(basic_histogram< counter_t > &h, std::uint64_t ns)
+{
+    h.count.add(1);
+    h.sum.add(ns);
+    h.buckets[bucket(ns)].add(1);
+}
+
+} // anonymous namespace
+
+std::uint64_t now()
+{
+    using namespace std::chrono;
+
+    return duration_cast< nanoseconds >(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+void enter_probe(size_t i)
+{
+    local.probe = i;
+    local.reason = REJECT_MAX;
+    local.block.probes[i].attempts.add(1);
+}
+
+bool leave_probe(size_t i, bool success, std::uint64_t start)
+{
+    auto &probe = local.block.probes[i];
+
+    if (success)
+        probe.hits.add(1);
+    else if (local.reason == REJECT_MAX)
+        probe.rejects[REJECT_MALFORMED].add(1);
+    else
+        probe.rejects[local.reason].add(1);
+
+    record(probe.latency, now() - start);
+
+    local.probe = 0;
+    return success;
+}
+
+void record(stage_t stage, std::uint64_t start)
+{
+    record(local.block.stages[stage], now() - start);
+}
+
+void result(font_type type)
+{
+    local.block.results[type].add(1);
+}
+
+bool reject(reject_t reason)
+{
+    if (local.reason == REJECT_MAX)
+        local.reason = reason;
+
+    return false;
+}
+
+void io(size_t bytes, bool seek, bool failed)
+{
+    auto &probe = local.block.probes[local.probe];
+
+    probe.bytes.add(bytes);
+    probe.reads.add(1);
+
+    if (seek)
+        probe.seeks.add(1);
+
+    if (failed)
+        local.reason = REJECT_IO;
+}
+
+void snapshot(snapshot_t &s)
+{
+    auto &r = registry();
+
+    std::lock_guard< std::mutex > lock(r.mtx);
+    s = r.retired;
+
+    for (auto p : r.blocks)
+        add(s, *p);
+}
+
+#else
+
+void snapshot(snapshot_t &s)
+{
+    s = snapshot_t{ };
+}
+
+#endif // FOFI_STATS
+
+namespace {
+
+//
+// The upper bound of a bucket, in seconds:
+//
+double bound(size_t k)
+{
+    return double(std::uint64_t(1) << k) * 1e-9;
+}
+
+void write_json(std::ostream &s, const histogram_t &h)
+{
+    s << "{ \"count\": " << h.count << ", \"sum_ns\": " << h.sum
+      << ", \"buckets\": [";
+
+    const char *sep = "";
+
+    for (size_t k = 0; k < nbuckets; ++k) {
+        if (h.buckets[k]) {
+            s << sep << "{ \"le_ns\": " << (std::uint64_t(1) << k)
+              << ", \"count\": " << h.buckets[k] << " }";
+            sep = ", ";
+        }
+    }
+
+    s << "] }";
+}
+
+void write_prometheus(std::ostream &s, const char *metric, const char *label,
+                      const char *value, const histogram_t &h)
+{
+    //
+    // Cumulative, up to the last bucket in use:
+    //
+    size_t last = nbuckets;
+
+    while (last && 0 == h.buckets[last - 1])
+        --last;
+
+    std::uint64_t n = 0;
+
+    for (size_t k = 0; k < last; ++k) {
+        n += h.buckets[k];
+
+        s << metric << "_bucket{" << label << "=\"" << value << "\",le=\""
+          << bound(k) << "\"} " << n << "\n";
+    }
+
+    s << metric << "_bucket{" << label << "=\"" << value << "\",le=\"+Inf\"} "
+      << h.count << "\n"
+      << metric << "_sum{" << label << "=\"" << value << "\"} "
+      << double(h.sum) * 1e-9 << "\n"
+      << metric << "_count{" << label << "=\"" << value << "\"} "
+      << h.count << "\n";
+}
+
+void header(std::ostream &s, const char *metric, const char *type,
+            const char *help)
+{
+    s << "# HELP " << metric << " " << help << "\n"
+      << "# TYPE " << metric << " " << type << "\n";
+}
+
+} // anonymous namespace
+
+void write_json(std::ostream &s, const snapshot_t &x)
+{
+    s << "{\n  \"probes\": {";
+
+    for (size_t i = 0; i < detail::PROBE_MAX; ++i) {
+        const auto &p = x.probes[i];
+
+        s << (i ? ",\n" : "\n")
+          << "    \"" << probe_name(i) << "\": {\n"
+          << "      \"attempts\": " << p.attempts
+          << ", \"hits\": " << p.hits
+          << ", \"bytes\": " << p.bytes
+          << ", \"reads\": " << p.reads
+          << ", \"seeks\": " << p.seeks << ",\n"
+          << "      \"rejects\": {";
+
+        for (size_t j = 0; j < REJECT_MAX; ++j)
+            s << (j ? ", " : " ") << "\"" << name(reject_t(j)) << "\": "
+              << p.rejects[j];
+
+        s << " },\n      \"latency\": ";
+        write_json(s, p.latency);
+        s << "\n    }";
+    }
+
+    s << "\n  },\n  \"stages\": {";
+
+    for (size_t i = 0; i < STAGE_MAX; ++i) {
+        s << (i ? ",\n" : "\n") << "    \"" << name(stage_t(i)) << "\": ";
+        write_json(s, x.stages[i]);
+    }
+
+    s << "\n  },\n  \"results\": {";
+
+    for (size_t i = 0; i <= FONT_ERROR; ++i)
+        s << (i ? ", " : " ") << "\"" << type_name(font_type(i)) << "\": "
+          << x.results[i];
+
+    s << " }\n}\n";
+}
+
+void write_prometheus(std::ostream &s, const snapshot_t &x)
+{
+    const auto precision = s.precision(12);
+
+    const struct {
+        const char *metric, *help;
+        std::uint64_t basic_probe_stats< std::uint64_t >::*field;
+    } counters[] = {
+        { "fofi_probe_attempts_total", "Probes run.",
+          &basic_probe_stats< std::uint64_t >::attempts },
+        { "fofi_probe_hits_total", "Probes that identified their input.",
+          &basic_probe_stats< std::uint64_t >::hits },
+        { "fofi_probe_read_bytes_total", "Bytes read from files.",
+          &basic_probe_stats< std::uint64_t >::bytes },
+        { "fofi_probe_reads_total", "Blocks read from files.",
+          &basic_probe_stats< std::uint64_t >::reads },
+        { "fofi_probe_seeks_total", "Reads not following the previous one.",
+          &basic_probe_stats< std::uint64_t >::seeks }
+    };
+
+    for (const auto &c : counters) {
+        header(s, c.metric, "counter", c.help);
+
+        for (size_t i = 0; i < detail::PROBE_MAX; ++i)
+            s << c.metric << "{probe=\"" << probe_name(i) << "\"} "
+              << x.probes[i].*c.field << "\n";
+    }
+
+    header(s, "fofi_probe_rejects_total", "counter",
+           "Probes that gave up, by reason.");
+
+    for (size_t i = 0; i < detail::PROBE_MAX; ++i)
+        for (size_t j = 0; j < REJECT_MAX; ++j)
+            s << "fofi_probe_rejects_total{probe=\"" << probe_name(i)
+              << "\",reason=\"" << name(reject_t(j)) << "\"} "
+              << x.probes[i].rejects[j] << "\n";
+
+    header(s, "fofi_probe_latency_seconds", "histogram", "Probe latency.");
+
+    for (size_t i = 0; i < detail::PROBE_MAX; ++i)
+        write_prometheus(s, "fofi_probe_latency_seconds", "probe",
+                         probe_name(i), x.probes[i].latency);
+
+    header(s, "fofi_stage_latency_seconds", "histogram", "Stage latency.");
+
+    for (size_t i = 0; i < STAGE_MAX; ++i)
+        write_prometheus(s, "fofi_stage_latency_seconds", "stage",
+                         name(stage_t(i)), x.stages[i]);
+
+    header(s, "fofi_results_total", "counter", "Identifications, by type.");
+
+    for (size_t i = 0; i <= FONT_ERROR; ++i)
+        s << "fofi_results_total{type=\"" << type_name(font_type(i)) << "\"} "
+          << x.results[i] << "\n";
+
+    s.precision(precision);
+}
+
+} // namespace xpdf::fofi::stats
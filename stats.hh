@@ -0,0 +1,167 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_STATS_HH
+#define FOFI_STATS_HH
+
+#include <fofi.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+//
+// Instrumentation of the probes and of the file reads, built in with
+// FOFI_STATS defined (make STATS=1). Without it, the hooks below are empty
+// inline functions and compile to nothing; the snapshot is then all zeroes.
+//
+// The counters are per thread, without atomic read-modify-writes, and summed
+// up when a snapshot is taken. The flag must be the same for all objects.
+//
+namespace xpdf::fofi::stats {
+
+#if defined(FOFI_STATS)
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif // FOFI_STATS
+
+//
+// Why a probe gave up on its input: the first reason given, which is the one
+// of the innermost structure, or REJECT_IO if a read failed on the way:
+//
+enum reject_t {
+    REJECT_SIGNATURE,   // not the signature of the format
+    REJECT_TRUNCATED,   // a structure runs past the end of the input
+    REJECT_MALFORMED,   // a value out of range, e.g., an offset size of 7
+    REJECT_MISSING,     // a required table or resource is not there
+    REJECT_IO,          // the file could not be read
+    REJECT_MAX
+};
+
+//
+// The stages of an identification, timed separately:
+//
+enum stage_t {
+    STAGE_FILE,         // all of a file, from open to close
+    STAGE_OPEN,         // the open of a file
+    STAGE_PROBE,        // the probe dispatch, see detail::identify
+    STAGE_DECOMPRESS,   // the look into compressed content
+    STAGE_MAX
+};
+
+//
+// Latencies in power-of-two buckets of nanoseconds: bucket k holds the ones
+// of k significant bits, i.e., less than 2^k ns.
+//
+constexpr size_t nbuckets = 48;
+
+//
+// The probes of detail::probe_t, by index; PROBE_NONE stands for the inputs
+// with no known signature and accounts for the reads made outside probes.
+//
+constexpr size_t max_probes = 8;
+
+template< typename T >
+struct basic_histogram
+{
+    T count, sum, buckets[nbuckets];
+};
+
+template< typename T >
+struct basic_probe_stats
+{
+    T attempts, hits;
+    T bytes, reads, seeks;
+    T rejects[REJECT_MAX];
+    basic_histogram< T > latency;
+};
+
+template< typename T >
+struct basic_stats
+{
+    basic_probe_stats< T > probes[max_probes];
+    basic_histogram< T > stages[STAGE_MAX];
+    T results[FONT_ERROR + 1];
+};
+
+using histogram_t = basic_histogram< std::uint64_t >;
+using snapshot_t = basic_stats< std::uint64_t >;
+
+const char *name(reject_t);
+const char *name(stage_t);
+const char *probe_name(size_t);
+const char *type_name(font_type);
+
+constexpr size_t bucket(std::uint64_t ns)
+{
+    size_t k = 0;
+
+    for (; ns && k < nbuckets - 1; ns >>= 1)
+        ++k;
+
+    return k;
+}
+
+//
+// The counters of all threads, past and present, summed up:
+//
+void snapshot(snapshot_t &);
+
+void write_json(std::ostream &, const snapshot_t &);
+void write_prometheus(std::ostream &, const snapshot_t &);
+
+#if defined(FOFI_STATS)
+
+std::uint64_t now();
+
+void enter_probe(size_t);
+bool leave_probe(size_t, bool success, std::uint64_t start);
+
+void record(stage_t, std::uint64_t start);
+void result(font_type);
+
+//
+// A probe failure, returning false for `return reject(...)', see PARSE_FAILURE:
+//
+bool reject(reject_t);
+
+void io(size_t bytes, bool seek, bool failed);
+
+#else
+
+inline std::uint64_t now() { return 0; }
+
+inline void enter_probe(size_t) { }
+inline bool leave_probe(size_t, bool success, std::uint64_t)
+{
+    return success;
+}
+
+inline void record(stage_t, std::uint64_t) { }
+inline void result(font_type) { }
+
+inline bool reject(reject_t) { return false; }
+
+inline void io(size_t, bool, bool) { }
+
+#endif // FOFI_STATS
+
+//
+// Times the scope as a stage:
+//
+struct scoped_stage
+{
+    explicit scoped_stage(stage_t stage)
+        : stage(stage), start(now())
+    { }
+
+    ~scoped_stage() { record(stage, start); }
+
+    stage_t stage;
+    std::uint64_t start;
+};
+
+} // namespace xpdf::fofi::stats
+
+#endif // FOFI_STATS_HH
@@ -0,0 +1,168 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_STREAM_HH
+#define FOFI_STREAM_HH
+
+#include <defs.hh>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <streambuf>
+#include <vector>
+
+namespace xpdf::fofi {
+
+//
+// The bytes of a single-pass stream -- a pipe, a socket, a decompressor --
+// read into memory only as far as the iterators have looked, and at most
+// `limit' of them. The stream is read in chunks; its end is known only once
+// it has been reached, so the iterators are forward ones and the end iterator
+// is a sentinel.
+//
+// With a bounded `window', only that many bytes behind the furthest position
+// looked at are kept: the parsers may go back that far, e.g., to a position
+// saved by an iterator guard, and positions further back read as the end of
+// the stream. Seeking ahead reads and discards the bytes in between.
+//
+struct stream_source
+{
+    struct iterator;
+
+    static constexpr size_t default_limit = 64 << 20;
+    static constexpr size_t default_window = 64 << 10;
+    static constexpr size_t unbounded = size_t(-1);
+
+    explicit stream_source(std::streambuf &sb, size_t window = unbounded,
+                           size_t limit = default_limit)
+        : sb(sb), window(window), limit(limit)
+    { }
+
+    stream_source(const stream_source &) = delete;
+    stream_source &operator=(const stream_source &) = delete;
+
+    iterator begin();
+    iterator end();
+
+    bool has(size_t off)
+    {
+        if (off < base)
+            return false;
+
+        return off - base < buf.size() || fill(off);
+    }
+
+    char at(size_t off)
+    {
+        return has(off) ? buf[off - base] : 0;
+    }
+
+    //
+    // The number of bytes read from the stream so far, and kept in memory:
+    //
+    size_t size() const { return base + buf.size(); }
+    size_t capacity() const { return buf.capacity(); }
+
+private:
+    bool fill(size_t off)
+    {
+        static constexpr size_t chunk = 4096;
+
+        while (!eof && off >= base + buf.size()) {
+            if (base + buf.size() >= limit) {
+                eof = true;
+                break;
+            }
+
+            //
+            // Drop what fell out of the window, but only in large pieces, so
+            // as not to move the buffer contents for every chunk:
+            //
+            if (window != unbounded && off - base > window) {
+                const auto n = std::min(off - base - window, buf.size());
+
+                if (n >= std::max(window, chunk)) {
+                    buf.erase(buf.begin(), buf.begin() + n);
+                    base += n;
+                }
+            }
+
+            const auto n = buf.size();
+            buf.resize(n + std::min(chunk, limit - base - n));
+
+            const auto result = sb.sgetn(buf.data() + n, buf.size() - n);
+            buf.resize(n + (result > 0 ? result : 0));
+
+            if (result <= 0)
+                eof = true;
+        }
+
+        return off >= base && off - base < buf.size();
+    }
+
+private:
+    std::streambuf &sb;
+    std::vector< char > buf;
+
+    size_t base = 0, window, limit;
+    bool eof = false;
+};
+
+struct stream_source::iterator
+{
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const char *;
+    using reference = char;
+
+    static constexpr size_t npos = size_t(-1);
+
+    iterator() = default;
+    iterator(stream_source *src, size_t off) : src(src), off(off) { }
+
+    //
+    // By value, the buffer moves as it grows:
+    //
+    reference operator*() const { return src->at(off); }
+
+    iterator &operator++() { return ++off, *this; }
+    iterator operator++(int) { auto tmp = *this; return ++off, tmp; }
+
+    bool operator==(const iterator &other) const
+    {
+        if (off == other.off)
+            return true;
+
+        if (off == npos)
+            return !other.src->has(other.off);
+
+        if (other.off == npos)
+            return !src->has(off);
+
+        return false;
+    }
+
+    bool operator!=(const iterator &other) const
+    {
+        return !(*this == other);
+    }
+
+    stream_source *src = 0;
+    size_t off = 0;
+};
+
+inline stream_source::iterator stream_source::begin()
+{
+    return { this, 0 };
+}
+
+inline stream_source::iterator stream_source::end()
+{
+    return { this, iterator::npos };
+}
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_STREAM_HH
@@ -19,8 +19,81 @@ namespace data = boost::unit_test::data;
 
 # include <boost/iterator/iterator_adaptor.hpp>
 
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/lzma.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+namespace io = boost::iostreams;
+
+#include <brotli/encode.h>
+
 #include <fofi.hh>
 #include <detail/fofi.hh>
+#include <batch.hh>
+#include <cache.hh>
+#include <corpus.hh>
+#include <dedup.hh>
+#include <mapped.hh>
+#include <pool.hh>
+#include <reader.hh>
+#include <results.hh>
+#include <scan.hh>
+#include <server.hh>
+#include <shm.hh>
+#include <stats.hh>
+#include <stream.hh>
+#include <uring.hh>
+#include <verify.hh>
+#include <watch.hh>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//
+// Counts all allocations made through the global operator new:
+//
+static std::atomic< size_t > allocations;
+
+void *operator new(size_t n)
+{
+    ++allocations;
+
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
 
 template< typename T >
 struct forward_iterator : boost::iterator_adaptor<
@@ -238,3 +311,2545 @@ BOOST_DATA_TEST_CASE(
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(pool)
+
+static const std::vector< std::tuple< size_t, size_t > >
+parallel_for_dataset = {
+    {    0, 4 },
+    {    1, 4 },
+    {    5, 1 },
+    {    5, 7 },
+    { 1000, 3 },
+    { 1000, 0 },
+};
+
+BOOST_DATA_TEST_CASE(
+    parallel_for_,
+    data::make(parallel_for_dataset), n, jobs)
+{
+    std::vector< std::atomic< int > > visits(n);
+
+    xpdf::fofi::parallel_for(n, jobs, [&](size_t i) { ++visits[i]; });
+
+    for (const auto &x : visits)
+        BOOST_CHECK(1 == x);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+using xpdf::fofi::corpus::be16;
+using xpdf::fofi::corpus::be32;
+using xpdf::fofi::corpus::make_cff;
+using xpdf::fofi::corpus::make_cff_font;
+using xpdf::fofi::corpus::make_dfont;
+using xpdf::fofi::corpus::make_otf;
+using xpdf::fofi::corpus::make_pfa;
+using xpdf::fofi::corpus::make_sfnt;
+using xpdf::fofi::corpus::make_ttc;
+using xpdf::fofi::corpus::seal_sfnt;
+
+//
+// Whether the build identifies the type at all, see make WITHOUT=...; the
+// fonts of the formats left out are not recognized:
+//
+static bool supported(xpdf::fofi::font_type type)
+{
+    return xpdf::fofi::detail::formats::supports(type);
+}
+
+struct temp_file
+{
+    explicit temp_file(const std::string &content)
+    {
+        char buf[] = "/tmp/fofi-test-XXXXXX";
+        fd = ::mkstemp(buf);
+        path = buf;
+
+        for (size_t n = 0; n < content.size();) {
+            auto result = ::write(fd, content.data() + n, content.size() - n);
+
+            if (result <= 0)
+                break;
+
+            n += result;
+        }
+    }
+
+    ~temp_file()
+    {
+        ::close(fd);
+        ::unlink(path.c_str());
+    }
+
+    int fd;
+    std::string path;
+};
+
+struct temp_dir
+{
+    temp_dir()
+    {
+        char buf[] = "/tmp/fofi-test-XXXXXX";
+        path = ::mkdtemp(buf);
+    }
+
+    ~temp_dir()
+    {
+        std::error_code ec;
+        fs::remove_all(path, ec);
+    }
+
+    std::string path;
+};
+
+BOOST_AUTO_TEST_SUITE(identify)
+
+static const std::vector< std::tuple< std::string, bool, xpdf::fofi::font_type > >
+identify_dataset = {
+    { "%!PS-AdobeFont-1.0: Foo",    true, xpdf::fofi::FONT_TYPE1_PFA },
+    { "%!FontType1-1.0: Foo",       true, xpdf::fofi::FONT_TYPE1_PFA },
+    { "%!PS-Adobe-3.0",            false, xpdf::fofi::FONT_UNKNOWN },
+    { std::string("\x80\x01\x20\x00\x00\x00" "%!PS-AdobeFont-1", 22),
+      true, xpdf::fofi::FONT_TYPE1_PFB },
+    { std::string("\x80\x01\x05\x00\x00\x00" "%!PS-AdobeFont-1", 22),
+      false, xpdf::fofi::FONT_UNKNOWN },
+    { std::string("\x00\x01\x00\x00\x00\x00", 6),
+      true, xpdf::fofi::FONT_TRUETYPE },
+    { std::string("\x00\x01", 2),  false, xpdf::fofi::FONT_UNKNOWN },
+    { "true",                       true, xpdf::fofi::FONT_TRUETYPE },
+    { "ttcf",                       true, xpdf::fofi::FONT_TRUETYPE_COLLECTION },
+    { make_cff(false),              true, xpdf::fofi::FONT_CFF_8BIT },
+    { make_cff(true),               true, xpdf::fofi::FONT_CFF_CID },
+    { make_otf(make_cff(false), 28),
+      true, xpdf::fofi::FONT_OPENTYPE_CFF_8BIT },
+    { make_otf(make_cff(true), 64),
+      true, xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+    { "OTTO",                      false, xpdf::fofi::FONT_UNKNOWN },
+    { "",                          false, xpdf::fofi::FONT_UNKNOWN },
+    { "Hello, world!",             false, xpdf::fofi::FONT_UNKNOWN },
+};
+
+BOOST_DATA_TEST_CASE(
+    identify_,
+    data::make(identify_dataset), buf, success, expected)
+{
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+    const bool in = supported(expected);
+
+    BOOST_CHECK((success && in) ==
+                xpdf::fofi::identify(buf.data(), buf.size(), type));
+    BOOST_CHECK(type == (in ? expected : xpdf::fofi::FONT_UNKNOWN));
+}
+
+BOOST_AUTO_TEST_CASE(info_otf_)
+{
+    const auto buf = make_sfnt(
+        "OTTO", { { "head", std::string(54, 'x') },
+                  { "CFF ", make_cff(true) },
+                  { "maxp", std::string(6, 'y') } });
+
+    xpdf::fofi::font_info info;
+    BOOST_CHECK(xpdf::fofi::identify_ex(buf.data(), buf.size(), info));
+
+    BOOST_CHECK(info.type == xpdf::fofi::FONT_OPENTYPE_CFF_CID);
+    BOOST_CHECK(info.nfaces == 1);
+    BOOST_CHECK(info.ntables == 3);
+    BOOST_CHECK(info.tables[0].tag == xpdf::fofi::detail::magic("head"));
+    BOOST_CHECK(info.tables[1].tag == xpdf::fofi::detail::magic("CFF "));
+    BOOST_CHECK(info.tables[2].tag == xpdf::fofi::detail::magic("maxp"));
+    BOOST_CHECK(info.tables[2].length == 6);
+    BOOST_CHECK(info.cff && info.cid);
+    BOOST_CHECK(info.cff_offset == 12 + 3 * 16 + 54);
+    BOOST_CHECK(info.cff_offset == info.tables[1].offset);
+}
+
+BOOST_AUTO_TEST_CASE(info_ttf_)
+{
+    const auto buf = make_sfnt(
+        std::string("\x00\x01\x00\x00", 4),
+        { { "glyf", std::string(10, 'x') }, { "loca", std::string(4, 'y') } });
+
+    xpdf::fofi::font_info info;
+    BOOST_CHECK(xpdf::fofi::identify_ex(buf.data(), buf.size(), info));
+
+    BOOST_CHECK(info.type == xpdf::fofi::FONT_TRUETYPE);
+    BOOST_CHECK(info.nfaces == 1);
+    BOOST_CHECK(info.ntables == 2);
+    BOOST_CHECK(info.tables[1].tag == xpdf::fofi::detail::magic("loca"));
+    BOOST_CHECK(info.tables[1].offset == 12 + 2 * 16 + 10);
+    BOOST_CHECK(!info.cff && !info.cid);
+}
+
+BOOST_AUTO_TEST_CASE(info_cff_)
+{
+    temp_file file(make_cff(false));
+
+    xpdf::fofi::font_info info;
+    BOOST_CHECK(xpdf::fofi::identify_ex(file.path.c_str(), info));
+
+    BOOST_CHECK(info.type == xpdf::fofi::FONT_CFF_8BIT);
+    BOOST_CHECK(info.nfaces == 1);
+    BOOST_CHECK(info.ntables == 0);
+    BOOST_CHECK(info.cff && !info.cid);
+    BOOST_CHECK(info.cff_offset == 0);
+}
+
+BOOST_AUTO_TEST_CASE(info_ttc_)
+{
+    const std::string buf("ttcf\x00\x01\x00\x00\x00\x00\x00\x03", 12);
+
+    xpdf::fofi::font_info info;
+    BOOST_CHECK(xpdf::fofi::identify_ex(buf.data(), buf.size(), info));
+
+    BOOST_CHECK(info.type == xpdf::fofi::FONT_TRUETYPE_COLLECTION);
+    BOOST_CHECK(info.nfaces == 3);
+}
+
+BOOST_AUTO_TEST_CASE(info_faces_)
+{
+    const auto glyf = std::string("\x00\x01\x00\x00", 4);
+
+    //
+    // Every face is laid out for its offset in the collection, see make_ttc:
+    //
+    const size_t base = 12 + 4 * 4;
+
+    const auto a = make_sfnt(glyf, { { "glyf", "x" } }, base);
+    const auto b = make_sfnt(
+        "OTTO", { { "head", "y" }, { "CFF ", make_cff(true) } },
+        base + a.size());
+    const auto c = make_sfnt(
+        glyf, { { "CFF ", make_cff(false) } }, base + a.size() + b.size());
+    const auto d = make_sfnt("OTTO", { { "head", "z" } },
+                             base + a.size() + b.size() + c.size());
+
+    temp_file file(make_ttc({ a, b, c, d }));
+
+    xpdf::fofi::font_info info;
+    BOOST_CHECK(xpdf::fofi::identify_ex(file.path.c_str(), info));
+
+    BOOST_CHECK(info.type == xpdf::fofi::FONT_TRUETYPE_COLLECTION);
+    BOOST_CHECK(info.nfaces == 4);
+
+    BOOST_CHECK(info.faces[0].type == xpdf::fofi::FONT_TRUETYPE);
+    BOOST_CHECK(info.faces[0].offset == base);
+
+    BOOST_CHECK(info.faces[1].type == xpdf::fofi::FONT_OPENTYPE_CFF_CID);
+    BOOST_CHECK(info.faces[1].offset == base + a.size());
+    BOOST_CHECK(info.faces[1].cff_offset == base + a.size() + 12 + 32 + 1);
+
+    BOOST_CHECK(info.faces[2].type == xpdf::fofi::FONT_OPENTYPE_CFF_8BIT);
+    BOOST_CHECK(info.faces[3].type == xpdf::fofi::FONT_UNKNOWN);
+}
+
+BOOST_AUTO_TEST_CASE(
+    info_dfont_,
+    * utf::enable_if< xpdf::fofi::detail::built_in<
+        xpdf::fofi::detail::PROBE_DFONT > >())
+{
+    const auto a = make_sfnt(std::string("\x00\x01\x00\x00", 4),
+                             { { "glyf", "x" } });
+    const auto b = make_sfnt("OTTO", { { "CFF ", make_cff(true) } });
+
+    const auto buf = make_dfont({ a, b });
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(xpdf::fofi::identify(buf.data(), buf.size(), type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_DFONT);
+
+    temp_file file(buf);
+
+    xpdf::fofi::font_info info;
+    BOOST_CHECK(xpdf::fofi::identify_ex(file.path.c_str(), info));
+
+    BOOST_CHECK(info.type == xpdf::fofi::FONT_DFONT);
+    BOOST_CHECK(info.nfaces == 2);
+
+    BOOST_CHECK(info.faces[0].type == xpdf::fofi::FONT_TRUETYPE);
+    BOOST_CHECK(info.faces[0].offset == 256 + 4);
+
+    BOOST_CHECK(info.faces[1].type == xpdf::fofi::FONT_OPENTYPE_CFF_CID);
+    BOOST_CHECK(info.faces[1].offset == 256 + 4 + a.size() + 4);
+    BOOST_CHECK(info.faces[1].cff_offset == info.faces[1].offset + 12 + 16);
+
+    //
+    // Not a resource fork without sfnt resources:
+    //
+    auto other = buf;
+    other.replace(other.find("sfnt"), 4, "ICN#");
+
+    BOOST_CHECK(!xpdf::fofi::identify(other.data(), other.size(), type));
+}
+
+BOOST_AUTO_TEST_CASE(allocation_free_)
+{
+    std::vector< std::string > bufs;
+
+    for (const auto &x : identify_dataset)
+        bufs.push_back(std::get< 0 >(x));
+
+    temp_file file(make_otf(make_cff(true), 5000));
+
+    xpdf::fofi::font_type type;
+
+    //
+    // Once to warm up the buffer pool:
+    //
+    xpdf::fofi::identify(file.path.c_str(), type);
+
+    const size_t before = allocations;
+
+    for (const auto &buf : bufs)
+        xpdf::fofi::identify(buf.data(), buf.size(), type);
+
+    xpdf::fofi::identify(file.path.c_str(), type);
+
+    BOOST_CHECK(before == allocations);
+}
+
+BOOST_AUTO_TEST_CASE(corpus_)
+{
+    namespace corpus = xpdf::fofi::corpus;
+
+    using namespace xpdf::fofi;
+
+    static const font_type expected[] = {
+        FONT_TYPE1_PFA, FONT_TYPE1_PFB, FONT_CFF_8BIT, FONT_CFF_CID,
+        FONT_TRUETYPE, FONT_TRUETYPE_COLLECTION, FONT_OPENTYPE_CFF_8BIT,
+        FONT_OPENTYPE_CFF_CID, FONT_DFONT
+    };
+
+    for (size_t size : { 0, 100, 10000 }) {
+        for (int i = 0; i < corpus::KIND_MAX; ++i) {
+            const auto kind = corpus::kind_t(i);
+            const auto buf = corpus::generate(kind, size, i);
+
+            BOOST_CHECK(buf == corpus::generate(kind, size, i));
+
+            font_type type = FONT_UNKNOWN;
+            const bool success =
+                xpdf::fofi::identify(buf.data(), buf.size(), type);
+
+            if (kind < corpus::TRUNCATED_OTF && !supported(expected[kind])) {
+                BOOST_CHECK(!success);
+            } else if (kind < corpus::TRUNCATED_OTF) {
+                BOOST_TEST_CONTEXT(corpus::name(kind) << " " << size) {
+                    BOOST_CHECK(success);
+                    BOOST_CHECK(type == expected[kind]);
+                }
+            } else if (kind != corpus::NOISE) {
+                BOOST_CHECK(!success);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(reader)
+
+static const std::vector< std::tuple< size_t, bool, xpdf::fofi::font_type > >
+otf_dataset = {
+    {    32, false, xpdf::fofi::FONT_OPENTYPE_CFF_8BIT },
+    {    32,  true, xpdf::fofi::FONT_OPENTYPE_CFF_CID  },
+    {  4093,  true, xpdf::fofi::FONT_OPENTYPE_CFF_CID  },
+    { 40000, false, xpdf::fofi::FONT_OPENTYPE_CFF_8BIT },
+};
+
+BOOST_DATA_TEST_CASE(
+    otf_,
+    data::make(otf_dataset), off, cid, expected)
+{
+    temp_file file(make_otf(make_cff(cid), off));
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(xpdf::fofi::identify_bycontent(file.path.c_str(), type));
+    BOOST_CHECK(type == expected);
+}
+
+BOOST_AUTO_TEST_CASE(blocks_)
+{
+    std::string s(3 * xpdf::fofi::buffer_pool::block_size + 17, '\0');
+
+    for (size_t i = 0; i < s.size(); ++i)
+        s[i] = char(i * 7 + i / 251);
+
+    temp_file file(s);
+
+    xpdf::fofi::file_reader src(file.fd, s.size());
+    BOOST_CHECK(src.size() == s.size());
+
+    //
+    // Back and forth across block boundaries, more blocks than are kept:
+    //
+    for (size_t i : { 0UL, 4095UL, 4096UL, 12304UL, 1UL, 8192UL, 4097UL })
+        BOOST_CHECK(src.at(i) == s[i]);
+
+    BOOST_CHECK(std::equal(src.begin(), src.end(), s.begin()));
+    BOOST_CHECK(!src.failed());
+}
+
+BOOST_AUTO_TEST_CASE(truncated_)
+{
+    temp_file file("%!PS-AdobeFont-1.0");
+
+    xpdf::fofi::file_reader src(file.fd, 1 << 20);
+    src.at(1 << 19);
+
+    BOOST_CHECK(src.failed());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(cache)
+
+BOOST_AUTO_TEST_CASE(persistent_)
+{
+    temp_file db(""), font(make_cff(true)), other("Hello, world!");
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+    struct stat st;
+    BOOST_CHECK(0 == ::stat(font.path.c_str(), &st));
+
+    {
+        xpdf::fofi::cache c(db.path.c_str());
+        BOOST_CHECK(c.is_open());
+
+        BOOST_CHECK(!c.lookup(st, type));
+        BOOST_CHECK(xpdf::fofi::identify(font.path.c_str(), type, c));
+        BOOST_CHECK(type == xpdf::fofi::FONT_CFF_CID);
+        BOOST_CHECK(!xpdf::fofi::identify(other.path.c_str(), type, c));
+    }
+
+    xpdf::fofi::cache c(db.path.c_str());
+
+    type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(c.lookup(st, type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_CFF_CID);
+
+    BOOST_CHECK(0 == ::stat(other.path.c_str(), &st));
+    BOOST_CHECK(c.lookup(st, type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_UNKNOWN);
+
+    //
+    // A changed file misses:
+    //
+    st.st_size += 1;
+    BOOST_CHECK(!c.lookup(st, type));
+}
+
+BOOST_AUTO_TEST_CASE(shared_)
+{
+    temp_file db(""), font("ttcf");
+
+    struct stat st;
+    BOOST_CHECK(0 == ::stat(font.path.c_str(), &st));
+
+    xpdf::fofi::cache a(db.path.c_str()), b(db.path.c_str());
+
+    //
+    // Appends of one are seen by the other on a miss:
+    //
+    b.insert(st, xpdf::fofi::FONT_TRUETYPE_COLLECTION);
+    b.flush();
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(a.lookup(st, type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_TRUETYPE_COLLECTION);
+}
+
+BOOST_AUTO_TEST_CASE(torn_)
+{
+    temp_file db(""), font("true");
+
+    struct stat st;
+    BOOST_CHECK(0 == ::stat(font.path.c_str(), &st));
+
+    {
+        xpdf::fofi::cache c(db.path.c_str());
+    }
+
+    ::lseek(db.fd, 0, SEEK_END);
+    BOOST_CHECK(7 == ::write(db.fd, "garbage", 7));
+
+    {
+        xpdf::fofi::cache c(db.path.c_str());
+        c.insert(st, xpdf::fofi::FONT_TRUETYPE);
+    }
+
+    xpdf::fofi::cache c(db.path.c_str());
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(c.lookup(st, type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_TRUETYPE);
+}
+
+BOOST_AUTO_TEST_CASE(compact_)
+{
+    temp_file db(""), font("true");
+
+    struct stat st, other, log;
+    BOOST_CHECK(0 == ::stat(font.path.c_str(), &st));
+
+    other = st;
+    other.st_ino += 1;
+
+    //
+    // Ones that are open before, and left behind by the compaction, one to
+    // append and one to look up:
+    //
+    xpdf::fofi::cache before(db.path.c_str()), reader(db.path.c_str());
+
+    {
+        xpdf::fofi::cache c(db.path.c_str());
+
+        c.insert(other, xpdf::fofi::FONT_TRUETYPE);
+
+        //
+        // A file changing over and over, every change a record:
+        //
+        for (int i = 0; i < 4000; ++i) {
+            ++st.st_mtim.tv_sec;
+            c.insert(st, xpdf::fofi::FONT_TRUETYPE);
+        }
+
+        c.flush();
+
+        BOOST_CHECK(0 == ::stat(db.path.c_str(), &log));
+        BOOST_CHECK(log.st_size < 1000 * 40);
+
+        xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+        BOOST_CHECK(c.lookup(st, type));
+        BOOST_CHECK(c.lookup(other, type));
+    }
+
+    //
+    // The live records are all there, and the processes that had the log
+    // open follow it:
+    //
+    auto third = st;
+    third.st_ino += 2;
+
+    before.insert(third, xpdf::fofi::FONT_CFF_8BIT);
+    before.flush();
+
+    xpdf::fofi::cache c(db.path.c_str());
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+    BOOST_CHECK(c.lookup(st, type));
+    BOOST_CHECK(c.lookup(other, type));
+    BOOST_CHECK(c.lookup(third, type) && type == xpdf::fofi::FONT_CFF_8BIT);
+
+    BOOST_CHECK(before.lookup(st, type));
+    BOOST_CHECK(reader.lookup(third, type));
+
+    BOOST_CHECK(0 == ::stat(db.path.c_str(), &log));
+    BOOST_CHECK(log.st_size < 1000 * 40);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_)
+{
+    temp_file db("");
+
+    struct stat st;
+    BOOST_CHECK(0 == ::stat(db.path.c_str(), &st));
+
+    //
+    // Lookups and insertions from several threads, past the buffered appends
+    // being written out, every thread seeing its own:
+    //
+    std::atomic< int > misses{ 0 };
+
+    {
+        xpdf::fofi::cache c(db.path.c_str());
+        std::vector< std::thread > threads;
+
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&, i] {
+                for (int j = 0; j < 300; ++j) {
+                    auto other = st;
+                    other.st_ino = 1000 * i + j;
+
+                    c.insert(other, xpdf::fofi::FONT_TRUETYPE);
+
+                    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+                    if (!c.lookup(other, type) ||
+                        type != xpdf::fofi::FONT_TRUETYPE)
+                        ++misses;
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    BOOST_CHECK(0 == misses);
+
+    //
+    // And all of them in the log:
+    //
+    xpdf::fofi::cache c(db.path.c_str());
+
+    for (int i = 0; i < 4; ++i) {
+        auto other = st;
+        other.st_ino = 1000 * i + 299;
+
+        xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+        BOOST_CHECK(c.lookup(other, type));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(decompress)
+
+template< typename Compressor >
+static std::string compress(const std::string &s, Compressor compressor)
+{
+    std::string result;
+
+    {
+        io::filtering_ostream stream;
+
+        stream.push(compressor);
+        stream.push(io::back_inserter(result));
+
+        stream.write(s.data(), s.size());
+    }
+
+    return result;
+}
+
+static std::string brotli(const std::string &s)
+{
+    std::string result(BrotliEncoderMaxCompressedSize(s.size()), '\0');
+    size_t n = result.size();
+
+    BrotliEncoderCompress(
+        BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+        s.size(), reinterpret_cast< const uint8_t * >(s.data()), &n,
+        reinterpret_cast< uint8_t * >(&result[0]));
+
+    result.resize(n);
+    return result;
+}
+
+static std::string make_woff(const std::string &flavor, const std::string &cff)
+{
+    //
+    // Tables are stored as is if compressing does not make them smaller:
+    //
+    auto table = compress(cff, io::zlib_compressor());
+
+    if (table.size() >= cff.size())
+        table = cff;
+
+    std::string s = "wOFF" + flavor + be32(0) + be16(1) + be16(0) + be32(0);
+    s += be16(1) + be16(0) + std::string(20, '\0');
+
+    s += "CFF " + be32(s.size() + 20) + be32(table.size()) + be32(cff.size());
+    s += be32(0);
+
+    return s + table;
+}
+
+static std::string make_woff2(const std::string &flavor, const std::string &cff)
+{
+    const std::string head(54, 'h');
+    const auto data = brotli(head + cff);
+
+    std::string s = "wOF2" + flavor + be32(0) + be16(2) + be16(0) + be32(0);
+    s += be32(data.size()) + be16(1) + be16(0) + std::string(20, '\0');
+
+    //
+    // Known tags 1 and 13, head and CFF, with 7-bit lengths:
+    //
+    s += std::string("\x01", 1) + char(head.size());
+    s += std::string("\x0d", 1) + char(cff.size());
+
+    return s + data;
+}
+
+static const auto pfa = std::string("%!PS-AdobeFont-1.0: Foo") +
+    std::string(2000, ' ');
+
+static const std::vector< std::tuple< std::string, xpdf::fofi::font_type > >
+decompress_dataset = {
+    { compress(pfa, io::gzip_compressor()),  xpdf::fofi::FONT_TYPE1_PFA },
+    { compress(pfa, io::bzip2_compressor()), xpdf::fofi::FONT_TYPE1_PFA },
+    { compress(pfa, io::lzma_compressor()),  xpdf::fofi::FONT_TYPE1_PFA },
+    { compress(pfa, io::zstd_compressor()),  xpdf::fofi::FONT_TYPE1_PFA },
+    { compress(make_otf(make_cff(true), 50000), io::gzip_compressor()),
+      xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+    { make_woff("OTTO", make_cff(true) + std::string(1000, '\0')),
+      xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+    { make_woff("OTTO", make_cff(false) + std::string(1000, '\0')),
+      xpdf::fofi::FONT_OPENTYPE_CFF_8BIT },
+    { make_woff("OTTO", make_cff(true)), xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+    { make_woff("true", ""), xpdf::fofi::FONT_TRUETYPE },
+    { make_woff2("OTTO", make_cff(true)), xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+    { make_woff2("OTTO", make_cff(false)), xpdf::fofi::FONT_OPENTYPE_CFF_8BIT },
+    { make_woff2("ttcf", ""), xpdf::fofi::FONT_TRUETYPE_COLLECTION },
+};
+
+BOOST_DATA_TEST_CASE(
+    decompress_,
+    data::make(decompress_dataset), buf, expected)
+{
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+    const bool in = supported(expected);
+    const auto result = in ? expected : xpdf::fofi::FONT_UNKNOWN;
+
+    BOOST_CHECK(in == xpdf::fofi::identify(buf.data(), buf.size(), type));
+    BOOST_CHECK(type == result);
+
+    temp_file file(buf);
+
+    type = xpdf::fofi::FONT_UNKNOWN;
+
+    BOOST_CHECK(in == xpdf::fofi::identify(file.path.c_str(), type));
+    BOOST_CHECK(type == result);
+}
+
+BOOST_AUTO_TEST_CASE(corrupt_)
+{
+    auto buf = compress(pfa, io::gzip_compressor());
+    buf.replace(10, 8, "garbage!");
+
+    xpdf::fofi::font_type type;
+    BOOST_CHECK(!xpdf::fofi::identify(buf.data(), buf.size(), type));
+
+    buf = make_woff2("OTTO", make_cff(true));
+    buf.resize(buf.size() - 4);
+    BOOST_CHECK(!xpdf::fofi::identify(buf.data(), buf.size(), type));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(stream)
+
+BOOST_AUTO_TEST_CASE(window_)
+{
+    std::string s(1 << 20, '\0');
+
+    for (size_t i = 0; i < s.size(); ++i)
+        s[i] = char(i * 13 + i / 241);
+
+    std::stringbuf sb(s);
+
+    const size_t window = xpdf::fofi::stream_source::default_window;
+    xpdf::fofi::stream_source src(sb, window);
+
+    BOOST_CHECK(src.at(0) == s[0]);
+    BOOST_CHECK(src.at(100) == s[100]);
+
+    //
+    // Skipping ahead keeps the memory bounded and the window readable:
+    //
+    BOOST_CHECK(src.at(900000) == s[900000]);
+    BOOST_CHECK(src.capacity() <= 3 * window);
+    BOOST_CHECK(src.at(900000 - window) == s[900000 - window]);
+
+    //
+    // Positions that fell out of the window read as the end:
+    //
+    BOOST_CHECK(!src.has(100));
+    BOOST_CHECK(src.begin() == src.end());
+
+    BOOST_CHECK(!src.has(s.size()));
+    BOOST_CHECK(src.size() == s.size());
+}
+
+static const std::vector< std::tuple< std::string, xpdf::fofi::font_type > >
+stream_dataset = {
+    { make_cff(false), xpdf::fofi::FONT_CFF_8BIT },
+    { make_otf(make_cff(true), 1 << 20), xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+    { decompress::compress(
+            make_otf(make_cff(false), 1 << 20), io::gzip_compressor()),
+      xpdf::fofi::FONT_OPENTYPE_CFF_8BIT },
+    { decompress::make_woff2("OTTO", make_cff(true)),
+      xpdf::fofi::FONT_OPENTYPE_CFF_CID },
+};
+
+BOOST_DATA_TEST_CASE(
+    identify_,
+    data::make(stream_dataset), buf, expected)
+{
+    std::stringbuf sb(buf);
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+
+    BOOST_CHECK(xpdf::fofi::identify(sb, type));
+    BOOST_CHECK(type == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(uring)
+
+BOOST_AUTO_TEST_CASE(identify_async_)
+{
+    namespace corpus = xpdf::fofi::corpus;
+
+    std::vector< std::unique_ptr< temp_file > > temps;
+
+    for (size_t size : { 100, 1 << 20 })
+        for (int i = 0; i < corpus::KIND_MAX; ++i)
+            temps.push_back(std::make_unique< temp_file >(
+                corpus::generate(corpus::kind_t(i), size, i)));
+
+    temps.push_back(std::make_unique< temp_file >(""));
+    temps.push_back(std::make_unique< temp_file >(decompress::compress(
+        make_otf(make_cff(true), 1 << 20), io::gzip_compressor())));
+    temps.push_back(std::make_unique< temp_file >(
+        decompress::make_woff2("OTTO", make_cff(false))));
+
+    std::vector< std::string > files = {
+        "/nonexistent", "/nonexistent.dfont", "/tmp"
+    };
+
+    for (const auto &x : temps)
+        files.push_back(x->path);
+
+    std::vector< int > seen(files.size());
+
+    //
+    // Fewer slots than files, to reuse them:
+    //
+    xpdf::fofi::identify_async(
+        files, 4, [&](size_t i, bool success, xpdf::fofi::font_type type) {
+            ++seen[i];
+
+            xpdf::fofi::font_type expected = xpdf::fofi::FONT_UNKNOWN;
+
+            BOOST_TEST_CONTEXT(files[i]) {
+                BOOST_CHECK(success == xpdf::fofi::identify(
+                                files[i].c_str(), expected));
+                BOOST_CHECK(type == expected);
+            }
+        });
+
+    BOOST_CHECK(std::all_of(
+        seen.begin(), seen.end(), [](auto n) { return n == 1; }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(batch)
+
+BOOST_DATA_TEST_CASE(
+    buffers_,
+    data::make(std::vector< size_t >{ 1, 4 }), jobs)
+{
+    namespace corpus = xpdf::fofi::corpus;
+
+    std::vector< std::string > samples;
+
+    for (size_t size : { 0, 100, 5000 })
+        for (int i = 0; i < corpus::KIND_MAX; ++i)
+            samples.push_back(corpus::generate(corpus::kind_t(i), size, i));
+
+    samples.push_back(decompress::compress(
+        make_otf(make_cff(true), 5000), io::gzip_compressor()));
+    samples.push_back(decompress::make_woff2("OTTO", make_cff(false)));
+    samples.push_back("");
+
+    //
+    // Enough of them to make several chunks, interleaved:
+    //
+    std::vector< xpdf::fofi::buffer_t > bufs;
+
+    for (size_t i = 0; i < 1000; ++i) {
+        const auto &s = samples[i * 7 % samples.size()];
+        bufs.push_back({ s.data(), s.size() });
+    }
+
+    std::vector< xpdf::fofi::font_type > types(
+        bufs.size(), xpdf::fofi::FONT_ERROR);
+
+    xpdf::fofi::identify(bufs.data(), bufs.size(), types.data(), jobs);
+
+    for (size_t i = 0; i < bufs.size(); ++i) {
+        xpdf::fofi::font_type expected = xpdf::fofi::FONT_UNKNOWN;
+
+        if (!xpdf::fofi::identify(bufs[i].data, bufs[i].size, expected))
+            expected = xpdf::fofi::FONT_UNKNOWN;
+
+        BOOST_CHECK(types[i] == expected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(scan)
+
+BOOST_DATA_TEST_CASE(
+    embedded_,
+    data::make(std::vector< xpdf::fofi::scan_impl_t >{
+            xpdf::fofi::SCAN_SCALAR, xpdf::fofi::SCAN_SSE2,
+            xpdf::fofi::SCAN_AVX2 }), impl)
+{
+    namespace corpus = xpdf::fofi::corpus;
+
+    using namespace xpdf::fofi;
+
+    //
+    // Fonts at odd offsets in noise, which has signature bytes of its own:
+    //
+    std::string blob = corpus::generate(corpus::NOISE, 1000, 1);
+    std::vector< std::pair< size_t, font_type > > fonts;
+
+    for (auto kind : { corpus::OTF_CID, corpus::PFA, corpus::TTC,
+                       corpus::PFB, corpus::DFONT, corpus::CFF_8BIT }) {
+        const auto font = corpus::generate(kind, 100);
+
+        //
+        // The kinds of fonts go by the types, in order:
+        //
+        const bool in = supported(font_type(kind));
+
+        font_type type = FONT_UNKNOWN;
+        BOOST_CHECK(in == xpdf::fofi::identify(font.data(), font.size(), type));
+
+        blob += corpus::generate(corpus::NOISE, 333, kind);
+
+        if (in)
+            fonts.emplace_back(blob.size(), type);
+
+        blob += font;
+    }
+
+    //
+    // Every offset, one at a time:
+    //
+    std::vector< scan_hit > expected;
+
+    for (size_t i = 0; i < blob.size(); ++i) {
+        const char *iter = blob.data() + i, *last = blob.data() + blob.size();
+        font_type type = FONT_UNKNOWN;
+
+        if (detail::identify(iter, last, type))
+            expected.push_back({ i, type });
+    }
+
+    std::vector< scan_hit > hits;
+    BOOST_CHECK(xpdf::fofi::scan(blob.data(), blob.size(), hits, impl) ==
+                hits.size());
+
+    BOOST_CHECK(hits.size() == expected.size());
+
+    for (size_t i = 0; i < std::min(hits.size(), expected.size()); ++i) {
+        BOOST_CHECK(hits[i].offset == expected[i].offset);
+        BOOST_CHECK(hits[i].type == expected[i].type);
+    }
+
+    for (auto [off, type] : fonts) {
+        BOOST_CHECK(std::any_of(hits.begin(), hits.end(), [&](auto &hit) {
+            return hit.offset == off && hit.type == type;
+        }));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(cff)
+
+BOOST_AUTO_TEST_CASE(parse_8bit_)
+{
+    const auto buf = make_cff_font(false, 300);
+
+    xpdf::fofi::cff_info info;
+    BOOST_CHECK(xpdf::fofi::parse_cff(buf.data(), buf.size(), info));
+
+    BOOST_CHECK(info.nfonts == 1);
+    BOOST_CHECK(info.nstrings == 2);
+    BOOST_CHECK(info.nglobal_subrs == 0);
+    BOOST_CHECK(!info.cid);
+    BOOST_CHECK(info.charstring_type == 2);
+    BOOST_CHECK(info.ncharstrings == 300);
+    BOOST_CHECK(info.private_dict.size == 2);
+    BOOST_CHECK(info.private_dict.offset + 2 + 6 == buf.size());
+    BOOST_CHECK(info.nlocal_subrs == 1);
+    BOOST_CHECK(info.fdarray == 0 && info.fdselect == 0 && info.nfds == 0);
+}
+
+BOOST_AUTO_TEST_CASE(parse_cid_)
+{
+    const auto buf = make_cff_font(true, 10, 3);
+
+    xpdf::fofi::cff_info info;
+    BOOST_CHECK(xpdf::fofi::parse_cff(buf.data(), buf.size(), info));
+
+    BOOST_CHECK(info.cid);
+    BOOST_CHECK(info.ncharstrings == 10);
+    BOOST_CHECK(info.private_dict.offset == 0);
+    BOOST_CHECK(info.fdarray && info.fdselect);
+    BOOST_CHECK(info.nfds == 3);
+
+    for (size_t i = 0; i < 3; ++i) {
+        BOOST_CHECK(info.fd_private_dicts[i].size == 2);
+        BOOST_CHECK(info.fd_private_dicts[i].offset ==
+                    buf.size() - (3 - i) * 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(parse_otf_)
+{
+    const auto cff = make_cff_font(true, 4, 2);
+    const auto buf = make_sfnt(
+        "OTTO", { { "head", std::string(54, 'x') }, { "CFF ", cff } });
+
+    xpdf::fofi::font_info font;
+    BOOST_CHECK(xpdf::fofi::identify_ex(buf.data(), buf.size(), font));
+    BOOST_CHECK(font.type == xpdf::fofi::FONT_OPENTYPE_CFF_CID);
+
+    xpdf::fofi::cff_info info;
+    BOOST_CHECK(xpdf::fofi::parse_cff(
+                    buf.data() + font.cff_offset,
+                    buf.size() - font.cff_offset, info));
+
+    BOOST_CHECK(info.cid && info.nfds == 2 && info.ncharstrings == 4);
+}
+
+BOOST_AUTO_TEST_CASE(truncated_)
+{
+    for (bool cid : { false, true }) {
+        const auto buf = make_cff_font(cid, 20, 2);
+
+        xpdf::fofi::cff_info info;
+
+        for (size_t n = 0; n < buf.size(); ++n)
+            BOOST_CHECK(!xpdf::fofi::parse_cff(buf.data(), n, info));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(malformed_)
+{
+    namespace corpus = xpdf::fofi::corpus;
+
+    xpdf::fofi::cff_info info;
+
+    //
+    // The minimal fonts of the corpus are enough for the identification, but
+    // have CharStrings at offset zero, or none at all:
+    //
+    for (auto kind : { corpus::CFF_8BIT, corpus::CFF_CID,
+                       corpus::HUGE_INDEX_CFF }) {
+        const auto buf = corpus::generate(kind, 4096);
+        BOOST_CHECK(!xpdf::fofi::parse_cff(buf.data(), buf.size(), info));
+    }
+
+    //
+    // Every byte of a good font set to the values that make for the largest
+    // offsets and counts:
+    //
+    const auto good = make_cff_font(true, 5, 2);
+
+    for (size_t i = 0; i < good.size(); ++i) {
+        for (char c : { '\x00', '\x7f', '\xff' }) {
+            auto buf = good;
+            buf[i] = c;
+
+            xpdf::fofi::parse_cff(buf.data(), buf.size(), info);
+        }
+    }
+
+    //
+    // A CharStrings offset past the end:
+    //
+    auto buf = good;
+    const auto pos = buf.find(std::string("\x11", 1)) - 4;
+    buf.replace(pos, 4, be32(0xfffffff0));
+
+    BOOST_CHECK(!xpdf::fofi::parse_cff(buf.data(), buf.size(), info));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(verify)
+
+//
+// Tables at aligned offsets but for the one after the 7-byte name:
+//
+static std::string make_font(const std::string &tag = "OTTO")
+{
+    const auto pad = [](std::string s) {
+        return s.resize((s.size() + 3) & ~size_t(3), '\0'), s;
+    };
+
+    std::string head(54, '\0');
+    head.replace(12, 4, be32(0x5f0f3cf5));
+
+    return seal_sfnt(make_sfnt(
+        tag, { { "CFF ", pad(make_cff_font(false, 10)) },
+               { "head", pad(head) },
+               { "name", "xyzzy42" },
+               { "maxp", std::string(6, 'm') } }));
+}
+
+BOOST_DATA_TEST_CASE(
+    checksum_,
+    data::make(std::vector< xpdf::fofi::scan_impl_t >{
+            xpdf::fofi::SCAN_SCALAR, xpdf::fofi::SCAN_SSE2,
+            xpdf::fofi::SCAN_AVX2 }), impl)
+{
+    const auto buf = xpdf::fofi::corpus::generate(
+        xpdf::fofi::corpus::NOISE, 1000, 7);
+
+    for (size_t off : { 0, 1, 3, 17 }) {
+        for (size_t n = 0; n + off <= buf.size(); n += n < 300 ? 1 : 97) {
+            BOOST_CHECK(
+                xpdf::fofi::checksum(buf.data() + off, n, impl) ==
+                xpdf::fofi::corpus::sfnt_checksum(buf, off, n));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(good_)
+{
+    xpdf::fofi::verify_result result;
+
+    for (const auto &tag : { std::string("OTTO"), std::string("true") }) {
+        const auto buf = make_font(tag);
+        BOOST_CHECK(xpdf::fofi::verify(buf.data(), buf.size(), result));
+        BOOST_CHECK(result.error == xpdf::fofi::VERIFY_OK);
+    }
+
+    //
+    // Tables at odd offsets, but for head:
+    //
+    const auto buf = seal_sfnt(make_sfnt(
+        std::string("\x00\x01\x00\x00", 4),
+        { { "head", std::string(54, 'h') }, { "glyf", "abc" },
+          { "loca", "de" } }));
+
+    BOOST_CHECK(xpdf::fofi::verify(buf.data(), buf.size(), result));
+
+    temp_file file(make_font());
+    BOOST_CHECK(xpdf::fofi::verify(file.path.c_str(), result));
+}
+
+BOOST_AUTO_TEST_CASE(corrupt_)
+{
+    using namespace xpdf::fofi;
+
+    const auto good = make_font();
+    verify_result result;
+
+    //
+    // A byte of the CFF table:
+    //
+    auto buf = good;
+    buf[12 + 4 * 16 + 40] ^= 1;
+
+    BOOST_CHECK(!xpdf::fofi::verify(buf.data(), buf.size(), result));
+    BOOST_CHECK(result.error == VERIFY_CHECKSUM);
+    BOOST_CHECK(result.tag == detail::magic("CFF "));
+
+    //
+    // The searchRange in the header, in no table:
+    //
+    buf = good;
+    buf[7] ^= 1;
+
+    BOOST_CHECK(!xpdf::fofi::verify(buf.data(), buf.size(), result));
+    BOOST_CHECK(result.error == VERIFY_ADJUSTMENT);
+
+    //
+    // The maxp table running past the end:
+    //
+    buf = good;
+    buf.replace(12 + 3 * 16 + 12, 4, be32(7));
+
+    BOOST_CHECK(!xpdf::fofi::verify(buf.data(), buf.size(), result));
+    BOOST_CHECK(result.error == VERIFY_BOUNDS);
+    BOOST_CHECK(result.tag == detail::magic("maxp"));
+
+    for (size_t n = 0; n < good.size(); ++n) {
+        BOOST_CHECK(!xpdf::fofi::verify(good.data(), n, result));
+        BOOST_CHECK(result.error != VERIFY_OK);
+    }
+
+    const auto cff = make_cff_font(false, 1);
+    BOOST_CHECK(!xpdf::fofi::verify(cff.data(), cff.size(), result));
+    BOOST_CHECK(result.error == VERIFY_FORMAT);
+
+    BOOST_CHECK(!xpdf::fofi::verify("/nonexistent/font", result));
+    BOOST_CHECK(result.error == VERIFY_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(ttc_)
+{
+    using namespace xpdf::fofi;
+
+    const auto face = [](size_t base, const std::string &glyf) {
+        return make_sfnt(
+            std::string("\x00\x01\x00\x00", 4),
+            { { "glyf", glyf }, { "head", std::string(54, 'h') } }, base);
+    };
+
+    const size_t first = 12 + 2 * 4, second = first + face(0, "").size() + 4;
+
+    auto buf = make_ttc({ face(first, "abcd"), face(second, "efgh") });
+    buf = seal_sfnt(seal_sfnt(buf, first, false), second, false);
+
+    verify_result result;
+    BOOST_CHECK(xpdf::fofi::verify(buf.data(), buf.size(), result));
+
+    buf[second + 12 + 2 * 16] = 'x';
+
+    BOOST_CHECK(!xpdf::fofi::verify(buf.data(), buf.size(), result));
+    BOOST_CHECK(result.error == VERIFY_CHECKSUM);
+    BOOST_CHECK(result.face == 1);
+    BOOST_CHECK(result.tag == detail::magic("glyf"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(dedup)
+
+BOOST_AUTO_TEST_CASE(hash64_)
+{
+    using xpdf::fofi::hash64;
+
+    BOOST_CHECK(hash64("", 0) == 0xef46db3751d8e999ULL);
+    BOOST_CHECK(hash64("abc", 3) == 0x44bc2cf5ad770999ULL);
+    BOOST_CHECK(hash64("abc", 3, 1) != hash64("abc", 3));
+
+    //
+    // Every length up to a few stripes, and a flipped bit in each:
+    //
+    const auto buf = xpdf::fofi::corpus::generate(
+        xpdf::fofi::corpus::NOISE, 200, 3);
+
+    for (size_t n = 1; n < buf.size(); ++n) {
+        auto other = buf.substr(0, n);
+        other[n / 2] ^= 0x10;
+
+        BOOST_CHECK(hash64(buf.data(), n) != hash64(buf.data(), n - 1));
+        BOOST_CHECK(hash64(buf.data(), n) != hash64(other.data(), n));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(groups_)
+{
+    const auto otf = make_otf(make_cff(true), 64);
+
+    temp_file a(otf), b(make_cff(false)), c(otf), d(otf + "x"), e(otf);
+
+    const std::vector< std::string > files = {
+        a.path, b.path, "/nonexistent/font", c.path, d.path, e.path,
+        "/nonexistent/font"
+    };
+
+    xpdf::fofi::dedup_index index(files, 2);
+
+    BOOST_CHECK(index.size() == files.size());
+    BOOST_CHECK(index.ngroups() == 5);
+
+    const auto group = index.group(0);
+    BOOST_CHECK(std::vector< std::uint32_t >(group.first, group.last) ==
+                std::vector< std::uint32_t >({ 0, 3, 5 }));
+
+    BOOST_CHECK(index.group(1).size() == 1 && *index.group(1).first == 1);
+    BOOST_CHECK(index.group(2).size() == 1 && *index.group(2).first == 2);
+    BOOST_CHECK(index.group(3).size() == 1 && *index.group(3).first == 4);
+    BOOST_CHECK(index.group(4).size() == 1 && *index.group(4).first == 6);
+
+    xpdf::fofi::content_key key;
+    BOOST_CHECK(index.key(0, key) && key.size == otf.size());
+    BOOST_CHECK(!index.key(2, key));
+
+    //
+    // One parse per group, one result per file:
+    //
+    std::vector< int > calls(files.size());
+    std::vector< xpdf::fofi::font_type > types(files.size());
+
+    std::mutex mtx;
+
+    xpdf::fofi::identify(files, 2, index, [&](size_t i, bool, auto type) {
+        std::lock_guard< std::mutex > lock(mtx);
+        ++calls[i];
+        types[i] = type;
+    });
+
+    BOOST_CHECK(std::all_of(calls.begin(), calls.end(), [](auto n) {
+        return n == 1;
+    }));
+
+    BOOST_CHECK(types[0] == xpdf::fofi::FONT_OPENTYPE_CFF_CID);
+    BOOST_CHECK(types[3] == types[0] && types[5] == types[0]);
+    BOOST_CHECK(types[1] == xpdf::fofi::FONT_CFF_8BIT);
+    BOOST_CHECK(types[2] == xpdf::fofi::FONT_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(named_)
+{
+    //
+    // The same content under a name that tells its type and one that does
+    // not: each gets what it would without the index, in either order:
+    //
+    temp_dir dir;
+    const auto &base = dir.path;
+
+    const auto ttf = std::string("\x00\x01\x00\x00\x00\x00", 6);
+
+    std::ofstream(base + "/a.ttf") << ttf;
+    std::ofstream(base + "/b.dfont") << ttf;
+
+    for (const auto &files : {
+            std::vector< std::string >{ base + "/a.ttf", base + "/b.dfont" },
+            std::vector< std::string >{ base + "/b.dfont", base + "/a.ttf" } }) {
+        xpdf::fofi::dedup_index index(files, 1);
+        BOOST_CHECK(index.ngroups() == 1);
+
+        std::vector< xpdf::fofi::font_type > types(files.size());
+
+        xpdf::fofi::identify(files, 1, index, [&](size_t i, bool, auto type) {
+            types[i] = type;
+        });
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+            xpdf::fofi::identify(files[i].c_str(), type);
+
+            BOOST_CHECK(types[i] == type);
+        }
+
+        BOOST_CHECK(types[files[0] == base + "/a.ttf" ? 0 : 1] ==
+                    xpdf::fofi::FONT_TRUETYPE);
+        BOOST_CHECK(types[files[0] == base + "/a.ttf" ? 1 : 0] ==
+                    xpdf::fofi::FONT_DFONT);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(server)
+
+//
+// A server on a thread of its own, for the duration of a test:
+//
+struct running_server
+{
+    running_server()
+        : path("/tmp/fofi-test-" + std::to_string(::getpid()) + ".sock"),
+          server(path.c_str()),
+          thread([this] { server.run(); })
+    { }
+
+    ~running_server()
+    {
+        server.stop();
+        thread.join();
+    }
+
+    std::string path;
+    xpdf::fofi::server server;
+    std::thread thread;
+};
+
+BOOST_AUTO_TEST_CASE(path_)
+{
+    running_server s;
+    BOOST_REQUIRE(s.server.is_open());
+
+    temp_file file(make_cff(true));
+
+    xpdf::fofi::client client(s.path.c_str());
+    BOOST_REQUIRE(client.is_open());
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(client.identify(file.path.c_str(), type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_CFF_CID);
+
+    BOOST_CHECK(!client.identify("/nonexistent/font", type));
+    BOOST_CHECK(type == xpdf::fofi::FONT_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(taken_)
+{
+    //
+    // A file that is not a socket is not removed, and not listened at:
+    //
+    temp_file file("notes");
+
+    {
+        xpdf::fofi::server server(file.path.c_str());
+        BOOST_CHECK(!server.is_open());
+    }
+
+    std::ifstream in(file.path);
+    BOOST_CHECK(std::string(std::istreambuf_iterator< char >(in), { }) ==
+                "notes");
+
+    //
+    // Neither is the socket of a running server:
+    //
+    running_server s;
+    BOOST_REQUIRE(s.server.is_open());
+
+    {
+        xpdf::fofi::server server(s.path.c_str());
+        BOOST_CHECK(!server.is_open());
+    }
+
+    temp_file font(make_cff(true));
+
+    xpdf::fofi::client client(s.path.c_str());
+    BOOST_REQUIRE(client.is_open());
+
+    xpdf::fofi::font_type type = xpdf::fofi::FONT_UNKNOWN;
+    BOOST_CHECK(client.identify(font.path.c_str(), type));
+}
+
+BOOST_AUTO_TEST_CASE(stale_)
+{
+    const std::string path =
+        "/tmp/fofi-test-" + std::to_string(::getpid()) + ".stale";
+
+    //
+    // A socket left behind by a server that is gone is replaced:
+    //
+    sockaddr_un addr = { };
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+
+    const int x = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    BOOST_REQUIRE(0 == ::bind(
+                      x, reinterpret_cast< sockaddr * >(&addr), sizeof addr));
+    ::close(x);
+
+    {
+        xpdf::fofi::server server(path.c_str());
+        BOOST_CHECK(server.is_open());
+    }
+
+    struct stat st;
+    BOOST_CHECK(0 != ::lstat(path.c_str(), &st));
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_)
+{
+    using namespace xpdf::fofi;
+
+    running_server s;
+
+    temp_file a(make_cff(false)), b(make_otf(make_cff(true), 64));
+
+    //
+    // Several clients at once, each with all of its requests in flight:
+    //
+    std::vector< std::thread > threads;
+    std::atomic< size_t > failures(0);
+
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            client c(s.path.c_str());
+
+            for (std::uint32_t i = 0; i < 1000; ++i)
+                if (!c.send_path(i, (i % 2 ? b : a).path.c_str()))
+                    ++failures;
+
+            for (std::uint32_t i = 0; i < 1000; ++i) {
+                response_t res;
+
+                const auto expected = i % 2
+                    ? FONT_OPENTYPE_CFF_CID : FONT_CFF_8BIT;
+
+                if (!c.receive(res) || res.id != i || !res.success ||
+                    res.type != expected)
+                    ++failures;
+            }
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    BOOST_CHECK(failures == 0);
+}
+
+BOOST_AUTO_TEST_CASE(fd_)
+{
+    using namespace xpdf::fofi;
+
+    running_server s;
+    client c(s.path.c_str());
+
+    temp_file a(make_cff(true)), b("Hello, world!");
+
+    BOOST_CHECK(c.send_fd(1, a.fd));
+    BOOST_CHECK(c.send_fd(2, b.fd));
+
+    response_t res;
+
+    BOOST_CHECK(c.receive(res));
+    BOOST_CHECK(res.id == 1 && res.success && res.type == FONT_CFF_CID);
+
+    BOOST_CHECK(c.receive(res));
+    BOOST_CHECK(res.id == 2 && !res.success && res.type == FONT_UNKNOWN);
+}
+
+BOOST_AUTO_TEST_CASE(shared_memory_)
+{
+    using namespace xpdf::fofi;
+
+    running_server s;
+    client c(s.path.c_str());
+
+    //
+    // Fonts at offsets in a sealed memfd:
+    //
+    const auto cff = make_cff(false), otf = make_otf(make_cff(true), 64);
+    const auto content = std::string(100, 'x') + cff + otf;
+
+    const int fd = ::memfd_create("fofi-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    BOOST_REQUIRE(fd >= 0);
+
+    BOOST_CHECK(::write(fd, content.data(), content.size()) ==
+                ssize_t(content.size()));
+    BOOST_CHECK(0 == ::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK));
+
+    response_t res;
+
+    BOOST_CHECK(c.send_attach(1, fd));
+    BOOST_CHECK(c.receive(res) && res.id == 1 && res.success);
+
+    const auto handle = res.value;
+
+    BOOST_CHECK(c.send_range(2, handle, 100, cff.size()));
+    BOOST_CHECK(c.send_range(3, handle, 100 + cff.size(), otf.size()));
+    BOOST_CHECK(c.send_range(4, handle, 0, 100));
+    BOOST_CHECK(c.send_range(5, handle, 100, content.size()));
+    BOOST_CHECK(c.send_range(6, handle + 1, 0, 1));
+
+    BOOST_CHECK(c.receive(res));
+    BOOST_CHECK(res.id == 2 && res.success && res.type == FONT_CFF_8BIT);
+
+    BOOST_CHECK(c.receive(res));
+    BOOST_CHECK(res.id == 3 && res.success &&
+                res.type == FONT_OPENTYPE_CFF_CID);
+
+    BOOST_CHECK(c.receive(res));
+    BOOST_CHECK(res.id == 4 && !res.success && res.type == FONT_UNKNOWN);
+
+    for (std::uint32_t id : { 5, 6 }) {
+        BOOST_CHECK(c.receive(res));
+        BOOST_CHECK(res.id == id && !res.success && res.type == FONT_ERROR);
+    }
+
+    BOOST_CHECK(c.send_detach(7, handle));
+    BOOST_CHECK(c.send_range(8, handle, 100, cff.size()));
+
+    BOOST_CHECK(c.receive(res) && res.id == 7 && res.success);
+    BOOST_CHECK(c.receive(res) && res.id == 8 && !res.success);
+
+    //
+    // A segment that could shrink under the server:
+    //
+    temp_file file(content);
+
+    BOOST_CHECK(c.send_attach(9, file.fd));
+    BOOST_CHECK(c.receive(res) && res.id == 9 && !res.success);
+
+    ::close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(malformed_)
+{
+    using namespace xpdf::fofi;
+
+    running_server s;
+
+    //
+    // Requests written as they are, without a client:
+    //
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    sockaddr_un addr = { };
+    addr.sun_family = AF_UNIX;
+    s.path.copy(addr.sun_path, sizeof addr.sun_path - 1);
+
+    BOOST_REQUIRE(0 == ::connect(
+        fd, reinterpret_cast< sockaddr * >(&addr), sizeof addr));
+
+    const auto request = [&](request_header req, const std::string &payload) {
+        std::string buf(reinterpret_cast< const char * >(&req), sizeof req);
+        buf += payload;
+
+        return ::write(fd, buf.data(), buf.size()) == ssize_t(buf.size());
+    };
+
+    //
+    // A descriptor that was not sent, an unknown kind, a short range:
+    //
+    BOOST_CHECK(request({ 1, REQUEST_FD, 0, 0 }, ""));
+    BOOST_CHECK(request({ 2, 99, 0, 3 }, "abc"));
+    BOOST_CHECK(request({ 3, REQUEST_RANGE, 0, 4 }, "abcd"));
+
+    for (std::uint32_t id = 1; id <= 3; ++id) {
+        response_t res;
+
+        BOOST_CHECK(::recv(fd, &res, sizeof res, MSG_WAITALL) == sizeof res);
+        BOOST_CHECK(res.id == id && !res.success && res.type == FONT_ERROR);
+    }
+
+    //
+    // A payload too large to frame drops the connection:
+    //
+    BOOST_CHECK(request({ 4, REQUEST_PATH, 0, 1 << 20 }, ""));
+
+    char c;
+    BOOST_CHECK(::recv(fd, &c, 1, 0) == 0);
+
+    ::close(fd);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(shm)
+
+BOOST_AUTO_TEST_CASE(basic_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(3, 4096);
+    BOOST_REQUIRE(ring.is_open());
+
+    BOOST_CHECK(ring.capacity() == 4);
+    BOOST_CHECK(ring.data_size() == 4096);
+
+    const auto cff = make_cff(false), otf = make_otf(make_cff(true), 64);
+
+    std::copy(cff.begin(), cff.end(), ring.data());
+    std::copy(otf.begin(), otf.end(), ring.data() + 1024);
+
+    shm_result result;
+    BOOST_CHECK(!ring.collect(result));
+
+    BOOST_CHECK(ring.submit(1, 0, cff.size()));
+    BOOST_CHECK(ring.submit(2, 1024, otf.size()));
+    BOOST_CHECK(ring.submit(3, 2048, 16));
+
+    BOOST_CHECK(ring.serve() == 3);
+    BOOST_CHECK(ring.serve() == 0);
+
+    BOOST_CHECK(ring.collect(result));
+    BOOST_CHECK(result.id == 1 && result.success);
+    BOOST_CHECK(result.type == FONT_CFF_8BIT);
+
+    BOOST_CHECK(ring.collect(result));
+    BOOST_CHECK(result.id == 2 && result.success);
+    BOOST_CHECK(result.type == FONT_OPENTYPE_CFF_CID);
+
+    BOOST_CHECK(ring.collect(result));
+    BOOST_CHECK(result.id == 3 && !result.success);
+    BOOST_CHECK(result.type == FONT_UNKNOWN);
+
+    BOOST_CHECK(!ring.collect(result));
+}
+
+BOOST_AUTO_TEST_CASE(bounds_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(4, 4096);
+
+    BOOST_CHECK(ring.submit(1, 4096, 0));
+    BOOST_CHECK(!ring.submit(2, 4000, 97));
+    BOOST_CHECK(!ring.submit(3, 4097, 0));
+    BOOST_CHECK(!ring.submit(4, 1, UINT64_MAX));
+
+    //
+    // Full, counting the requests whose results are not collected yet:
+    //
+    BOOST_CHECK(ring.submit(5, 0, 16));
+    BOOST_CHECK(ring.submit(6, 0, 16));
+    BOOST_CHECK(ring.submit(7, 0, 16));
+    BOOST_CHECK(!ring.submit(8, 0, 16));
+
+    BOOST_CHECK(ring.serve(2) == 2);
+    BOOST_CHECK(!ring.submit(8, 0, 16));
+
+    shm_result result;
+
+    BOOST_CHECK(ring.collect(result) && result.id == 1);
+    BOOST_CHECK(ring.submit(8, 0, 16));
+}
+
+BOOST_AUTO_TEST_CASE(attach_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(4, 4096);
+
+    shm_ring other(ring.fd());
+    BOOST_REQUIRE(other.is_open());
+
+    BOOST_CHECK(other.capacity() == 4);
+    BOOST_CHECK(other.data_size() == 4096);
+
+    //
+    // Not a segment:
+    //
+    temp_file file(std::string(8192, 'x'));
+    BOOST_CHECK(!shm_ring(file.fd).is_open());
+
+    const auto cff = make_cff(true);
+    std::copy(cff.begin(), cff.end(), ring.data() + 100);
+
+    BOOST_CHECK(ring.submit(42, 100, cff.size()));
+    BOOST_CHECK(other.serve() == 1);
+
+    shm_result result;
+
+    BOOST_CHECK(ring.collect(result));
+    BOOST_CHECK(result.id == 42 && result.type == FONT_CFF_CID);
+}
+
+BOOST_AUTO_TEST_CASE(seals_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(4, 4096);
+
+    BOOST_CHECK(::ftruncate(ring.fd(), 64) != 0);
+    BOOST_CHECK(::ftruncate(ring.fd(), 1 << 20) != 0);
+
+    //
+    // A copy of the segment that could shrink:
+    //
+    const int fd = ::memfd_create("fofi-test", MFD_CLOEXEC);
+    BOOST_REQUIRE(fd >= 0);
+
+    struct stat st;
+    BOOST_REQUIRE(0 == ::fstat(ring.fd(), &st));
+
+    std::string buf(st.st_size, '\0');
+    BOOST_REQUIRE(st.st_size == ::pread(ring.fd(), &buf[0], buf.size(), 0));
+    BOOST_REQUIRE(st.st_size == ::write(fd, buf.data(), buf.size()));
+
+    BOOST_CHECK(!shm_ring(fd).is_open());
+
+    ::close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(overrun_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(2, 4096);
+
+    const auto cff = make_cff(true);
+    std::copy(cff.begin(), cff.end(), ring.data());
+
+    BOOST_CHECK(ring.submit(1, 0, cff.size()));
+    BOOST_CHECK(ring.submit(2, 0, cff.size()));
+    BOOST_CHECK(ring.serve() == 2);
+
+    //
+    // A producer that resets the in-flight count, in the second cache line of
+    // the segment, then submits more with the results not collected; the
+    // consumer gives up on their results instead of waiting forever:
+    //
+    void *p = ::mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd(), 0);
+    BOOST_REQUIRE(MAP_FAILED != p);
+
+    reinterpret_cast< std::atomic< std::uint64_t > * >(
+        static_cast< char * >(p) + 64)->store(0);
+
+    ::munmap(p, 4096);
+
+    BOOST_CHECK(ring.submit(3, 0, cff.size()));
+    BOOST_CHECK(ring.submit(4, 0, cff.size()));
+    BOOST_CHECK(ring.serve() == 2);
+
+    shm_result result;
+    size_t n = 0;
+
+    for (; ring.collect(result); ++n)
+        BOOST_CHECK(result.id == 1 || result.id == 2);
+
+    BOOST_CHECK(n == 2);
+}
+
+BOOST_AUTO_TEST_CASE(threads_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(64, 4096);
+
+    const auto cff = make_cff(false);
+    std::copy(cff.begin(), cff.end(), ring.data());
+
+    //
+    // Producers and consumers at once, every request completing exactly once:
+    //
+    const size_t producers = 4, consumers = 3, n = 5000;
+
+    std::vector< std::atomic< int > > seen(producers * n);
+    std::atomic< size_t > done(0), failures(0);
+
+    std::vector< std::thread > threads;
+
+    for (size_t t = 0; t < consumers; ++t) {
+        threads.emplace_back([&] {
+            while (done < producers * n)
+                if (0 == ring.serve(16))
+                    std::this_thread::yield();
+        });
+    }
+
+    for (size_t t = 0; t < producers; ++t) {
+        threads.emplace_back([&, t] {
+            size_t submitted = 0;
+
+            while (submitted < n) {
+                if (ring.submit(t * n + submitted, 0, cff.size()))
+                    ++submitted;
+                else
+                    std::this_thread::yield();
+
+                shm_result result;
+
+                while (ring.collect(result)) {
+                    if (!result.success || result.type != FONT_CFF_8BIT)
+                        ++failures;
+
+                    ++seen[result.id];
+                    ++done;
+                }
+            }
+        });
+    }
+
+    //
+    // The producers collect each other's results, until none is left:
+    //
+    for (size_t t = 0; t < producers; ++t)
+        threads[consumers + t].join();
+
+    shm_result result;
+
+    while (done < producers * n) {
+        if (ring.collect(result)) {
+            ++seen[result.id];
+            ++done;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    for (size_t t = 0; t < consumers; ++t)
+        threads[t].join();
+
+    BOOST_CHECK(failures == 0);
+    BOOST_CHECK(std::all_of(seen.begin(), seen.end(), [](auto &x) {
+        return x == 1;
+    }));
+}
+
+BOOST_AUTO_TEST_CASE(process_)
+{
+    using namespace xpdf::fofi;
+
+    shm_ring ring(8, 4096);
+
+    const auto otf = make_otf(make_cff(true), 64);
+    std::copy(otf.begin(), otf.end(), ring.data());
+
+    for (std::uint64_t i = 0; i < 8; ++i)
+        BOOST_CHECK(ring.submit(i, 0, i % 2 ? otf.size() : 4));
+
+    //
+    // A consumer in another process, over the inherited descriptor:
+    //
+    const pid_t pid = ::fork();
+    BOOST_REQUIRE(pid >= 0);
+
+    if (0 == pid) {
+        shm_ring other(ring.fd());
+
+        size_t n = 0;
+
+        while (other.is_open() && n < 8)
+            n += other.serve();
+
+        ::_exit(n == 8 ? 0 : 1);
+    }
+
+    int status = 0;
+    BOOST_CHECK(pid == ::waitpid(pid, &status, 0));
+    BOOST_CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+    shm_result result;
+
+    for (std::uint64_t i = 0; i < 8; ++i) {
+        BOOST_CHECK(ring.collect(result));
+        BOOST_CHECK(result.id == i && result.success == bool(i % 2));
+
+        if (i % 2)
+            BOOST_CHECK(result.type == FONT_OPENTYPE_CFF_CID);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(stats)
+
+BOOST_AUTO_TEST_CASE(bucket_)
+{
+    using xpdf::fofi::stats::bucket;
+    using xpdf::fofi::stats::nbuckets;
+
+    BOOST_CHECK(bucket(0) == 0);
+    BOOST_CHECK(bucket(1) == 1);
+    BOOST_CHECK(bucket(1023) == 10);
+    BOOST_CHECK(bucket(1024) == 11);
+    BOOST_CHECK(bucket(UINT64_MAX) == nbuckets - 1);
+}
+
+BOOST_AUTO_TEST_CASE(write_)
+{
+    using namespace xpdf::fofi::stats;
+
+    snapshot_t x{ };
+
+    x.probes[3].attempts = 4;
+    x.probes[3].hits = 3;
+    x.probes[3].rejects[REJECT_TRUNCATED] = 1;
+
+    x.probes[3].latency.count = 4;
+    x.probes[3].latency.sum = 3000;
+    x.probes[3].latency.buckets[bucket(500)] = 3;
+    x.probes[3].latency.buckets[bucket(1500)] = 1;
+
+    x.results[xpdf::fofi::FONT_CFF_CID] = 3;
+
+    std::ostringstream json;
+    write_json(json, x);
+
+    BOOST_CHECK(json.str().find(
+        "\"cff\": {\n      \"attempts\": 4, \"hits\": 3,") !=
+        std::string::npos);
+    BOOST_CHECK(json.str().find("\"truncated\": 1") != std::string::npos);
+    BOOST_CHECK(json.str().find(
+        "\"buckets\": [{ \"le_ns\": 512, \"count\": 3 }, "
+        "{ \"le_ns\": 2048, \"count\": 1 }]") != std::string::npos);
+    BOOST_CHECK(json.str().find("\"cff_cid\": 3") != std::string::npos);
+
+    std::ostringstream text;
+    write_prometheus(text, x);
+
+    const auto &s = text.str();
+
+    BOOST_CHECK(s.find("fofi_probe_hits_total{probe=\"cff\"} 3\n") !=
+                std::string::npos);
+    BOOST_CHECK(s.find("fofi_probe_rejects_total{probe=\"cff\","
+                       "reason=\"truncated\"} 1\n") != std::string::npos);
+
+    //
+    // Cumulative buckets:
+    //
+    BOOST_CHECK(s.find("fofi_probe_latency_seconds_bucket{probe=\"cff\","
+                       "le=\"5.12e-07\"} 3\n") != std::string::npos);
+    BOOST_CHECK(s.find("fofi_probe_latency_seconds_bucket{probe=\"cff\","
+                       "le=\"1.024e-06\"} 3\n") != std::string::npos);
+    BOOST_CHECK(s.find("fofi_probe_latency_seconds_bucket{probe=\"cff\","
+                       "le=\"2.048e-06\"} 4\n") != std::string::npos);
+    BOOST_CHECK(s.find("fofi_probe_latency_seconds_bucket{probe=\"cff\","
+                       "le=\"+Inf\"} 4\n") != std::string::npos);
+    BOOST_CHECK(s.find("fofi_probe_latency_seconds_sum{probe=\"cff\"} 3e-06\n")
+                != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(counters_)
+{
+    namespace stats = xpdf::fofi::stats;
+    namespace detail = xpdf::fofi::detail;
+
+    stats::snapshot_t before, after;
+    stats::snapshot(before);
+
+    const auto cff = make_cff(true);
+
+    xpdf::fofi::font_type type;
+
+    BOOST_CHECK(xpdf::fofi::identify(cff.data(), cff.size(), type));
+    BOOST_CHECK(!xpdf::fofi::identify(cff.data(), 8, type));
+    BOOST_CHECK(!xpdf::fofi::identify("Hello, world!", 13, type));
+
+    stats::snapshot(after);
+
+    if constexpr (stats::enabled) {
+        const auto &a = after.probes[detail::PROBE_CFF];
+        const auto &b = before.probes[detail::PROBE_CFF];
+
+        BOOST_CHECK(a.attempts - b.attempts == 2);
+        BOOST_CHECK(a.hits - b.hits == 1);
+        BOOST_CHECK(a.rejects[stats::REJECT_TRUNCATED] -
+                    b.rejects[stats::REJECT_TRUNCATED] == 1);
+        BOOST_CHECK(a.latency.count - b.latency.count == 2);
+
+        const auto &c = after.probes[detail::PROBE_NONE];
+        const auto &d = before.probes[detail::PROBE_NONE];
+
+        BOOST_CHECK(c.rejects[stats::REJECT_SIGNATURE] -
+                    d.rejects[stats::REJECT_SIGNATURE] == 1);
+
+        BOOST_CHECK(after.results[xpdf::fofi::FONT_CFF_CID] -
+                    before.results[xpdf::fofi::FONT_CFF_CID] == 1);
+        BOOST_CHECK(after.results[xpdf::fofi::FONT_UNKNOWN] -
+                    before.results[xpdf::fofi::FONT_UNKNOWN] == 2);
+    } else {
+        BOOST_CHECK(after.probes[detail::PROBE_CFF].attempts == 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(mapped)
+
+BOOST_AUTO_TEST_CASE(plan_otf_)
+{
+    using namespace xpdf::fofi;
+
+    const auto otf = make_otf(make_cff(true, 10000), 1 << 20);
+
+    access_plan plan;
+
+    //
+    // The directory is in the head, the CFF table only the first 4 KiB of it:
+    //
+    plan_access(otf.data(), 4096, otf.size(), plan);
+
+    BOOST_REQUIRE(plan.n == 1);
+    BOOST_CHECK(plan.ranges[0].offset == 1 << 20);
+    BOOST_CHECK(plan.ranges[0].size == 4096);
+
+    //
+    // A head short of the directory:
+    //
+    plan_access(otf.data(), 20, otf.size(), plan);
+
+    BOOST_REQUIRE(plan.n == 1);
+    BOOST_CHECK(plan.ranges[0].offset == 12);
+    BOOST_CHECK(plan.ranges[0].size == 16);
+
+    //
+    // Clipped to the file:
+    //
+    plan_access(otf.data(), 4096, (1 << 20) + 100, plan);
+
+    BOOST_REQUIRE(plan.n == 1);
+    BOOST_CHECK(plan.ranges[0].size == 100);
+
+    //
+    // A CFF table in the head is no news:
+    //
+    const auto near = make_otf(make_cff(false), 64);
+    plan_access(near.data(), near.size(), near.size(), plan);
+
+    BOOST_CHECK(plan.n == 0);
+}
+
+BOOST_AUTO_TEST_CASE(plan_dfont_)
+{
+    using namespace xpdf::fofi;
+
+    const auto ttf = make_sfnt(
+        std::string("\x00\x01\x00\x00", 4), { { "glyf", "xxxx" } });
+    const auto dfont = make_dfont({ ttf, std::string(10000, '\0') });
+
+    access_plan plan;
+    plan_access(dfont.data(), 16, dfont.size(), plan);
+
+    BOOST_REQUIRE(plan.n == 1);
+    BOOST_CHECK(plan.ranges[0].offset + plan.ranges[0].size == dfont.size());
+
+    //
+    // Nothing for the formats read from the head alone:
+    //
+    const auto cff = make_cff(true);
+    plan_access(cff.data(), cff.size(), 1 << 20, plan);
+
+    BOOST_CHECK(plan.n == 0);
+}
+
+BOOST_AUTO_TEST_CASE(identify_)
+{
+    using namespace xpdf::fofi;
+
+    //
+    // Either side of the populated size:
+    //
+    for (size_t size : { size_t(4096), populate_size + 1, size_t(1) << 20 }) {
+        const std::string fonts[] = {
+            make_otf(make_cff(true), size),
+            make_otf(make_cff(false), 64) + std::string(size, '\0'),
+            make_pfa(size),
+            make_cff(false, size),
+            std::string(size, 'x')
+        };
+
+        for (const auto &font : fonts) {
+            temp_file file(font);
+
+            font_type a = FONT_UNKNOWN, b = FONT_UNKNOWN;
+
+            BOOST_CHECK(xpdf::fofi::identify(file.path.c_str(), a) ==
+                        identify_mapped(file.path.c_str(), b));
+            BOOST_CHECK(a == b);
+        }
+    }
+
+    font_type type = FONT_UNKNOWN;
+
+    BOOST_CHECK(!identify_mapped("/nonexistent/font", type));
+    BOOST_CHECK(type == FONT_ERROR);
+
+    temp_file empty("");
+
+    type = FONT_UNKNOWN;
+    BOOST_CHECK(!identify_mapped(empty.path.c_str(), type));
+    BOOST_CHECK(type == FONT_UNKNOWN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(columnar)
+
+BOOST_AUTO_TEST_CASE(write_read_)
+{
+    using namespace xpdf::fofi;
+
+    temp_file file("");
+
+    struct stat st = { };
+
+    results_writer writer;
+
+    const char *paths[] = { "/b/font.otf", "/a/font.pfa", "", "/c" };
+    const font_type types[] = {
+        FONT_OPENTYPE_CFF_CID, FONT_TYPE1_PFA, FONT_ERROR, FONT_UNKNOWN
+    };
+
+    for (size_t i = 0; i < 4; ++i) {
+        st.st_size = 100 * i;
+        st.st_mtim.tv_sec = i;
+        st.st_mtim.tv_nsec = 7;
+
+        writer.add(paths[i], types[i], st);
+    }
+
+    BOOST_REQUIRE(writer.write(file.path.c_str()));
+
+    results_file results(file.path.c_str());
+
+    BOOST_REQUIRE(results.is_open());
+    BOOST_REQUIRE(results.size() == 4);
+    BOOST_CHECK(!results.has_metadata());
+
+    //
+    // Sorted by path:
+    //
+    BOOST_CHECK(results.path(0) == "");
+    BOOST_CHECK(results.path(1) == "/a/font.pfa");
+    BOOST_CHECK(results.path(2) == "/b/font.otf");
+    BOOST_CHECK(results.path(3) == "/c");
+
+    for (size_t i = 0; i < 4; ++i) {
+        const size_t j = results.find(paths[i]);
+
+        BOOST_REQUIRE(j != results_file::npos);
+        BOOST_CHECK(results.type(j) == types[i]);
+        BOOST_CHECK(results.file_size(j) == 100 * i);
+        BOOST_CHECK(results.mtime(j) == std::int64_t(i) * 1000000000 + 7);
+        BOOST_CHECK(results.nfaces(j) == 0);
+
+        BOOST_CHECK(results.types()[j] == types[i]);
+        BOOST_CHECK(0 == reinterpret_cast< uintptr_t >(results.sizes()) % 64);
+    }
+
+    BOOST_CHECK(results.find("/b") == results_file::npos);
+    BOOST_CHECK(results.find("/d") == results_file::npos);
+}
+
+BOOST_AUTO_TEST_CASE(metadata_)
+{
+    using namespace xpdf::fofi;
+
+    const auto ttc = make_ttc({
+            make_sfnt(std::string("\x00\x01\x00\x00", 4),
+                      { { "glyf", "xxxx" }, { "head", "yyyy" } }),
+            make_sfnt(std::string("\x00\x01\x00\x00", 4),
+                      { { "glyf", "xxxx" } }) });
+
+    font_info info;
+    BOOST_REQUIRE(identify_ex(ttc.data(), ttc.size(), info));
+
+    temp_file file("");
+
+    struct stat st = { };
+
+    results_writer writer;
+
+    writer.add("/ttc", info.type, st, info);
+    writer.add("/none", FONT_UNKNOWN, st);
+
+    BOOST_REQUIRE(writer.write(file.path.c_str()));
+
+    results_file results(file.path.c_str());
+
+    BOOST_REQUIRE(results.is_open());
+    BOOST_CHECK(results.has_metadata());
+
+    const size_t i = results.find("/ttc"), j = results.find("/none");
+
+    BOOST_REQUIRE(i != results_file::npos && j != results_file::npos);
+
+    BOOST_CHECK(results.type(i) == FONT_TRUETYPE_COLLECTION);
+    BOOST_CHECK(results.nfaces(i) == 2);
+    BOOST_CHECK(results.ntables(i) == info.ntables);
+    BOOST_CHECK(results.flags(i) == 0);
+
+    BOOST_CHECK(results.nfaces(j) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_)
+{
+    using namespace xpdf::fofi;
+
+    BOOST_CHECK(!results_file("/nonexistent/results").is_open());
+    BOOST_CHECK(!results_file(temp_file("").path.c_str()).is_open());
+
+    temp_file file("");
+
+    struct stat st = { };
+
+    results_writer writer;
+
+    for (size_t i = 0; i < 100; ++i)
+        writer.add(std::to_string(i), FONT_TRUETYPE, st);
+
+    BOOST_REQUIRE(writer.write(file.path.c_str()));
+
+    std::string content;
+
+    {
+        std::ifstream stream(file.path);
+        content.assign(std::istreambuf_iterator< char >(stream), { });
+    }
+
+    //
+    // Truncated anywhere:
+    //
+    for (size_t n : { size_t(0), size_t(8), size_t(64), content.size() - 1 }) {
+        temp_file truncated(content.substr(0, n));
+        BOOST_CHECK(!results_file(truncated.path.c_str()).is_open());
+    }
+
+    //
+    // The other byte order:
+    //
+    auto swapped = content;
+    std::reverse(swapped.begin(), swapped.begin() + 8);
+
+    BOOST_CHECK(!results_file(temp_file(swapped).path.c_str()).is_open());
+
+    //
+    // Path offsets past the data, the column being after the header and the
+    // directory:
+    //
+    auto bad = content;
+    bad[192 + 8 * 100 + 7] = 0x7f;
+
+    BOOST_CHECK(!results_file(temp_file(bad).path.c_str()).is_open());
+
+    BOOST_CHECK(results_file(temp_file(content).path.c_str()).is_open());
+}
+
+BOOST_AUTO_TEST_CASE(update_)
+{
+    using namespace xpdf::fofi;
+
+    temp_file a(""), b("");
+
+    results_writer writer;
+
+    struct stat st = { };
+    st.st_size = 10;
+    st.st_mtim.tv_sec = 1;
+
+    for (auto path : { "/d/x", "/d/y", "/d-z", "/d/e/x", "/e" })
+        writer.add(path, FONT_TRUETYPE, st);
+
+    BOOST_REQUIRE(writer.write(a.path.c_str()));
+
+    results_file first(a.path.c_str());
+    BOOST_REQUIRE(first.is_open());
+
+    //
+    // The files under a directory, which is not where the prefix sorts:
+    //
+    BOOST_CHECK(first.path(first.lower_bound("/d/")) == "/d/e/x");
+    BOOST_CHECK(first.path(first.lower_bound("/d")) == "/d-z");
+    BOOST_CHECK(first.lower_bound("/f") == first.size());
+
+    //
+    // Unchanged only with the same size and modification time:
+    //
+    BOOST_CHECK(first.find("/e", st) != results_file::npos);
+
+    auto other = st;
+    other.st_mtim.tv_nsec = 1;
+
+    BOOST_CHECK(first.find("/e", other) == results_file::npos);
+
+    other = st;
+    other.st_size = 11;
+
+    BOOST_CHECK(first.find("/e", other) == results_file::npos);
+
+    //
+    // Rows taken over as they are:
+    //
+    results_writer next;
+
+    for (size_t i = 0; i < first.size(); i += 2)
+        next.add(first, i);
+
+    BOOST_REQUIRE(next.write(b.path.c_str()));
+
+    results_file second(b.path.c_str());
+
+    BOOST_REQUIRE(second.is_open());
+    BOOST_REQUIRE(second.size() == 3);
+
+    for (size_t i = 0; i < second.size(); ++i) {
+        BOOST_CHECK(second.path(i) == first.path(2 * i));
+        BOOST_CHECK(second.type(i) == FONT_TRUETYPE);
+        BOOST_CHECK(second.find(second.path(i), st) == i);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(watch)
+
+//
+// Waits for the changes, in order, without the duplicates:
+//
+std::vector< std::string > changes(xpdf::fofi::watcher &w)
+{
+    std::vector< std::string > paths;
+    BOOST_REQUIRE(w.wait(paths, 50));
+
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    return paths;
+}
+
+BOOST_AUTO_TEST_CASE(files_)
+{
+    temp_dir dir;
+    fs::create_directory(dir.path + "/sub");
+
+    xpdf::fofi::watcher w({ dir.path });
+    BOOST_REQUIRE(w.is_open());
+
+    std::ofstream(dir.path + "/sub/a") << "a";
+
+    BOOST_CHECK(changes(w) == std::vector< std::string >{
+            dir.path + "/sub/a" });
+
+    fs::rename(dir.path + "/sub/a", dir.path + "/b");
+    fs::remove(dir.path + "/b");
+
+    BOOST_CHECK((changes(w) == std::vector< std::string >{
+                dir.path + "/b", dir.path + "/sub/a" }));
+}
+
+BOOST_AUTO_TEST_CASE(directories_)
+{
+    temp_dir dir;
+
+    xpdf::fofi::watcher w({ dir.path });
+    BOOST_REQUIRE(w.is_open());
+
+    //
+    // A new directory is reported as a whole, and watched:
+    //
+    fs::create_directory(dir.path + "/new");
+
+    BOOST_CHECK(changes(w) == std::vector< std::string >{
+            dir.path + "/new" });
+
+    std::ofstream(dir.path + "/new/a") << "a";
+
+    BOOST_CHECK(changes(w) == std::vector< std::string >{
+            dir.path + "/new/a" });
+
+    fs::remove_all(dir.path + "/new");
+
+    const auto paths = changes(w);
+
+    BOOST_CHECK(std::find(paths.begin(), paths.end(), dir.path + "/new") !=
+                paths.end());
+}
+
+BOOST_AUTO_TEST_CASE(moved_)
+{
+    temp_dir dir, away;
+    fs::create_directories(dir.path + "/a/b");
+
+    xpdf::fofi::watcher w({ dir.path });
+    BOOST_REQUIRE(w.is_open());
+
+    //
+    // A directory moved within the trees is watched under its new path:
+    //
+    fs::rename(dir.path + "/a", dir.path + "/c");
+
+    BOOST_CHECK((changes(w) == std::vector< std::string >{
+                dir.path + "/a", dir.path + "/c" }));
+
+    std::ofstream(dir.path + "/c/b/x") << "x";
+
+    BOOST_CHECK(changes(w) == std::vector< std::string >{
+            dir.path + "/c/b/x" });
+
+    //
+    // One moved out of them is not watched anymore, nor what is under it:
+    //
+    fs::rename(dir.path + "/c", away.path + "/c");
+
+    BOOST_CHECK(changes(w) == std::vector< std::string >{
+            dir.path + "/c" });
+
+    std::ofstream(away.path + "/c/x") << "x";
+    std::ofstream(away.path + "/c/b/y") << "y";
+    std::ofstream(dir.path + "/z") << "z";
+
+    BOOST_CHECK(changes(w) == std::vector< std::string >{
+            dir.path + "/z" });
+}
+
+BOOST_AUTO_TEST_CASE(stop_)
+{
+    temp_dir dir;
+
+    xpdf::fofi::watcher w({ dir.path });
+    BOOST_REQUIRE(w.is_open());
+
+    std::thread thread([&] { w.stop(); });
+
+    std::vector< std::string > paths;
+    BOOST_CHECK(!w.wait(paths));
+
+    thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(dispatch)
+
+//
+// Every signature picks its own format, at compile time:
+//
+template< xpdf::fofi::detail::probe_t... Ps >
+constexpr bool distinct(xpdf::fofi::detail::registry< Ps... >)
+{
+    using namespace xpdf::fofi::detail;
+
+    //
+    // The formats left out of the build are not looked for at all:
+    //
+    return ([] {
+        if (!built_in< Ps >)
+            return true;
+
+        for (const auto &sig : format< Ps >::signatures)
+            if (formats::probe_for(sig.word) != Ps)
+                return false;
+
+        return true;
+    }() && ...);
+}
+
+static_assert(distinct(xpdf::fofi::detail::formats{ }));
+
+BOOST_AUTO_TEST_CASE(probe_for_)
+{
+    using namespace xpdf::fofi::detail;
+
+    //
+    // What the build has of them:
+    //
+    const auto expect = [](probe_t which, bool in) {
+        return in ? which : PROBE_NONE;
+    };
+
+    BOOST_CHECK(probe_for(magic("%!PS")) ==
+                expect(PROBE_PFA, built_in< PROBE_PFA >));
+    BOOST_CHECK(probe_for(0x80010a0b) ==
+                expect(PROBE_PFB, built_in< PROBE_PFB >));
+    BOOST_CHECK(probe_for(0x01000401) ==
+                expect(PROBE_CFF, built_in< PROBE_CFF >));
+    BOOST_CHECK(probe_for(magic("ttcf")) ==
+                expect(PROBE_TTF, built_in< PROBE_TTF >));
+    BOOST_CHECK(probe_for(magic("OTTO")) ==
+                expect(PROBE_OTF, built_in< PROBE_OTF >));
+    BOOST_CHECK(probe_for(magic("\x00\x00\x01\x00")) ==
+                expect(PROBE_DFONT, built_in< PROBE_DFONT >));
+    BOOST_CHECK(probe_for(magic("wOFF")) == PROBE_NONE);
+    BOOST_CHECK(probe_for(0x80020000) == PROBE_NONE);
+
+    BOOST_CHECK(std::string(formats::name(PROBE_OTF)) == "otf");
+    BOOST_CHECK(std::string(formats::name(PROBE_NONE)) == "none");
+}
+
+BOOST_AUTO_TEST_CASE(
+    subset_,
+    * utf::enable_if< xpdf::fofi::detail::built_in<
+        xpdf::fofi::detail::PROBE_OTF > >())
+{
+    using namespace xpdf::fofi;
+    using namespace xpdf::fofi::detail;
+
+    using sfnt = registry< PROBE_TTF, PROBE_OTF >;
+
+    static_assert(sfnt::supports(FONT_OPENTYPE_CFF_CID) ==
+                  built_in< PROBE_OTF >);
+    static_assert(!sfnt::supports(FONT_TYPE1_PFA));
+    static_assert(formats::supports(FONT_TYPE1_PFA) == built_in< PROBE_PFA >);
+
+    BOOST_CHECK(sfnt::probe_for(magic("%!PS")) == PROBE_NONE);
+    BOOST_CHECK(sfnt::probe_for(magic("OTTO")) == PROBE_OTF);
+
+    const auto otf = make_otf(make_cff(true), 64);
+    const auto pfa = make_pfa();
+
+    font_type type = FONT_UNKNOWN;
+
+    auto iter = otf.data();
+    BOOST_CHECK(sfnt::run(PROBE_OTF, iter, otf.data() + otf.size(), type, 0));
+    BOOST_CHECK(type == FONT_OPENTYPE_CFF_CID);
+
+    //
+    // Not in the set, whatever the input:
+    //
+    iter = pfa.data();
+    BOOST_CHECK(!sfnt::run(PROBE_PFA, iter, pfa.data() + pfa.size(), type, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,613 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include <batch.hh>
+#include <decompress.hh>
+#include <reader.hh>
+#include <uring.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+//
+// Not depending on liburing, the ring is driven with the raw system calls:
+//
+int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return int(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags)
+{
+    return int(::syscall(
+        __NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+    return int(::syscall(__NR_io_uring_register, fd, opcode, arg, nargs));
+}
+
+//
+// A submission and a completion queue, shared with the kernel. The ring is
+// open only if the kernel supports all the operations we need.
+//
+struct ring
+{
+    explicit ring(unsigned entries);
+    ~ring();
+
+    ring(const ring &) = delete;
+    ring &operator=(const ring &) = delete;
+
+    bool is_open() const { return fd >= 0; }
+
+    //
+    // A cleared submission queue entry, or 0 if the queue is full:
+    //
+    io_uring_sqe *get();
+
+    //
+    // Submits the queued entries and waits for `wait' completions:
+    //
+    int submit(unsigned wait);
+
+    //
+    // Calls f(user_data, result) for all available completions:
+    //
+    template< typename F >
+    void reap(F f);
+
+private:
+    bool map();
+    bool supported();
+
+private:
+    int fd = -1;
+    io_uring_params params{ };
+
+    void *sq_ptr = MAP_FAILED, *cq_ptr = MAP_FAILED;
+    size_t sq_len = 0, cq_len = 0;
+
+    io_uring_sqe *sqes = 0;
+    io_uring_cqe *cqes = 0;
+
+    unsigned *sq_head = 0, *sq_tail = 0, *sq_mask = 0, *sq_array = 0;
+    unsigned *cq_head = 0, *cq_tail = 0, *cq_mask = 0;
+
+    //
+    // Our copy of the submission tail, and the entries not yet submitted:
+    //
+    unsigned tail = 0, queued = 0;
+};
+
+ring::ring(unsigned entries)
+{
+    fd = io_uring_setup(entries, &params);
+
+    if (fd >= 0 && !(map() && supported())) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+ring::~ring()
+{
+    if (sqes)
+        ::munmap(sqes, params.sq_entries * sizeof *sqes);
+
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+        ::munmap(cq_ptr, cq_len);
+
+    if (sq_ptr != MAP_FAILED)
+        ::munmap(sq_ptr, sq_len);
+
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool ring::map()
+{
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    //
+    // Both rings in one mapping, since 5.4:
+    //
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+
+    if (single)
+        sq_len = cq_len = std::max(sq_len, cq_len);
+
+    sq_ptr = ::mmap(0, sq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (sq_ptr == MAP_FAILED)
+        return false;
+
+    cq_ptr = single ? sq_ptr : ::mmap(
+        0, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        IORING_OFF_CQ_RING);
+
+    if (cq_ptr == MAP_FAILED)
+        return false;
+
+    void *p = ::mmap(
+        0, params.sq_entries * sizeof *sqes, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (p == MAP_FAILED)
+        return false;
+
+    sqes = static_cast< io_uring_sqe * >(p);
+
+    const auto sq = static_cast< char * >(sq_ptr);
+    const auto cq = static_cast< char * >(cq_ptr);
+
+    sq_head  = reinterpret_cast< unsigned * >(sq + params.sq_off.head);
+    sq_tail  = reinterpret_cast< unsigned * >(sq + params.sq_off.tail);
+    sq_mask  = reinterpret_cast< unsigned * >(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast< unsigned * >(sq + params.sq_off.array);
+
+    cq_head = reinterpret_cast< unsigned * >(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast< unsigned * >(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast< unsigned * >(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast< io_uring_cqe * >(cq + params.cq_off.cqes);
+
+    tail = *sq_tail;
+
+    return true;
+}
+
+bool ring::supported()
+{
+    static constexpr unsigned nops = 256;
+
+    std::vector< char > buf(
+        sizeof(io_uring_probe) + nops * sizeof(io_uring_probe_op));
+
+    auto probe = reinterpret_cast< io_uring_probe * >(buf.data());
+
+    //
+    // Probing is itself a 5.6 addition, as is IORING_OP_READ:
+    //
+    if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, nops) < 0)
+        return false;
+
+    for (auto op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ }) {
+        if (op > probe->last_op ||
+            0 == (probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    }
+
+    return true;
+}
+
+io_uring_sqe *ring::get()
+{
+    const unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= params.sq_entries)
+        return 0;
+
+    const unsigned i = tail & *sq_mask;
+
+    sq_array[i] = i;
+    ++tail, ++queued;
+
+    memset(sqes + i, 0, sizeof *sqes);
+    return sqes + i;
+}
+
+int ring::submit(unsigned wait)
+{
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        const int result = io_uring_enter(
+            fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+
+        if (result >= 0) {
+            queued -= std::min(unsigned(result), queued);
+            return result;
+        }
+
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+template< typename F >
+void ring::reap(F f)
+{
+    unsigned head = *cq_head;
+    const unsigned last = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != last; ++head) {
+        const auto &cqe = cqes[head & *cq_mask];
+        f(cqe.user_data, cqe.res);
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+//
+// The state of a file in flight: its descriptor and attributes, and the
+// blocks read so far, which the parsers see through an iterator. Reading an
+// offset that has not been read yet is recorded as `missing' and reads as a
+// zero; the parsers are then run again, once that block is in.
+//
+struct slot_t
+{
+    using iterator = offset_iterator< slot_t >;
+
+    static constexpr size_t max_blocks = 8;
+    static constexpr size_t npos = size_t(-1);
+
+    iterator begin() { return { this, 0 }; }
+    iterator end() { return { this, size }; }
+
+    const char &at(size_t off)
+    {
+        static const char zero = 0;
+
+        for (size_t i = 0; i < nblocks; ++i) {
+            const auto &block = blocks[i];
+
+            if (off - block.base < block.size)
+                return block.p[off - block.base];
+        }
+
+        if (missing == npos)
+            missing = off;
+
+        return zero;
+    }
+
+    struct block_t
+    {
+        size_t base = 0, size = 0;
+        char *p = 0;
+    };
+
+    block_t blocks[max_blocks];
+    size_t nblocks = 0, size = 0, missing = npos, index = 0;
+
+    struct statx stx;
+
+    int fd = -1, error = 0;
+    unsigned pending = 0;
+
+    bool opened = false, failed = false;
+};
+
+enum op_t { OPEN, STAT, READ };
+
+inline std::uint64_t tag(size_t slot, size_t block, op_t op)
+{
+    return std::uint64_t(slot) << 16 | block << 8 | op;
+}
+
+struct engine
+{
+    using callback_type = std::function< void(size_t, bool, font_type) >;
+
+    static constexpr size_t default_depth = 64, max_depth = 1024;
+
+    engine(const std::vector< std::string > &files, size_t depth,
+           const callback_type &f)
+        : files(files), f(f),
+          slots(std::min(depth ? depth : default_depth, max_depth)),
+          r(2 * slots.size())
+    {
+        for (size_t i = slots.size(); i; --i)
+            free.push_back(i - 1);
+    }
+
+    ~engine()
+    {
+        for (auto &slot : slots) {
+            if (slot.fd >= 0)
+                ::close(slot.fd);
+
+            //
+            // After a failure of the ring, reads may still be in flight:
+            //
+            if (idle) {
+                for (auto &block : slot.blocks)
+                    if (block.p)
+                        pool.release(block.p);
+            }
+        }
+    }
+
+    bool is_open() const { return r.is_open(); }
+
+    //
+    // Returns false if the ring failed, leaving the files not reported yet to
+    // the caller:
+    //
+    bool run();
+
+    std::vector< bool > reported;
+
+private:
+    void start(size_t);
+    void complete(std::uint64_t, int);
+    void advance(slot_t &);
+    void read(slot_t &, size_t);
+    void finish(slot_t &, bool, font_type);
+
+    bool sync(slot_t &, font_type &, bool compressed_only);
+
+    void report(size_t i, bool success, font_type type)
+    {
+        reported[i] = true;
+        f(i, success, type);
+    }
+
+private:
+    const std::vector< std::string > &files;
+    const callback_type &f;
+
+    buffer_pool &pool = buffer_pool::instance();
+
+    std::vector< slot_t > slots;
+    std::vector< size_t > free;
+
+    ring r;
+    bool idle = false;
+};
+
+bool engine::run()
+{
+    reported.assign(files.size(), false);
+
+    for (size_t next = 0;;) {
+        while (next < files.size() && !free.empty())
+            start(next++);
+
+        if (free.size() == slots.size()) {
+            if (next == files.size())
+                return idle = true;
+
+            continue;
+        }
+
+        if (r.submit(1) < 0 && errno != EAGAIN && errno != EBUSY)
+            return false;
+
+        r.reap([this](auto user_data, auto result) {
+            complete(user_data, result);
+        });
+    }
+}
+
+void engine::start(size_t i)
+{
+    const char *path = files[i].c_str();
+
+    font_type type = FONT_UNKNOWN;
+
+    if (identify_byextension(path, type))
+        return report(i, true, type);
+
+    const size_t n = free.back();
+    free.pop_back();
+
+    auto &slot = slots[n];
+
+    slot.index = i;
+    slot.fd = -1;
+    slot.error = 0;
+    slot.nblocks = slot.size = 0;
+    slot.opened = slot.failed = false;
+
+    //
+    // The open and the stat go together, both by path:
+    //
+    auto sqe = r.get();
+    ASSERT(sqe);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast< std::uintptr_t >(path);
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = tag(n, 0, OPEN);
+
+    sqe = r.get();
+    ASSERT(sqe);
+
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast< std::uintptr_t >(path);
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = reinterpret_cast< std::uintptr_t >(&slot.stx);
+    sqe->user_data = tag(n, 0, STAT);
+
+    slot.pending = 2;
+}
+
+void engine::complete(std::uint64_t user_data, int result)
+{
+    auto &slot = slots[user_data >> 16];
+
+    switch (op_t(user_data & 0xff)) {
+    case OPEN:
+        if (result >= 0)
+            slot.fd = result;
+        else
+            slot.error = -result;
+        break;
+
+    case STAT:
+        if (result < 0)
+            slot.error = -result;
+        break;
+
+    case READ:
+        //
+        // Error, or the file shrunk underneath us:
+        //
+        if (result < 0 ||
+            size_t(result) != slot.blocks[(user_data >> 8) & 0xff].size)
+            slot.failed = true;
+        break;
+    }
+
+    if (0 == --slot.pending)
+        advance(slot);
+}
+
+void engine::advance(slot_t &slot)
+{
+    if (!slot.opened) {
+        slot.opened = true;
+
+        if (slot.error || !S_ISREG(slot.stx.stx_mode))
+            return finish(slot, false, FONT_ERROR);
+
+        slot.size = slot.stx.stx_size;
+
+        if (slot.size)
+            return read(slot, 0);
+    }
+
+    if (slot.failed)
+        return finish(slot, false, FONT_ERROR);
+
+    font_type type = FONT_UNKNOWN;
+
+    slot.missing = slot_t::npos;
+
+    auto iter = slot.begin(), last = slot.end();
+    bool success = detail::identify(iter, last, type);
+
+    if (slot.missing != slot_t::npos) {
+        if (slot.nblocks < slot_t::max_blocks)
+            return read(slot, slot.missing);
+
+        //
+        // Rarely, the parsers go further than we keep:
+        //
+        success = sync(slot, type, false);
+    } else if (!success) {
+        success = sync(slot, type, true);
+    }
+
+    finish(slot, success, type);
+}
+
+void engine::read(slot_t &slot, size_t off)
+{
+    auto &block = slot.blocks[slot.nblocks];
+
+    if (0 == block.p)
+        block.p = pool.acquire();
+
+    block.base = off - off % buffer_pool::block_size;
+    block.size = std::min(buffer_pool::block_size, slot.size - block.base);
+
+    auto sqe = r.get();
+    ASSERT(sqe);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast< std::uintptr_t >(block.p);
+    sqe->len = block.size;
+    sqe->off = block.base;
+    sqe->user_data = tag(&slot - slots.data(), slot.nblocks, READ);
+
+    ++slot.nblocks;
+    slot.pending = 1;
+}
+
+//
+// The synchronous reader, for the compressed fonts and the few that need more
+// than we keep in flight:
+//
+bool engine::sync(slot_t &slot, font_type &type, bool compressed_only)
+{
+    //
+    // Small files are all in the first block already:
+    //
+    if (compressed_only && slot.size <= buffer_pool::block_size)
+        return identify_compressed(slot.blocks[0].p, slot.size, type);
+
+    file_reader src(slot.fd, slot.size, pool);
+
+    auto iter = src.begin(), last = src.end();
+
+    bool success = !compressed_only && detail::identify(iter, last, type);
+
+    if (!success && !src.failed())
+        success = identify_compressed(src.begin(), src.end(), type);
+
+    if (src.failed())
+        type = FONT_ERROR, success = false;
+
+    return success;
+}
+
+void engine::finish(slot_t &slot, bool success, font_type type)
+{
+    if (slot.fd >= 0)
+        ::close(slot.fd);
+
+    slot.fd = -1;
+    free.push_back(&slot - slots.data());
+
+    report(slot.index, success, type);
+}
+
+} // anonymous namespace
+
+void identify_async(
+    const std::vector< std::string > &files, size_t depth,
+    const std::function< void(size_t, bool, font_type) > &f)
+{
+    engine e(files, depth, f);
+
+    if (e.is_open()) {
+        if (e.run())
+            return;
+
+        //
+        // The ring failed midway, the rest is done here:
+        //
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (!e.reported[i]) {
+                font_type type = FONT_UNKNOWN;
+                const bool success = identify(files[i].c_str(), type);
+                f(i, success, type);
+            }
+        }
+
+        return;
+    }
+
+    identify(files, 0, f);
+}
+
+bool async_supported()
+{
+    static const bool supported = ring(2).is_open();
+    return supported;
+}
+
+} // namespace xpdf::fofi
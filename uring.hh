@@ -0,0 +1,37 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_URING_HH
+#define FOFI_URING_HH
+
+#include <fofi.hh>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace xpdf::fofi {
+
+//
+// Identifies all `files' from the calling thread with asynchronous I/O, with
+// up to `depth' of them in flight (0 for the default): the opens, stats and
+// header reads are submitted together through an io_uring, and the parsers
+// run on whatever has completed. A file is read further only when a parser
+// asks for an offset past what has been read of it, one block at a time.
+//
+// Reports each file as it completes via f(index, success, type), with the
+// same results as identify(path). Where io_uring is not available, falls back
+// to identifying the files on a pool of threads, see batch.hh.
+//
+void identify_async(
+    const std::vector< std::string > &files, size_t depth,
+    const std::function< void(size_t, bool, font_type) > &f);
+
+//
+// Whether identify_async goes through io_uring on this system:
+//
+bool async_supported();
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_URING_HH
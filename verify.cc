@@ -0,0 +1,397 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define FOFI_VERIFY_X86 1
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <verify.hh>
+#include <detail/fofi.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+inline std::uint32_t load32(const char *p)
+{
+    return std::uint32_t(std::uint8_t(p[0])) << 24 |
+        std::uint32_t(std::uint8_t(p[1])) << 16 |
+        std::uint32_t(std::uint8_t(p[2])) <<  8 |
+        std::uint32_t(std::uint8_t(p[3]));
+}
+
+inline std::uint32_t load16(const char *p)
+{
+    return std::uint32_t(std::uint8_t(p[0])) << 8 | std::uint8_t(p[1]);
+}
+
+//
+// The words from `p' on, then the last, partial one:
+//
+std::uint32_t checksum_scalar(const char *p, size_t n)
+{
+    std::uint32_t sum = 0;
+
+    for (; n >= 4; p += 4, n -= 4)
+        sum += load32(p);
+
+    for (size_t i = 0; i < n; ++i)
+        sum += std::uint32_t(std::uint8_t(p[i])) << (24 - 8 * i);
+
+    return sum;
+}
+
+#if defined(FOFI_VERIFY_X86)
+//
+// The sums wrap around in each lane the same way they do in a single one, the
+// lanes are added up at the end:
+//
+__attribute__((target("sse2")))
+inline __m128i load_bswap32x4(const char *p)
+{
+    //
+    // No byte shuffle before SSSE3: the bytes of the 16-bit halves, then the
+    // halves themselves:
+    //
+    auto v = _mm_loadu_si128(reinterpret_cast< const __m128i * >(p));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+}
+
+__attribute__((target("sse2")))
+std::uint32_t checksum_sse2(const char *p, size_t n)
+{
+    auto a = _mm_setzero_si128(), b = _mm_setzero_si128();
+
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        a = _mm_add_epi32(a, load_bswap32x4(p + i));
+        b = _mm_add_epi32(b, load_bswap32x4(p + i + 16));
+    }
+
+    alignas(16) std::uint32_t xs[4];
+    _mm_store_si128(reinterpret_cast< __m128i * >(xs), _mm_add_epi32(a, b));
+
+    return xs[0] + xs[1] + xs[2] + xs[3] + checksum_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i load_bswap32x8(const char *p)
+{
+    const auto mask = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    return _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast< const __m256i * >(p)), mask);
+}
+
+__attribute__((target("avx2")))
+std::uint32_t checksum_avx2(const char *p, size_t n)
+{
+    auto a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+    auto c = _mm256_setzero_si256(), d = _mm256_setzero_si256();
+
+    size_t i = 0;
+
+    for (; i + 128 <= n; i += 128) {
+        a = _mm256_add_epi32(a, load_bswap32x8(p + i));
+        b = _mm256_add_epi32(b, load_bswap32x8(p + i + 32));
+        c = _mm256_add_epi32(c, load_bswap32x8(p + i + 64));
+        d = _mm256_add_epi32(d, load_bswap32x8(p + i + 96));
+    }
+
+    for (; i + 32 <= n; i += 32)
+        a = _mm256_add_epi32(a, load_bswap32x8(p + i));
+
+    const auto v = _mm256_add_epi32(_mm256_add_epi32(a, b),
+                                    _mm256_add_epi32(c, d));
+
+    const auto w = _mm_add_epi32(_mm256_castsi256_si128(v),
+                                 _mm256_extracti128_si256(v, 1));
+
+    alignas(16) std::uint32_t xs[4];
+    _mm_store_si128(reinterpret_cast< __m128i * >(xs), w);
+
+    return xs[0] + xs[1] + xs[2] + xs[3] + checksum_scalar(p + i, n - i);
+}
+#endif // FOFI_VERIFY_X86
+
+//
+// The contribution of bytes [begin, end) of the file to the file checksum,
+// i.e., with the words aligned on the file and not on `begin':
+//
+std::uint32_t
+sum_range(const char *p, size_t begin, size_t end, scan_impl_t impl)
+{
+    std::uint32_t sum = 0;
+
+    for (; begin < end && begin % 4; ++begin)
+        sum += std::uint32_t(std::uint8_t(p[begin])) << (24 - 8 * (begin % 4));
+
+    const size_t n = (end - begin) & ~size_t(3);
+
+    return sum + checksum(p + begin, n, impl) +
+        checksum(p + begin + n, end - begin - n, SCAN_SCALAR);
+}
+
+//
+// The whole of a file checksum, 0xb1b0afba by way of checkSumAdjustment:
+//
+constexpr std::uint32_t checksum_magic = 0xb1b0afba;
+
+struct verifier
+{
+    verifier(const char *p, size_t n, verify_result &result)
+        : p(p), n(n), result(result), impl(scan_impl())
+    { }
+
+    bool fail(verify_error error, std::uint32_t face = 0, std::uint32_t tag = 0)
+    {
+        result = { error, face, tag };
+        return false;
+    }
+
+    //
+    // The table directory of a face, at `off', and the bounds of its tables:
+    //
+    bool face(size_t off, std::uint32_t index)
+    {
+        if (off > n || n - off < 12)
+            return fail(VERIFY_DIRECTORY, index);
+
+        switch (load32(p + off)) {
+        case 0x00010000:
+        case detail::magic("true"):
+        case detail::magic("OTTO"):
+            break;
+
+        default:
+            return fail(VERIFY_FORMAT, index);
+        }
+
+        const size_t ntables = load16(p + off + 4);
+
+        if ((n - off - 12) / 16 < ntables)
+            return fail(VERIFY_DIRECTORY, index);
+
+        for (size_t i = 0; i < ntables; ++i) {
+            const char *rec = p + off + 12 + 16 * i;
+
+            const table_record t{
+                load32(rec), load32(rec + 4), load32(rec + 8), load32(rec + 12)
+            };
+
+            if (t.offset > n || n - t.offset < t.length)
+                return fail(VERIFY_BOUNDS, index, t.tag);
+
+            tables.push_back({ t, index, 0 });
+        }
+
+        return true;
+    }
+
+    //
+    // The tables, in file order, each one summed once even if shared by the
+    // faces of a collection:
+    //
+    bool checksums()
+    {
+        std::sort(tables.begin(), tables.end(), [](auto &a, auto &b) {
+            return a.rec.offset < b.rec.offset ||
+                (a.rec.offset == b.rec.offset && a.rec.length < b.rec.length);
+        });
+
+        const table_entry *prev = 0;
+
+        for (auto &t : tables) {
+            if (prev && prev->rec.offset == t.rec.offset &&
+                prev->rec.length == t.rec.length) {
+                t.sum = prev->sum;
+            } else {
+                t.sum = checksum(p + t.rec.offset, t.rec.length, impl);
+            }
+
+            //
+            // The checksum of head is made with checkSumAdjustment as zero:
+            //
+            std::uint32_t sum = t.sum;
+
+            if (t.rec.tag == detail::magic("head") && t.rec.length >= 12)
+                sum -= load32(p + t.rec.offset + 8);
+
+            if (sum != t.rec.checksum)
+                return fail(VERIFY_CHECKSUM, t.face, t.rec.tag);
+
+            prev = &t;
+        }
+
+        return true;
+    }
+
+    //
+    // The file checksum from the table checksums and the bytes around the
+    // tables, or over all of it if the tables are not laid out the way the
+    // format asks:
+    //
+    std::uint32_t file_checksum() const
+    {
+        std::uint32_t sum = 0;
+        size_t pos = 0;
+
+        for (const auto &t : tables) {
+            if (t.rec.offset % 4 || t.rec.offset < pos)
+                return sum_range(p, 0, n, impl);
+
+            sum += sum_range(p, pos, t.rec.offset, impl) + t.sum;
+            pos = t.rec.offset + t.rec.length;
+        }
+
+        return sum + sum_range(p, pos, n, impl);
+    }
+
+    bool sfnt()
+    {
+        if (!face(0, 0) || !checksums())
+            return false;
+
+        const auto iter = std::find_if(
+            tables.begin(), tables.end(), [](auto &t) {
+                return t.rec.tag == detail::magic("head");
+            });
+
+        if (iter != tables.end() && iter->rec.length >= 12 &&
+            file_checksum() != checksum_magic)
+            return fail(VERIFY_ADJUSTMENT, 0, iter->rec.tag);
+
+        return true;
+    }
+
+    //
+    // The faces of a collection; checkSumAdjustment is not meaningful in
+    // them, the head tables summing up different sets of tables:
+    //
+    bool ttc()
+    {
+        if (n < 12)
+            return fail(VERIFY_DIRECTORY);
+
+        const size_t nfaces = load32(p + 8);
+
+        if ((n - 12) / 4 < nfaces)
+            return fail(VERIFY_DIRECTORY);
+
+        for (size_t i = 0; i < nfaces; ++i)
+            if (!face(load32(p + 12 + 4 * i), i))
+                return false;
+
+        return checksums();
+    }
+
+    struct table_entry
+    {
+        table_record rec;
+        std::uint32_t face, sum;
+    };
+
+    const char *p;
+    size_t n;
+
+    verify_result &result;
+    scan_impl_t impl;
+
+    std::vector< table_entry > tables;
+};
+
+} // anonymous namespace
+
+std::uint32_t checksum(const char *pbuf, size_t n, scan_impl_t impl)
+{
+    switch (scan_impl(impl)) {
+#if defined(FOFI_VERIFY_X86)
+    case SCAN_AVX2: return checksum_avx2(pbuf, n);
+    case SCAN_SSE2: return checksum_sse2(pbuf, n);
+#endif // FOFI_VERIFY_X86
+
+    default:
+        return checksum_scalar(pbuf, n);
+    }
+}
+
+bool verify(const char *pbuf, size_t n, verify_result &result)
+{
+    result = { VERIFY_OK, 0, 0 };
+
+    verifier v(pbuf, n, result);
+
+    if (n >= 4 && load32(pbuf) == detail::magic("ttcf"))
+        return v.ttc();
+
+    return v.sfnt();
+}
+
+bool verify(const char *filepath, verify_result &result)
+{
+    result = { VERIFY_ERROR, 0, 0 };
+
+    const int fd = ::open(filepath, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (0 != ::fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    if (0 == st.st_size) {
+        ::close(fd);
+        return verify("", 0, result);
+    }
+
+    void *p = ::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (MAP_FAILED == p)
+        return false;
+
+    //
+    // Every byte of the tables is read once, front to back, mostly:
+    //
+    ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    const bool success = verify(
+        static_cast< const char * >(p), st.st_size, result);
+
+    ::munmap(p, st.st_size);
+    return success;
+}
+
+const char *to_string(verify_error error)
+{
+    static const char *xs[] = {
+        "ok",
+        "not an sfnt",
+        "truncated table directory",
+        "table out of bounds",
+        "table checksum mismatch",
+        "checkSumAdjustment mismatch",
+        "read error"
+    };
+
+    return size_t(error) < sizeof xs / sizeof *xs ? xs[error] : "(unknown)";
+}
+
+} // namespace xpdf::fofi
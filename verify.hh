@@ -0,0 +1,61 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_VERIFY_HH
+#define FOFI_VERIFY_HH
+
+#include <fofi.hh>
+#include <scan.hh>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xpdf::fofi {
+
+//
+// What is wrong with a font, in the order the checks are made:
+//
+enum verify_error {
+    VERIFY_OK,
+    VERIFY_FORMAT,              // Not an sfnt, e.g., a compressed one
+    VERIFY_DIRECTORY,           // Table directory past the end of the file
+    VERIFY_BOUNDS,              // Table data past the end of the file
+    VERIFY_CHECKSUM,            // Table checksum mismatch
+    VERIFY_ADJUSTMENT,          // head checkSumAdjustment mismatch
+    VERIFY_ERROR                // The file could not be read
+};
+
+//
+// The first problem found and where: the face of a collection, counting from
+// zero, and the tag of the table, if any.
+//
+struct verify_result
+{
+    verify_error error;
+    std::uint32_t face, tag;
+};
+
+//
+// Checks the integrity of a TrueType or OpenType font or collection: every
+// table record of every face lies within the file, every table sums up to its
+// checksum, and, but for collections, the whole file sums up to what the head
+// checkSumAdjustment makes it. Fails with the first problem found. Cheap enough
+// to run on every font before it is handed to a rasterizer.
+//
+bool verify(const char *, size_t, verify_result &);
+bool verify(const char *filepath, verify_result &);
+
+//
+// The sfnt checksum of a buffer, the sum of its big-endian 32-bit words, the
+// last one padded with zeros, using the same implementations as the scan:
+//
+std::uint32_t checksum(const char *, size_t, scan_impl_t = SCAN_AUTO);
+
+//
+// A short description of the error, for messages:
+//
+const char *to_string(verify_error);
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_VERIFY_HH
@@ -0,0 +1,185 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#include <cerrno>
+#include <cstdint>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <watch.hh>
+
+namespace xpdf::fofi {
+namespace {
+
+constexpr std::uint32_t events =
+    IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+    IN_MOVED_TO;
+
+} // anonymous namespace
+
+watcher::watcher(const std::vector< std::string > &roots)
+    : roots(roots), fd(-1), wake{ -1, -1 }
+{
+    if (0 != ::pipe2(wake, O_CLOEXEC))
+        return;
+
+    fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (fd < 0)
+        return;
+
+    for (const auto &root : roots)
+        add(root);
+}
+
+watcher::~watcher()
+{
+    if (fd >= 0)
+        ::close(fd);
+
+    for (auto x : wake)
+        if (x >= 0)
+            ::close(x);
+}
+
+void watcher::add(const std::string &path)
+{
+    //
+    // The directory first, so that what is created in it while its
+    // subdirectories are walked is not missed:
+    //
+    const auto watch = [this](const std::string &dir) {
+        const int wd = ::inotify_add_watch(
+            fd, dir.c_str(), events | IN_ONLYDIR | IN_DONT_FOLLOW);
+
+        if (wd >= 0)
+            dirs[wd] = dir;
+    };
+
+    std::error_code ec;
+
+    if (!fs::is_directory(fs::symlink_status(path, ec)))
+        return;
+
+    watch(path);
+
+    const auto options = fs::directory_options::skip_permission_denied;
+    fs::recursive_directory_iterator iter(path, options, ec), last;
+
+    for (; !ec && iter != last; iter.increment(ec))
+        if (iter->is_directory(ec) && !iter->is_symlink(ec))
+            watch(iter->path().string());
+}
+
+void watcher::remove(const std::string &path)
+{
+    //
+    // The directory and everything under it; the kernel keeps watching a
+    // directory moved out of the trees, under paths no longer its own:
+    //
+    const auto under = [&](const std::string &dir) {
+        return dir.size() >= path.size() &&
+            0 == dir.compare(0, path.size(), path) &&
+            (dir.size() == path.size() || '/' == dir[path.size()]);
+    };
+
+    for (auto iter = dirs.begin(); iter != dirs.end();) {
+        if (under(iter->second)) {
+            ::inotify_rm_watch(fd, iter->first);
+            iter = dirs.erase(iter);
+        } else
+            ++iter;
+    }
+}
+
+bool watcher::read(std::vector< std::string > &paths)
+{
+    alignas(inotify_event) char buf[16 << 10];
+
+    for (;;) {
+        const auto n = ::read(fd, buf, sizeof buf);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0)
+            return errno == EAGAIN;
+
+        if (0 == n)
+            return false;
+
+        for (auto p = buf; p < buf + n;) {
+            const auto &ev = *reinterpret_cast< const inotify_event * >(p);
+            p += sizeof ev + ev.len;
+
+            if (ev.mask & IN_Q_OVERFLOW) {
+                paths.insert(paths.end(), roots.begin(), roots.end());
+                continue;
+            }
+
+            const auto iter = dirs.find(ev.wd);
+
+            if (iter == dirs.end())
+                continue;
+
+            if (ev.mask & IN_IGNORED) {
+                dirs.erase(iter);
+                continue;
+            }
+
+            if (0 == ev.len)
+                continue;
+
+            auto path = (fs::path(iter->second) / ev.name).string();
+
+            //
+            // A directory that comes in is watched before its content is
+            // looked at, see add; one that goes out is not watched anymore:
+            //
+            if (ev.mask & IN_ISDIR && ev.mask & (IN_CREATE | IN_MOVED_TO))
+                add(path);
+            else if (ev.mask & IN_ISDIR && ev.mask & IN_MOVED_FROM)
+                remove(path);
+
+            paths.push_back(std::move(path));
+        }
+    }
+}
+
+bool watcher::wait(std::vector< std::string > &paths, int settle)
+{
+    for (int timeout = -1;;) {
+        pollfd fds[] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+
+        const int n = ::poll(fds, 2, timeout);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 || fds[1].revents)
+            return false;
+
+        if (0 == n)
+            return true;
+
+        if (!read(paths))
+            return false;
+
+        timeout = settle;
+    }
+}
+
+void watcher::stop()
+{
+    const char c = 0;
+    while (::write(wake[1], &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+} // namespace xpdf::fofi
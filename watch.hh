@@ -0,0 +1,58 @@
+// -*- mode: c++; -*-
+// Copyright 2019 Thinkoid, LLC
+
+#ifndef FOFI_WATCH_HH
+#define FOFI_WATCH_HH
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xpdf::fofi {
+
+//
+// Watches directory trees for changes through inotify: every directory in the
+// trees, the ones created later included, is watched for files written,
+// created, deleted, moved or touched. Directory symlinks are not followed, and
+// directories that cannot be watched, e.g., past the limit of watches of the
+// user, are not.
+//
+struct watcher
+{
+    explicit watcher(const std::vector< std::string > &roots);
+    ~watcher();
+
+    watcher(const watcher &) = delete;
+    watcher &operator=(const watcher &) = delete;
+
+    bool is_open() const { return fd >= 0; }
+
+    //
+    // Waits for changes, then collects them until `settle' milliseconds pass
+    // without any. Appends the paths that changed to `paths': files, and
+    // directories that were created, deleted or moved, as a whole. Where the
+    // events were lost, the roots are appended instead. Returns false when
+    // stopped or failed.
+    //
+    bool wait(std::vector< std::string > &paths, int settle = 100);
+
+    //
+    // Makes wait() return; safe to call from a signal handler:
+    //
+    void stop();
+
+private:
+    void add(const std::string &);
+    void remove(const std::string &);
+    bool read(std::vector< std::string > &);
+
+private:
+    std::vector< std::string > roots;
+    std::unordered_map< int, std::string > dirs;
+
+    int fd, wake[2];
+};
+
+} // namespace xpdf::fofi
+
+#endif // FOFI_WATCH_HH